@@ -0,0 +1,117 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Last booted item history
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_BOOT_HISTORY
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "boothistory.h"
+
+
+/* Return device name without /dev/ */
+static const char *device_name(const char *device)
+{
+	const char *p;
+
+	p = strrchr(device, '/');
+	return p ? p + 1 : device;
+}
+
+
+struct boot_history *boot_history_load(const char *path)
+{
+	struct boot_history *bh;
+	kx_blob b;
+
+	if (-1 == blob_load(&b, path, BOOT_HISTORY_MAGIC, BOOT_HISTORY_VERSION)) {
+		log_msg(lg, "Boot history %s is not found or invalid", path);
+		return NULL;
+	}
+
+	bh = malloc(sizeof(*bh));
+	if (NULL == bh) {
+		DPRINTF("Can't allocate boot history");
+		blob_free(&b);
+		return NULL;
+	}
+
+	bh->name = blob_get_str(&b);
+	bh->major = blob_get_u32(&b);
+	bh->minor = blob_get_u32(&b);
+	bh->blocks = blob_get_u64(&b);
+	bh->label = blob_get_str(&b);
+	bh->kernelpath = blob_get_str(&b);
+	bh->ubivol = blob_get_u32(&b);
+
+	if (b.error || !bh->name || !bh->label || !bh->kernelpath) {
+		log_msg(lg, "Boot history %s is broken", path);
+		boot_history_free(bh);
+		bh = NULL;
+	}
+
+	blob_free(&b);
+	return bh;
+}
+
+
+void boot_history_free(struct boot_history *bh)
+{
+	if (!bh) return;
+
+	dispose(bh->name);
+	dispose(bh->label);
+	dispose(bh->kernelpath);
+	free(bh);
+}
+
+
+int boot_history_match(struct boot_history *bh, struct boot_item_t *bi)
+{
+	if (!bh || !bi) return 0;
+
+	return (bi->major == bh->major) && (bi->minor == bh->minor)
+		&& (bi->blocks == bh->blocks) && (bi->ubivol == bh->ubivol)
+		&& !strcmp(device_name(bi->device), bh->name)
+		&& !strcmp(bi->label ? bi->label : "", bh->label)
+		&& !strcmp(bi->kernelpath ? bi->kernelpath : "", bh->kernelpath);
+}
+
+
+int boot_history_save(const char *path, struct boot_item_t *bi)
+{
+	kx_blob b;
+	int rc;
+
+	blob_init(&b);
+	blob_put_str(&b, device_name(bi->device));
+	blob_put_u32(&b, bi->major);
+	blob_put_u32(&b, bi->minor);
+	blob_put_u64(&b, bi->blocks);
+	blob_put_str(&b, bi->label ? bi->label : "");
+	blob_put_str(&b, bi->kernelpath ? bi->kernelpath : "");
+	blob_put_u32(&b, bi->ubivol);
+
+	rc = blob_save(&b, path, BOOT_HISTORY_MAGIC, BOOT_HISTORY_VERSION);
+	blob_free(&b);
+
+	return rc;
+}
+
+#endif	/* USE_BOOT_HISTORY */
@@ -0,0 +1,53 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Last booted item history
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_BOOTHISTORY_H_
+#define _HAVE_BOOTHISTORY_H_
+
+#include "config.h"
+
+#ifdef USE_BOOT_HISTORY
+#include "devicescan.h"
+
+#define BOOT_HISTORY_MAGIC		0x4842424b	/* "KBBH" */
+#define BOOT_HISTORY_VERSION	2
+
+/* Last booted item */
+struct boot_history {
+	char *name;					/* Device name (mmcblk0p2) */
+	int major, minor;			/* Device numbers */
+	unsigned long long blocks;	/* Device size in 1K blocks */
+	char *label;				/* Item label ("" - none) */
+	char *kernelpath;			/* Item kernel */
+	int ubivol;					/* Item UBI volume */
+};
+
+/* Read history from file 'path'. Return NULL when there is no history */
+struct boot_history *boot_history_load(const char *path);
+
+/* Free history structure */
+void boot_history_free(struct boot_history *bh);
+
+/* Check that boot item 'bi' is the one remembered in history */
+int boot_history_match(struct boot_history *bh, struct boot_item_t *bi);
+
+/* Remember boot item 'bi' as last booted one in file 'path'.
+ * Return 0 or -1 on error */
+int boot_history_save(const char *path, struct boot_item_t *bi);
+
+#endif	/* USE_BOOT_HISTORY */
+
+#endif	/* _HAVE_BOOTHISTORY_H_ */
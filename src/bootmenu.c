@@ -0,0 +1,253 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Boot menu building
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "util.h"
+#include "trace.h"
+#include "evdevs.h"
+#include "bootmenu.h"
+
+/* Create system menu */
+kx_menu *build_menu(struct params_t *params)
+{
+	kx_menu *menu;
+	kx_menu_level *ml;
+	kx_menu_item *mi;
+	
+#ifdef USE_ICONS
+	kx_picture **icons;
+	
+	if (params->gui) icons = params->gui->icons;
+	else icons = NULL;
+#endif
+	
+	/* Create menu with 2 levels (main and system) */
+	menu = menu_create(2);
+	if (!menu) {
+		DPRINTF("Can't create menu");
+		return NULL;
+	}
+	
+	/* Create main menu level */
+	menu->top = menu_level_create(menu, 4, NULL);
+	
+	/* Create system menu level */
+	ml = menu_level_create(menu, 6, menu->top);
+	if (!ml) {
+		DPRINTF("Can't create system menu");
+		return menu;
+	}
+
+	mi = menu_item_add(menu->top, A_SUBMENU, "System menu", NULL, ml);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_SYSTEM]);
+#endif
+
+	mi = menu_item_add(ml, A_PARENTMENU, "Back", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_BACK]);
+#endif
+
+	mi = menu_item_add(ml, A_RESCAN, "Rescan", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_RESCAN]);
+#endif
+
+	mi = menu_item_add(ml, A_DEBUG, "Show debug info", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_DEBUG]);
+#endif
+
+	mi = menu_item_add(ml, A_REBOOT, "Reboot", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_REBOOT]);
+#endif
+
+	mi = menu_item_add(ml, A_SHUTDOWN, "Shutdown", NULL, NULL);
+#ifdef USE_ICONS
+	if (icons) menu_item_set_data(mi, icons[ICON_SHUTDOWN]);
+#endif
+
+	if (!initmode) {
+		mi = menu_item_add(ml, A_EXIT, "Exit", NULL, NULL);
+#ifdef USE_ICONS
+		if (icons) menu_item_set_data(mi, icons[ICON_EXIT]);
+#endif
+	}
+
+	menu->current = menu->top;
+	menu_item_select(menu, 0);
+	return menu;
+}
+
+
+/* Add boot item 'i' into main menu at position 'no' */
+kx_menu_item *fill_menu_item(struct params_t *params, int i, kx_menu_dim no)
+{
+	kx_menu_item *mi;
+	kx_menu_level *ml;
+	struct boot_item_t *tbi;
+	struct bootconf_t *bl;
+	const int sizeof_desc = 160;
+	char desc[sizeof_desc], *label;
+#ifdef USE_ICONS
+	kx_picture *icon;
+	struct gui_t *gui;
+
+	gui = params->gui;
+#endif
+
+	bl = params->bootcfg;
+	ml = params->menu->top;
+	tbi = bl->list[i];
+
+	snprintf(desc, sizeof_desc, "%s %s %lluMb",
+			tbi->device, tbi->fstype, tbi->blocks/1024);
+
+	if (tbi->label)
+		label = tbi->label;
+	else
+		label = tbi->kernelpath + sizeof(MOUNTPOINT) - 1;
+
+	log_msg(lg, "+ [%s]", label);
+	mi = menu_item_insert(ml, no, A_DEVICES + i, label, desc, NULL);
+#ifdef USE_TYPE_FILTER
+	if (mi) menu_filter_add(params->filter, mi, tbi->priority);
+#endif
+
+#ifdef USE_ICONS
+	if (gui) {
+		/* Search associated with boot item icon if any */
+		icon = tbi->icondata;
+		if (!icon && (gui->icons)) {
+			/* We have no custom icon - use default */
+			switch (tbi->dtype) {
+			case DVT_STORAGE:
+				icon = gui->icons[ICON_STORAGE];
+				break;
+			case DVT_MMC:
+				icon = gui->icons[ICON_MMC];
+				break;
+			case DVT_MTD:
+				icon = gui->icons[ICON_MEMORY];
+				break;
+			case DVT_UNKNOWN:
+			default:
+				break;
+			}
+		}
+
+		/* Add icon to menu */
+		if (mi) mi->data = icon;
+	}
+#endif
+
+	return mi;
+}
+
+
+/* Boot item waiting to be added into menu */
+struct menu_pending_t {
+	int priority;
+	int i;
+};
+
+/* Higher priority first, items with equal priority in order of devices */
+static int menu_pending_cmp(const void *a, const void *b)
+{
+	const struct menu_pending_t *pa = a, *pb = b;
+
+	if (pa->priority != pb->priority)
+		return (pa->priority < pb->priority) ? 1 : -1;
+	return pa->i - pb->i;
+}
+
+
+/* Fill main menu with boot items not added yet */
+int fill_menu(struct params_t *params)
+{
+	int i, k, n, ts;
+	kx_menu_level *ml;
+	kx_menu_dim no;
+	kx_menu_id id;
+	struct bootconf_t *bl;
+	struct menu_pending_t *pending;
+
+	bl = params->bootcfg;
+
+	if ( (NULL == bl) || (bl->fill <= params->menu_filled) ) {
+#ifdef USE_ASYNC_SCAN
+		/* More items may come later */
+		if (params->scan.running) return 0;
+#endif
+		if (0 == params->menu_filled)
+			log_msg(lg, "No items for menu found");
+		return 0;
+	}
+
+	log_msg(lg, "Populating menu: %d item(s)", bl->fill - params->menu_filled);
+
+	ts = trace_begin("fill_menu", NULL);
+	ml = params->menu->top;
+
+	pending = malloc((bl->fill - params->menu_filled) * sizeof(*pending));
+	if ( (NULL == pending) || (-1 == menu_level_reserve(ml,
+			ml->count + bl->fill - params->menu_filled)) )
+	{
+		DPRINTF("Can't allocate memory for menu items");
+		dispose(pending);
+		trace_end(ts);
+		return -1;
+	}
+
+	for (i = params->menu_filled, n = 0; i < bl->fill; i++) {
+		if (!bl->list[i]) continue;		/* Removed already */
+		pending[n].priority = bl->list[i]->priority;
+		pending[n].i = i;
+		++n;
+	}
+	qsort(pending, n, sizeof(*pending), menu_pending_cmp);
+
+	/* Menu is sorted already so merge new items in one pass */
+	for (k = 0, no = 0; k < n; k++, no++) {
+		for (; no < ml->count; no++) {
+			id = ml->list[no]->id;
+			if ( (id >= A_DEVICES) && (bl->list[id - A_DEVICES]->priority
+					< pending[k].priority) )
+				break;
+		}
+
+		if (NULL == fill_menu_item(params, pending[k].i, no)) {
+			DPRINTF("Can't add item to menu");
+			free(pending);
+			trace_end(ts);
+			return -1;
+		}
+	}
+	free(pending);
+
+	params->menu_filled = bl->fill;
+#ifdef USE_TYPE_FILTER
+	/* New items may match filter being typed */
+	menu_filter_update(params->filter, params->menu);
+#endif
+	trace_end(ts);
+
+	return 0;
+}
@@ -0,0 +1,32 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Boot menu building
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_BOOTMENU_H_
+#define _HAVE_BOOTMENU_H_
+
+#include "kexecboot.h"
+
+/* Create menu with system submenu and no boot items */
+kx_menu *build_menu(struct params_t *params);
+
+/* Add boot item 'i' of bootcfg into main menu at position 'no' */
+kx_menu_item *fill_menu_item(struct params_t *params, int i, kx_menu_dim no);
+
+/* Add bootcfg items not added yet into main menu keeping it sorted
+ * by priority. Return -1 on error */
+int fill_menu(struct params_t *params);
+
+#endif	/* _HAVE_BOOTMENU_H_ */
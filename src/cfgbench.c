@@ -0,0 +1,142 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Config file parser benchmark
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Usage: kexecboot-cfgbench [<sections> [<rounds>]]
+ *
+ * Parses synthetic config file with given number of sections and reports
+ * time per section. Time of copying values (what setters do with strdup()
+ * and set_path()) is reported separately to see its share.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+
+#define APPEND_LEN	200
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write config file with 'count' sections to 'f' */
+static void write_cfg(FILE *f, unsigned int count)
+{
+	char append[APPEND_LEN + 1];
+	unsigned int i;
+
+	memset(append, 'x', APPEND_LEN);
+	append[APPEND_LEN] = '\0';
+
+	fprintf(f, "# Synthetic config\nTIMEOUT=10\nUI=gui\nDEBUG=off\n");
+	for (i = 0; i < count; i++) {
+		fprintf(f, "\n# Section %u\n", i);
+		fprintf(f, "LABEL=Linux %u\n", i);
+		fprintf(f, "KERNEL=/boot/zImage-%u\n", i);
+		fprintf(f, "DTB=/boot/board-%u.dtb\n", i);
+		fprintf(f, "INITRD = /boot/initrd-%u.img\n", i);
+		fprintf(f, "APPEND=console=ttyS0,115200 root=/dev/mmcblk0p%u %s\n",
+				i % 8, append);
+		fprintf(f, "PRIORITY=%u\n", i % 100);
+		if (0 == i % 1000) fprintf(f, "DEFAULT\n");
+	}
+}
+
+/* Copy values of all sections like setters do */
+static void copy_values(struct cfgdata_t *cfgdata)
+{
+	kx_cfg_section *sc;
+	char *p[5];
+	unsigned int i, j;
+
+	for (i = 0; i < cfgdata->count; i++) {
+		sc = cfgdata->list[i];
+		p[0] = strdup(sc->label);
+		p[1] = strdup(sc->kernelpath);
+		p[2] = strdup(sc->dtbpath);
+		p[3] = strdup(sc->initrd);
+		p[4] = strdup(sc->cmdline_append);
+		for (j = 0; j < 5; j++) free(p[j]);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	struct cfgdata_t cfgdata;
+	char path[] = "/tmp/kexecboot-cfgbench.XXXXXX";
+	unsigned int count, rounds, i;
+	double t, parse, copy;
+	FILE *f;
+	int fd;
+
+	count = (argc > 1) ? atoi(argv[1]) : 5000;
+	rounds = (argc > 2) ? atoi(argv[2]) : 20;
+	if ((0 == count) || (0 == rounds)) {
+		fprintf(stderr, "Usage: %s [<sections> [<rounds>]]\n", argv[0]);
+		return 2;
+	}
+
+	fd = mkstemp(path);
+	if ((-1 == fd) || (NULL == (f = fdopen(fd, "w")))) {
+		fprintf(stderr, "Can't create %s: %s\n", path, ERRMSG);
+		return 1;
+	}
+	write_cfg(f, count);
+	fclose(f);
+
+	parse = 0;
+	copy = 0;
+	for (i = 0; i < rounds; i++) {
+		init_cfgdata(&cfgdata);
+
+		t = now();
+		parse_cfgfile(path, &cfgdata);
+		parse += now() - t;
+
+		if (cfgdata.count != count) {
+			fprintf(stderr, "Parsed %u sections of %u\n", cfgdata.count, count);
+			unlink(path);
+			return 1;
+		}
+
+		t = now();
+		copy_values(&cfgdata);
+		copy += now() - t;
+
+		destroy_cfgdata(&cfgdata);
+	}
+	unlink(path);
+
+	printf("%u sections, %u rounds\n", count, rounds);
+	printf("parse:  %8.3f ms/file %8.1f ns/section\n",
+			parse * 1e3 / rounds, parse * 1e9 / rounds / count);
+	printf("copies: %8.3f ms/file %8.1f ns/section (%.1f%% of parse)\n",
+			copy * 1e3 / rounds, copy * 1e9 / rounds / count,
+			100 * copy / parse);
+
+	return 0;
+}
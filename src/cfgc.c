@@ -0,0 +1,77 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Config file compiler
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Usage: kexecboot-cfgc <boot.cfg> [<boot.cfgb>]
+ *
+ * Compiled file is written next to config file by default. It is used
+ * by kexecboot built with the same configure options while config file
+ * have the same size and modification time, so copy both files with
+ * times preserved (cp -p, tar, mkfs -d). Numbers are stored little-endian,
+ * so host and target may have different byte order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "util.h"
+#include "cfgparser.h"
+
+int main(int argc, char **argv)
+{
+	struct cfgdata_t cfgdata;
+	struct stat st;
+	char *out;
+
+	if ((argc < 2) || (argc > 3)) {
+		fprintf(stderr, "Usage: %s <boot.cfg> [<boot.cfgb>]\n", argv[0]);
+		return 2;
+	}
+
+	if (3 == argc) {
+		out = strdup(argv[2]);
+	} else {
+		out = malloc(strlen(argv[1]) + 2);
+		if (out) sprintf(out, "%sb", argv[1]);
+	}
+	if (NULL == out) {
+		fprintf(stderr, "Can't allocate memory\n");
+		return 1;
+	}
+
+	init_cfgdata(&cfgdata);
+	if ( (-1 == stat(argv[1], &st))
+		|| (-1 == parse_cfgfile(argv[1], &cfgdata)) )
+	{
+		fprintf(stderr, "Can't read %s: %s\n", argv[1], ERRMSG);
+		return 1;
+	}
+
+	if (-1 == cfgb_save(out, &cfgdata, &st)) {
+		fprintf(stderr, "Can't write %s\n", out);
+		return 1;
+	}
+
+	printf("%s: %u section(s) written to %s\n", argv[1], cfgdata.count, out);
+	destroy_cfgdata(&cfgdata);
+	free(out);
+
+	return 0;
+}
@@ -23,11 +23,36 @@
 #include <sys/mount.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
 
 #include "config.h"
 #include "util.h"
 #include "cfgparser.h"
 
+#ifdef USE_ICONS
+#include "fb.h"
+#endif
+
+/* Make room for 'size' sections in cfgdata */
+static int cfgdata_reserve(struct cfgdata_t *cfgdata, unsigned int size)
+{
+	kx_cfg_section **new_list;
+
+	if (size <= cfgdata->size) return 0;
+
+	new_list = realloc(cfgdata->list, size * sizeof(*(cfgdata->list)));
+	if (NULL == new_list) {
+		DPRINTF("Can't resize cfgdata sections list");
+		return -1;
+	}
+
+	cfgdata->size = size;
+	cfgdata->list = new_list;
+	return 0;
+}
+
 kx_cfg_section *cfg_section_new(struct cfgdata_t *cfgdata)
 {
 	kx_cfg_section *sc;
@@ -66,6 +91,7 @@ kx_cfg_section *cfg_section_new(struct cfgdata_t *cfgdata)
 	sc->icondata = NULL;
 	sc->priority = 0;
 	sc->is_default = 0;
+	sc->ubivol = 0;
 
 	cfgdata->list[cfgdata->count++] = sc;
 	cfgdata->current = sc;
@@ -94,20 +120,35 @@ void init_cfgdata(struct cfgdata_t *cfgdata)
 	cfgdata->mtdparts = NULL;
 	cfgdata->fbcon = NULL;
 	cfgdata->ttydev = NULL;
+#ifdef USE_PROBE_TIMEOUT
+	cfgdata->probe_timeout = USE_PROBE_TIMEOUT;
+#endif
 }
 
 void destroy_cfgdata(struct cfgdata_t *cfgdata)
 {
 	int i;
+	kx_cfg_section *sc;
 
 	if (!cfgdata) return;
 	if (!cfgdata->list) return;
 
 	for(i = 0; i < cfgdata->count; i++) {
-		if (cfgdata->list[i]) {
-			dispose(cfgdata->list[i]->iconpath);
-			free(cfgdata->list[i]);
-		}
+		sc = cfgdata->list[i];
+		if (!sc) continue;
+
+		dispose(sc->label);
+		dispose(sc->dtbpath);
+		dispose(sc->kernelpath);
+		dispose(sc->cmdline_append);
+		dispose(sc->cmdline);
+		dispose(sc->initrd);
+		dispose(sc->iconpath);
+#ifdef USE_ICONS
+		/* Icon is not taken by boot item */
+		fb_destroy_picture(sc->icondata);
+#endif
+		free(sc);
 	}
 	free(cfgdata->list);
 
@@ -116,18 +157,21 @@ void destroy_cfgdata(struct cfgdata_t *cfgdata)
 
 static int set_path(char **path, char *value)
 {
+	size_t len;
+
 	dispose(*path);
 
 	/* Prepend the current  mountpoint, since the enduser won't know it */
-	*path = malloc(strlen(MOUNTPOINT) + strlen(value) + 1);
+	len = strlen(value) + 1;
+	*path = malloc(sizeof(MOUNTPOINT) - 1 + len);
 	if (NULL == *path) {
 		DPRINTF("Can't allocate memory to store path '%s'", value);
 
 		return -1;
 	}
 
-	strcpy(*path, MOUNTPOINT);
-	strcat(*path, value);
+	memcpy(*path, MOUNTPOINT, sizeof(MOUNTPOINT) - 1);
+	memcpy(*path + sizeof(MOUNTPOINT) - 1, value, len);
 
 	return 0;
 }
@@ -366,6 +410,21 @@ static int set_ttydev(struct cfgdata_t *cfgdata, char *value)
 	return 0;
 }
 
+#ifdef USE_PROBE_TIMEOUT
+static int set_probe_timeout(struct cfgdata_t *cfgdata, char *value)
+{
+	int i;
+
+	i = get_nni(value, NULL);
+	if (i < 0) {
+		log_msg(lg, "Can't convert '%s' to integer", value);
+		return -1;
+	}
+	cfgdata->probe_timeout = i;
+	return 0;
+}
+#endif
+
 enum cfg_type_t { CFG_NONE, CFG_FILE, CFG_CMDLINE };
 
 /* Config file (keywords -> parsing functions) tuples array */
@@ -376,52 +435,99 @@ struct cfg_keyfunc_t {
 	int (*keyfunc)(struct cfgdata_t *, char *);
 };
 
-static struct cfg_keyfunc_t cfg_keyfunc[] = {
+/* Perfect hash of keyword of length 'len' starting with uppercased
+ * chars 'c0' and 'c1'. It has no collisions for keywords below */
+#define CFG_HASH_SIZE	32
+#define CFG_HASH(len, c0, c1) \
+	(((len) + (((c0) + (c1)) << 2)) & (CFG_HASH_SIZE - 1))
+#define CFG_KEY(c0, c1, type, has_value, kw, func) \
+	[CFG_HASH(sizeof(kw) - 1, c0, c1)] = { type, has_value, kw, func }
+
+/* Keywords are placed to their slots at compile time. Keep slots unique
+ * when adding keyword: keyword put into taken slot overrides previous
+ * one, build fails then as Makefile.am sets -Werror=override-init */
+static const struct cfg_keyfunc_t cfg_keyfunc[CFG_HASH_SIZE] = {
 	/* Global bootmenu settings */
-	{ CFG_FILE, 1, "TIMEOUT", set_timeout },
-	{ CFG_FILE, 1, "UI", set_ui },
-	{ CFG_FILE,-1, "DEBUG", set_debug },
+	CFG_KEY('T', 'I', CFG_FILE, 1, "TIMEOUT", set_timeout),
+	CFG_KEY('U', 'I', CFG_FILE, 1, "UI", set_ui),
+	CFG_KEY('D', 'E', CFG_FILE,-1, "DEBUG", set_debug),
 	/* Individual item settings */
-	{ CFG_FILE, 0, "DEFAULT", set_default },
-	{ CFG_FILE, 1, "LABEL", set_label },
-	{ CFG_FILE, 1, "DTB", set_dtb },
-	{ CFG_FILE, 1, "KERNEL", set_kernel },
-	{ CFG_FILE, 1, "ICON", set_icon },
-	{ CFG_FILE, 1, "APPEND", set_cmdline_append },
-	{ CFG_FILE, 1, "CMDLINE", set_cmdline },
-	{ CFG_FILE, 1, "INITRD", set_initrd },
-	{ CFG_FILE, 1, "PRIORITY", set_priority },
-	{ CFG_CMDLINE, 1, "FBCON", set_fbcon },
-	{ CFG_CMDLINE, 1, "MTDPARTS", set_mtdparts },
-	{ CFG_CMDLINE, 1, "CONSOLE", set_ttydev },
-
-	{ CFG_NONE, 0, NULL, NULL }
+	CFG_KEY('D', 'E', CFG_FILE, 0, "DEFAULT", set_default),
+	CFG_KEY('L', 'A', CFG_FILE, 1, "LABEL", set_label),
+	CFG_KEY('D', 'T', CFG_FILE, 1, "DTB", set_dtb),
+	CFG_KEY('K', 'E', CFG_FILE, 1, "KERNEL", set_kernel),
+	CFG_KEY('I', 'C', CFG_FILE, 1, "ICON", set_icon),
+	CFG_KEY('A', 'P', CFG_FILE, 1, "APPEND", set_cmdline_append),
+	CFG_KEY('C', 'M', CFG_FILE, 1, "CMDLINE", set_cmdline),
+	CFG_KEY('I', 'N', CFG_FILE, 1, "INITRD", set_initrd),
+	CFG_KEY('P', 'R', CFG_FILE, 1, "PRIORITY", set_priority),
+	CFG_KEY('F', 'B', CFG_CMDLINE, 1, "FBCON", set_fbcon),
+	CFG_KEY('M', 'T', CFG_CMDLINE, 1, "MTDPARTS", set_mtdparts),
+	CFG_KEY('C', 'O', CFG_CMDLINE, 1, "CONSOLE", set_ttydev),
+#ifdef USE_PROBE_TIMEOUT
+	CFG_KEY('K', 'E', CFG_CMDLINE, 1, "KEXECBOOT.PROBE_TIMEOUT", set_probe_timeout),
+#endif
 };
 
 
 /* Process specified keyword */
 int process_keyword(enum cfg_type_t cfg_type, struct cfgdata_t *cfgdata, char *keyword, char *value)
 {
-	struct cfg_keyfunc_t *kf;
-	char ukey[strlen(keyword) + 1];
+	const struct cfg_keyfunc_t *kf;
+	size_t len;
 
-	/* For convenience convert keyword to lowercase */
-	strtoupper(keyword, ukey);
+	/* Keywords are case-insensitive */
+	len = strlen(keyword);
+	if (len < 2) return -1;
+	kf = &cfg_keyfunc[CFG_HASH(len, toupper(keyword[0]), toupper(keyword[1]))];
 
 	/* See if given keyword is known and call appropriate function */
-	for (kf = cfg_keyfunc; kf->keyword != NULL; kf++) {
-		if (cfg_type != kf->type) continue;
-		if (0 == strcmp(ukey, kf->keyword)) {
-			if ( (1 == kf->has_value) && (NULL == value) ) {
-				log_msg(lg, "+ keyword '%s' should have value", ukey);
-				return -1;
-			}
-			return kf->keyfunc(cfgdata, value);
-		}
+	if ( (cfg_type != kf->type) || strcasecmp(keyword, kf->keyword) ) {
+		/* Coming this far, keyword was not found */
+		return -1;
+	}
+
+	if ( (1 == kf->has_value) && (NULL == value) ) {
+		log_msg(lg, "+ keyword '%s' should have value", kf->keyword);
+		return -1;
+	}
+	return kf->keyfunc(cfgdata, value);
+}
+
+
+/* Read whole file 'path' into NUL-terminated buffer. Return NULL on error */
+static char *cfg_read_file(const char *path)
+{
+	struct stat st;
+	char *buf;
+	ssize_t n;
+	size_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd) return NULL;
+
+	if ((-1 == fstat(fd, &st)) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return NULL;
 	}
 
-	/* Coming this far, keyword was not found */
-	return -1;
+	buf = malloc(st.st_size + 1);
+	if (NULL == buf) {
+		DPRINTF("Can't allocate memory for config file");
+		close(fd);
+		return NULL;
+	}
+
+	/* File may be shorter than it was said by fstat() */
+	len = 0;
+	while ( (len < st.st_size)
+			&& ((n = read(fd, buf + len, st.st_size - len)) > 0) )
+		len += n;
+	close(fd);
+
+	buf[len] = '\0';
+	return buf;
 }
 
 
@@ -430,24 +536,26 @@ int process_keyword(enum cfg_type_t cfg_type, struct cfgdata_t *cfgdata, char *k
 int parse_cfgfile(char *path, struct cfgdata_t *cfgdata)
 {
 	int linenr = 0;
-	FILE *f;
-	char *c;
+	char *buf;
+	char *c, *next;
 	char *keyword;
 	char *value;
-	char line[256];
 
-	/* Open the config file */
-	f = fopen(path, "r");
-	if (NULL == f) {
+	/* Read the config file at once. Lines are split in place */
+	buf = cfg_read_file(path);
+	if (NULL == buf) {
 		log_msg(lg, "+ can't open config file: %s", ERRMSG);
 		return -1;
 	}
 
-	/* Read config file line by line */
-	while (fgets(line, sizeof(line), f)) {
+	for (c = buf; '\0' != *c; c = next) {
 		++linenr;
+		next = strchr(c, '\n');
+		if (next) *next++ = '\0';
+		else next = c + strlen(c);
+
 		/* Skip white-space from beginning */
-		keyword = ltrim(line);
+		keyword = ltrim(c);
 
 		if ( ('\0' == keyword[0]) || ('#' == keyword[0]) ) {
 			/* Skip comment or empty line */
@@ -469,11 +577,11 @@ int parse_cfgfile(char *path, struct cfgdata_t *cfgdata)
 
 		/* Process keyword and value */
 		if (-1 == process_keyword(CFG_FILE, cfgdata, keyword, value)) {
-			log_msg(lg, "Can't parse keyword '%s'", keyword);
+			log_msg(lg, "Can't parse keyword '%s' at line %d", keyword, linenr);
 		}
 	}
 
-	fclose(f);
+	free(buf);
 	return 0;
 }
 
@@ -528,6 +636,27 @@ int parse_cmdline(struct cfgdata_t *cfgdata)
 	return 0;
 }
 
+/* Move sections of 'src' to end of 'dst' and destroy 'src' */
+int cfgdata_move(struct cfgdata_t *dst, struct cfgdata_t *src)
+{
+	unsigned int i;
+
+	if (-1 == cfgdata_reserve(dst, dst->count + src->count)) return -1;
+
+	for (i = 0; i < src->count; i++) {
+		dst->list[dst->count++] = src->list[i];
+		src->list[i] = NULL;
+	}
+
+	/* Global settings of first config file are kept */
+	if ((dst->timeout <= 0) && (src->timeout > 0)) dst->timeout = src->timeout;
+	if (src->debug > 0) dst->debug = src->debug;
+	if (dst->ui != src->ui) dst->ui = src->ui;
+
+	destroy_cfgdata(src);
+	return 0;
+}
+
 /* Set kernelpath only (may be used when no config file found) */
 int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath)
 {
@@ -540,3 +669,205 @@ int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath)
 	sc->kernelpath = strdup(kernelpath);
 	return 0;
 }
+
+/* Relocate 'path' (which starts with MOUNTPOINT) to 'mountpoint' */
+char *cfg_path_at(char *buf, size_t size, const char *mountpoint,
+		const char *path)
+{
+	if (!strncmp(path, MOUNTPOINT, sizeof(MOUNTPOINT) - 1))
+		path += sizeof(MOUNTPOINT) - 1;
+
+	snprintf(buf, size, "%s%s", mountpoint, path);
+	return buf;
+}
+
+#ifdef USE_BLOBS
+#ifdef USE_ICONS
+static void pack_icon(kx_blob *b, kx_picture *pic)
+{
+	unsigned int i;
+
+	if (NULL == pic) {
+		blob_put_u32(b, 0);
+		blob_put_u32(b, 0);
+		return;
+	}
+
+	blob_put_u32(b, pic->width);
+	blob_put_u32(b, pic->height);
+	for (i = 0; i < pic->width * pic->height; i++)
+		blob_put_u32(b, pic->pixels[i]);
+}
+
+static kx_picture *unpack_icon(kx_blob *b)
+{
+	kx_picture *pic;
+	unsigned int width, height, i;
+
+	width = blob_get_u32(b);
+	height = blob_get_u32(b);
+	if (b->error || (0 == width) || (0 == height)) return NULL;
+
+	/* Don't trust sizes too much */
+	if ((size_t)width * height * sizeof(*pic->pixels) > b->fill - b->pos) {
+		b->error = 1;
+		return NULL;
+	}
+
+	pic = malloc(sizeof(*pic));
+	if (NULL == pic) {
+		DPRINTF("Can't allocate memory for icon");
+		b->error = 1;
+		return NULL;
+	}
+
+	pic->width = width;
+	pic->height = height;
+	pic->pixels = malloc(width * height * sizeof(*pic->pixels));
+	if (NULL == pic->pixels) {
+		DPRINTF("Can't allocate memory for icon pixels");
+		free(pic);
+		b->error = 1;
+		return NULL;
+	}
+	for (i = 0; i < width * height; i++)
+		pic->pixels[i] = blob_get_u32(b);
+
+	return pic;
+}
+#endif
+
+/* Append serialized 'cfgdata' to blob 'b'. Return 0 or -1 on error */
+int cfgdata_pack(kx_blob *b, struct cfgdata_t *cfgdata)
+{
+	kx_cfg_section *sc;
+	unsigned int i, count;
+
+	blob_put_u32(b, cfgdata->timeout);
+	blob_put_u32(b, cfgdata->ui);
+	blob_put_u32(b, cfgdata->debug);
+
+	count = 0;
+	for (i = 0; i < cfgdata->count; i++)
+		if (cfgdata->list[i]) ++count;
+	blob_put_u32(b, count);
+
+	for (i = 0; i < cfgdata->count; i++) {
+		sc = cfgdata->list[i];
+		if (!sc) continue;
+
+		blob_put_str(b, sc->label);
+		blob_put_str(b, sc->dtbpath);
+		blob_put_str(b, sc->kernelpath);
+		blob_put_str(b, sc->cmdline_append);
+		blob_put_str(b, sc->cmdline);
+		blob_put_str(b, sc->initrd);
+		blob_put_str(b, sc->iconpath);
+		blob_put_u32(b, sc->is_default);
+		blob_put_u32(b, sc->priority);
+		blob_put_u32(b, sc->ubivol);
+#ifdef USE_ICONS
+		pack_icon(b, sc->icondata);
+#endif
+	}
+
+	return b->error ? -1 : 0;
+}
+
+/* Restore cfgdata from blob 'b' at current position.
+ * Return 0 or -1 on error (cfgdata is destroyed then) */
+int cfgdata_unpack(kx_blob *b, struct cfgdata_t *cfgdata)
+{
+	kx_cfg_section *sc;
+	unsigned int count;
+
+	init_cfgdata(cfgdata);
+	if (NULL == cfgdata->list) return -1;
+
+	cfgdata->timeout = blob_get_u32(b);
+	cfgdata->ui = blob_get_u32(b);
+	cfgdata->debug = blob_get_u32(b);
+
+	/* Every section takes more than 4 bytes so don't trust bigger count */
+	count = blob_get_u32(b);
+	if (!b->error && (count <= (b->fill - b->pos) / 4))
+		cfgdata_reserve(cfgdata, count);
+
+	for (; !b->error && (count > 0); count--) {
+		sc = cfg_section_new(cfgdata);
+		if (!sc) {
+			b->error = 1;
+			break;
+		}
+
+		sc->label = blob_get_str(b);
+		sc->dtbpath = blob_get_str(b);
+		sc->kernelpath = blob_get_str(b);
+		sc->cmdline_append = blob_get_str(b);
+		sc->cmdline = blob_get_str(b);
+		sc->initrd = blob_get_str(b);
+		sc->iconpath = blob_get_str(b);
+		sc->is_default = blob_get_u32(b);
+		sc->priority = blob_get_u32(b);
+		sc->ubivol = blob_get_u32(b);
+#ifdef USE_ICONS
+		sc->icondata = unpack_icon(b);
+#endif
+	}
+
+	if (b->error) {
+		log_msg(lg, "Can't restore config data");
+		destroy_cfgdata(cfgdata);
+		return -1;
+	}
+
+	return 0;
+}
+#endif
+
+#ifdef USE_BINARY_CFG
+/* Compiled config file is stale when config file is changed since */
+static void cfgb_put_stat(kx_blob *b, struct stat *st)
+{
+	blob_put_u64(b, st->st_size);
+	blob_put_u64(b, st->st_mtime);
+}
+
+int cfgb_save(const char *path, struct cfgdata_t *cfgdata, struct stat *st)
+{
+	kx_blob b;
+	int rc;
+
+	blob_init(&b);
+	cfgb_put_stat(&b, st);
+	rc = cfgdata_pack(&b, cfgdata);
+	if (0 == rc)
+		rc = blob_save(&b, path, BOOTCFGB_MAGIC, BOOTCFGB_VERSION);
+	blob_free(&b);
+
+	return rc;
+}
+
+int cfgb_load(const char *path, struct cfgdata_t *cfgdata, struct stat *st)
+{
+	kx_blob b;
+	uint64_t size, mtime;
+	int rc;
+
+	if (-1 == blob_load(&b, path, BOOTCFGB_MAGIC, BOOTCFGB_VERSION))
+		return -1;
+
+	size = blob_get_u64(&b);
+	mtime = blob_get_u64(&b);
+	if (b.error || (size != st->st_size) || (mtime != st->st_mtime)) {
+		log_msg(lg, "+ compiled config file is stale");
+		blob_free(&b);
+		return -1;
+	}
+
+	rc = cfgdata_unpack(&b, cfgdata);
+	blob_free(&b);
+
+	return rc;
+}
+#endif
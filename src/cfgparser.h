@@ -19,11 +19,28 @@
 #ifndef _HAVE_CONFIGPARSER_H
 #define _HAVE_CONFIGPARSER_H
 
+#include <stddef.h>
+
 #include "config.h"
 #include "util.h"
 
 #define MOUNTPOINT	"/mnt"
-#define BOOTCFG_PATH MOUNTPOINT "/boot/boot.cfg"
+#define BOOTCFG_FILE	"/boot/boot.cfg"
+#define BOOTCFG_PATH MOUNTPOINT BOOTCFG_FILE
+
+#ifdef USE_BINARY_CFG
+/* Compiled config file (see kexecboot-cfgc) */
+#define BOOTCFGB_FILE	BOOTCFG_FILE "b"
+#define BOOTCFGB_PATH MOUNTPOINT BOOTCFGB_FILE
+
+#define BOOTCFGB_MAGIC		0x4642424b	/* "KBBF" */
+/* Sections are packed with icons data when icons are used */
+#ifdef USE_ICONS
+#define BOOTCFGB_VERSION	0x101
+#else
+#define BOOTCFGB_VERSION	1
+#endif
+#endif
 
 enum ui_type_t { GUI, TEXTUI };
 
@@ -38,6 +55,7 @@ typedef struct {
 	void *icondata;		/* Icon data */
 	int is_default;		/* Use section as default? */
 	int priority;		/* Priority of item in menu */
+	int ubivol;			/* UBI volume section is found on */
 } kx_cfg_section;
 
 /* Config file data structure */
@@ -56,6 +74,9 @@ struct cfgdata_t {
 	char *fbcon;		/* fbcon tag */
 	char *mtdparts;		/* MTD partitioning */
 	char *ttydev;		/* Console tty device name */
+#ifdef USE_PROBE_TIMEOUT
+	int probe_timeout;	/* Seconds to probe one device (0 - forever) */
+#endif
 };
 
 /* Clean config file structure */
@@ -64,6 +85,10 @@ void init_cfgdata(struct cfgdata_t *cfgdata);
 /* Free config file sections */
 void destroy_cfgdata(struct cfgdata_t *cfgdata);
 
+/* Move sections of 'src' to end of 'dst' and destroy 'src'.
+ * Return 0 or -1 on error ('src' is left as is then) */
+int cfgdata_move(struct cfgdata_t *dst, struct cfgdata_t *src);
+
 /* Set kernelpath only (may be used when no config file found) */
 int cfgdata_add_kernel(struct cfgdata_t *cfgdata, char *kernelpath);
 
@@ -73,4 +98,30 @@ int parse_cfgfile(char *cfgpath, struct cfgdata_t *cfgdata);
 
 int parse_cmdline(struct cfgdata_t *cfgdata);
 
+#ifdef USE_BLOBS
+/* Append serialized 'cfgdata' to blob 'b'. Return 0 or -1 on error */
+int cfgdata_pack(kx_blob *b, struct cfgdata_t *cfgdata);
+
+/* Restore cfgdata from blob 'b' at current position.
+ * Return 0 or -1 on error (cfgdata is destroyed then) */
+int cfgdata_unpack(kx_blob *b, struct cfgdata_t *cfgdata);
+#endif
+
+#ifdef USE_BINARY_CFG
+#include <sys/stat.h>
+
+/* Write 'cfgdata' parsed from config file with status 'st' to compiled
+ * config file 'path'. Return 0 or -1 on error */
+int cfgb_save(const char *path, struct cfgdata_t *cfgdata, struct stat *st);
+
+/* Read compiled config file 'path' into 'cfgdata' when it is made from
+ * config file with status 'st'. Return 0 or -1 when file is missing,
+ * broken or stale (cfgdata is not initialized then) */
+int cfgb_load(const char *path, struct cfgdata_t *cfgdata, struct stat *st);
+#endif
+
+/* Relocate 'path' (which starts with MOUNTPOINT) to 'mountpoint' */
+char *cfg_path_at(char *buf, size_t size, const char *mountpoint,
+		const char *path);
+
 #endif /* _HAVE_CONFIGPARSER_H */
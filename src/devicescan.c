@@ -25,41 +25,18 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <dirent.h>
 
 #include "fstype/fstype.h"
+#include "fstype/fsregistry.h"
+#include "fstype/fslookup.h"
 #include "util.h"
 #include "devicescan.h"
+#include "trace.h"
 #include "config.h"
 
 
-/* Create charlist of known filesystems */
-struct charlist *scan_filesystems()
-{
-	char *split;
-	struct charlist *fl;
-	char line[80];
-
-	fl = create_charlist(8);
-	// make a list of all known filesystems
-	FILE *f = fopen("/proc/filesystems", "r");
-
-	if (NULL == f) {
-		log_msg(lg, "+ can't open /proc/filesystems: %s", ERRMSG);
-		free_charlist(fl);
-		return NULL;
-	}
-
-	while (fgets(line, sizeof(line), f)) {
-		line[strlen(line) - 1] = '\0';	/* kill last '\n' */
-		split = strchr(line, '\t');
-		split++;
-		addto_charlist(fl, split);	/* NOTE: strdup() may return NULL */
-	}
-	fclose(f);
-	return fl;
-}
-
-
 /* Allocate bootconf structure */
 struct bootconf_t *create_bootcfg(unsigned int size)
 {
@@ -77,6 +54,10 @@ struct bootconf_t *create_bootcfg(unsigned int size)
 	bc->size = size;
 	bc->fill = 0;
 
+	bc->devs = NULL;
+	bc->devs_size = 0;
+	bc->devs_fill = 0;
+
 	bc->timeout = 0;
 	bc->default_item = NULL;
 	bc->ui = GUI;
@@ -100,29 +81,139 @@ static struct dtypes_t dtypes[] = {
 	{ DVT_UNKNOWN, 0, NULL }
 };
 
+/* Remember device scanned into bootconf. Return NULL on error */
+static struct bootdev_t *bootcfg_add_device(struct bootconf_t *bc,
+		struct device_t *dev)
+{
+	struct bootdev_t *bd;
+
+	bd = bootcfg_find_device(bc, dev->major, dev->minor, dev->blocks);
+	if (bd) {
+		bd->seen = 1;
+		return bd;
+	}
+
+	/* Resize list when needed before adding device */
+	if (bc->devs_fill >= bc->devs_size) {
+		struct bootdev_t *new_devs;
+		unsigned int new_size;
+
+		new_size = bc->devs_size ? bc->devs_size * 2 : 8;
+		new_devs = realloc(bc->devs, new_size * sizeof(*(bc->devs)));
+		if (NULL == new_devs) {
+			DPRINTF("Can't resize bootconf devices list");
+			return NULL;
+		}
+		bc->devs_size = new_size;
+		bc->devs = new_devs;
+	}
+
+	bd = &bc->devs[bc->devs_fill++];
+	bd->major = dev->major;
+	bd->minor = dev->minor;
+	bd->blocks = dev->blocks;
+	bd->seen = 1;
+	arena_init(&bd->arena);
+
+	return bd;
+}
+
+
+struct bootdev_t *bootcfg_find_device(struct bootconf_t *bc,
+		int major, int minor, unsigned long long blocks)
+{
+	unsigned int i;
+
+	for (i = 0; i < bc->devs_fill; i++) {
+		if ((bc->devs[i].major == major) && (bc->devs[i].minor == minor)
+				&& (bc->devs[i].blocks == blocks))
+			return &bc->devs[i];
+	}
+
+	return NULL;
+}
+
+
+void bootcfg_sweep_devices(struct bootconf_t *bc)
+{
+	unsigned int i;
+
+	for (i = 0; i < bc->devs_fill; ) {
+		if (bc->devs[i].seen) {
+			++i;
+			continue;
+		}
+
+		/* Boot items of device are removed already */
+		arena_free(&bc->devs[i].arena);
+		bc->devs[i] = bc->devs[--bc->devs_fill];
+	}
+}
+
+
+/* Copy string 'src' (may be NULL) into arena. Return 0 or -1 on error */
+static int arena_copy(kx_arena *a, char **dst, const char *src)
+{
+	*dst = arena_strdup(a, src);
+	return (src && !*dst) ? -1 : 0;
+}
+
+
 /* Import values from cfgdata and boot to bootconf */
 int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 		struct cfgdata_t *cfgdata)
 {
 	struct boot_item_t *bi;
+	struct bootdev_t *bd;
 	struct dtypes_t *dt;
 	int i;
 	kx_cfg_section *sc;
+	char *device;
+
+	bd = bootcfg_add_device(bc, dev);
+	if (!bd) return -1;
+	if (!cfgdata) return 0;
+
+	/* Items are allocated in arena of device and freed with device */
+	device = arena_strdup(&bd->arena, dev->device);
+	if (NULL == device) {
+		DPRINTF("Can't allocate memory for device name");
+		return -1;
+	}
+
+	/* Make room for all sections at once (one slot is kept free) */
+	if (bc->fill + cfgdata->count >= bc->size) {
+		struct boot_item_t **new_list;
+		unsigned int new_size;
+
+		new_size = bc->size;
+		while (bc->fill + cfgdata->count >= new_size) new_size <<= 1;
+		new_list = realloc( bc->list, new_size * sizeof(*(bc->list)) );
+		if (NULL == new_list) {
+			DPRINTF("Can't resize boot structure");
+			return -1;
+		}
+
+		bc->list = new_list;
+		bc->size = new_size;
+	}
 
 	/* Go through all found config file sections */
 	for (i = 0; i < cfgdata->count; i++) {
 		sc = cfgdata->list[i];
 		if (!sc) continue;
 
-		bi = malloc(sizeof(*bi));
+		bi = arena_alloc(&bd->arena, sizeof(*bi));
 		if (NULL == bi) {
 			DPRINTF("Can't allocate memory for new bootconf item");
 			return -1;
 		}
 
-		bi->device = strdup(dev->device);
+		bi->device = device;
 		bi->fstype = dev->fstype;
 		bi->blocks = dev->blocks;
+		bi->major = dev->major;
+		bi->minor = dev->minor;
 
 		bi->dtype = DVT_UNKNOWN;
 		for (dt = dtypes; dt->dtype != DVT_UNKNOWN; dt++) {
@@ -132,14 +223,28 @@ int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 		}
 
 		/* Section-dependent data */
-		bi->label = sc->label;
-		bi->dtbpath = sc->dtbpath;
-		bi->kernelpath = sc->kernelpath;
-		bi->cmdline_append = sc->cmdline_append;
-		bi->cmdline = sc->cmdline;
-		bi->initrd = sc->initrd;
+		if ( (-1 == arena_copy(&bd->arena, &bi->label, sc->label))
+			|| (-1 == arena_copy(&bd->arena, &bi->dtbpath, sc->dtbpath))
+			|| (-1 == arena_copy(&bd->arena, &bi->kernelpath, sc->kernelpath))
+			|| (-1 == arena_copy(&bd->arena, &bi->cmdline_append,
+					sc->cmdline_append))
+			|| (-1 == arena_copy(&bd->arena, &bi->cmdline, sc->cmdline))
+			|| (-1 == arena_copy(&bd->arena, &bi->initrd, sc->initrd)) )
+		{
+			DPRINTF("Can't allocate memory for new bootconf item");
+			return -1;
+		}
+
+		/* Icon is owned by boot item now */
 		bi->icondata = sc->icondata;
+		sc->icondata = NULL;
 		bi->priority = sc->priority;
+		bi->ubivol = sc->ubivol;
+#ifdef USE_MOUNT_FDS
+		/* Every item owns its copy of mount fd */
+		bi->mntfd = (dev->mntfd >= 0) ?
+				fcntl(dev->mntfd, F_DUPFD_CLOEXEC, 0) : -1;
+#endif
 		if (sc->is_default) bc->default_item = bi;
 
 		bc->list[bc->fill] = bi;
@@ -150,39 +255,33 @@ int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 
 		++bc->fill;
 
-		/* Resize list when needed */
-		if (bc->fill >= bc->size) {
-			struct boot_item_t **new_list;
-
-			bc->size <<= 1;	/* size *= 2; */
-			new_list = realloc( bc->list, bc->size * sizeof(*(bc->list)) );
-			if (NULL == new_list) {
-				DPRINTF("Can't resize boot structure");
-				return -1;
-			}
-
-			bc->list = new_list;
-		}
-
 	} /* for */
 
 	return 0;
 }
 
 
+/* Free boot item. Its memory is released with arena of its device */
+void free_bootitem(struct boot_item_t *bi)
+{
+#ifdef USE_MOUNT_FDS
+	if (bi->mntfd >= 0) close(bi->mntfd);
+#endif
+}
+
+
 /* Free bootconf structure */
 void free_bootcfg(struct bootconf_t *bc)
 {
 	int i;
 	for (i = 0; i < bc->fill; i++) {
-		free(bc->list[i]->device);
-		free(bc->list[i]->kernelpath);
-		dispose(bc->list[i]->cmdline);
-		dispose(bc->list[i]->initrd);
-		dispose(bc->list[i]->label);
-		free(bc->list[i]);
+		/* Removed items are NULL */
+		if (bc->list[i]) free_bootitem(bc->list[i]);
 	}
+	for (i = 0; i < bc->devs_fill; i++)
+		arena_free(&bc->devs[i].arena);
 	free(bc->list);
+	dispose(bc->devs);
 	free(bc);
 }
 
@@ -198,6 +297,7 @@ void print_bootcfg(struct bootconf_t *bc)
 	log_msg(lg, " + debug: %d", bc->debug);
 
 	for (i = 0; i < bc->fill; i++) {
+		if (!bc->list[i]) continue;
 		log_msg(lg, " [%d] device: '%s'", i, bc->list[i]->device);
 		log_msg(lg, " [%d] fstype: '%s'", i, bc->list[i]->fstype);
 		log_msg(lg, " [%d] blocks: '%lu'", i, bc->list[i]->blocks);
@@ -212,29 +312,36 @@ void print_bootcfg(struct bootconf_t *bc)
 #endif
 
 
-/* Detect FS type on device and returt pointer to static structure from fstype.c */
-const char *detect_fstype(char *device, struct charlist *fl)
+/* Detect FS type on device and returt pointer to static structure from fstype.c
+ * Superblock stamp is stored into 'stamp' */
+const char *detect_fstype(char *device, struct fs_registry *fsreg,
+		unsigned long long *stamp)
 {
-	int fd;
+	int fd, ts;
 	const char *fstype;
 
+	ts = trace_begin("open", device);
 	fd = open(device, O_RDONLY);
+	trace_end(ts);
 	if (fd < 0) {
 		log_msg(lg, "+ can't open device: %s", ERRMSG);
 		return NULL;
 	}
 
-	if ( 0 != identify_fs(fd, &fstype, NULL, 0) ) {
+	ts = trace_begin("identify_fs", device);
+	if ( 0 != identify_fs(fd, &fstype, NULL, stamp, 0, fsreg) ) {
+		trace_end(ts);
 		close(fd);
 		log_msg(lg, "+ can't identify FS type");
 		return NULL;
 	}
+	trace_end(ts);
 	close(fd);
 
 	log_msg(lg, "+ FS type '%s' detected", fstype);
 
-	/* Check that FS is known */
-	if (in_charlist(fl, fstype) < 0) {
+	/* Check that FS is registered in kernel */
+	if (FS_NATIVE != fsreg_lookup(fsreg, fstype)) {
 
 		/* whitelist 'ubi', we assume it is ubifs */
 		if (!strncmp(fstype, "ubi",3)) {
@@ -249,16 +356,33 @@ const char *detect_fstype(char *device, struct charlist *fl)
 }
 
 
-/* Check and parse config file */
-int get_bootinfo(struct cfgdata_t *cfgdata)
+/* Check and parse config file of device mounted at 'mountpoint' */
+int get_bootinfo(struct cfgdata_t *cfgdata, const char *mountpoint)
 {
 	struct stat sinfo;
+	char path[PATH_MAX];
+#ifdef USE_BINARY_CFG
+	char bpath[PATH_MAX];
+#endif
+
+	cfg_path_at(path, sizeof(path), mountpoint, BOOTCFG_PATH);
+
+#ifdef USE_BINARY_CFG
+	/* Prefer compiled config file made from this config file */
+	if (0 == stat(path, &sinfo)) {
+		cfg_path_at(bpath, sizeof(bpath), mountpoint, BOOTCFGB_PATH);
+		if (0 == cfgb_load(bpath, cfgdata, &sinfo)) {
+			log_msg(lg, "+ compiled config file found");
+			return 0;
+		}
+	}
+#endif
 
 	/* Clean cfgdata structure */
 	init_cfgdata(cfgdata);
 
 	/* Parse config file */
-	if (0 == parse_cfgfile(BOOTCFG_PATH, cfgdata)) {	/* Found and parsed */
+	if (0 == parse_cfgfile(path, cfgdata)) {	/* Found and parsed */
 		log_msg(lg, "+ config file found");
 		/* Check kernel presence
 		 * FIXME: we should stat every kernel or shouldn't stat at all
@@ -274,7 +398,8 @@ int get_bootinfo(struct cfgdata_t *cfgdata)
 		/* Check default kernels */
 		char **kp;
 		for (kp = default_kernels; NULL != *kp; kp++) {
-			if (0 == stat(*kp, &sinfo)) {
+			cfg_path_at(path, sizeof(path), mountpoint, *kp);
+			if (0 == stat(path, &sinfo)) {
 				cfgdata_add_kernel(cfgdata, *kp);
 				log_msg(lg, "+ found default kernel '%s'", *kp);
 				return 0;
@@ -287,48 +412,366 @@ int get_bootinfo(struct cfgdata_t *cfgdata)
 	return -1;
 }
 
-FILE *devscan_open(struct charlist **fslist)
+#ifdef USE_FS_LOOKUP
+/* Look for config file and default kernels without mounting device.
+ * Return 0 when device surely has nothing to boot or -1 when it should
+ * be mounted to say */
+int lookup_bootinfo(struct device_t *dev)
+{
+	int fd, rc;
+	char **kp;
+	char path[PATH_MAX];
+
+	fd = open(dev->device, O_RDONLY);
+	if (fd < 0) return -1;
+
+	cfg_path_at(path, sizeof(path), "", BOOTCFG_PATH);
+	rc = fs_lookup(fd, dev->fstype, path);
+
+	for (kp = default_kernels; (FSL_MISSING == rc) && (NULL != *kp); kp++) {
+		cfg_path_at(path, sizeof(path), "", *kp);
+		rc = fs_lookup(fd, dev->fstype, path);
+	}
+	close(fd);
+
+	return (FSL_MISSING == rc) ? 0 : -1;
+}
+#endif
+
+/* Block device found in sysfs */
+struct devscan_entry {
+	char name[32];			/* Device name (mmcblk0p1) */
+	int major, minor;
+	int pmajor, pminor;		/* Parent disk numbers (-1 - whole disk) */
+	unsigned long long blocks;	/* Size in 1K blocks */
+	int has_parts;			/* Whole disk have partitions */
+};
+
+/* Devices scanning state */
+struct devscan {
+	FILE *fp;				/* /proc/partitions when sysfs is not available */
+	struct devscan_entry *list;	/* Devices found in /sys/class/block */
+	unsigned int count;
+	unsigned int next;		/* Next device to return */
+};
+
+#define SYSFS_BLOCK	"/sys/class/block"
+
+
+/* Read attribute 'attr' of sysfs directory 'dirfd' into 'buf'.
+ * Return length of value or -1 on error */
+static int sysfs_read(int dirfd, const char *attr, char *buf, int size)
+{
+	int fd, len;
+
+	fd = openat(dirfd, attr, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd) return -1;
+
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len < 0) return -1;
+
+	buf[len] = '\0';
+	return len;
+}
+
+
+/* Read "major:minor" attribute 'attr' of sysfs directory 'dirfd' */
+static int sysfs_read_dev(int dirfd, const char *attr, int *major, int *minor)
 {
-	FILE *f;
-	struct charlist *fl;
+	char buf[24];
+
+	if ( (-1 == sysfs_read(dirfd, attr, buf, sizeof(buf)))
+			|| (2 != sscanf(buf, "%d:%d", major, minor)) )
+		return -1;
+
+	return 0;
+}
+
+
+/* Read numeric attribute 'attr' of sysfs directory 'dirfd' (0 on error) */
+static unsigned long long sysfs_read_num(int dirfd, const char *attr)
+{
+	char buf[24];
+
+	if (-1 == sysfs_read(dirfd, attr, buf, sizeof(buf)))
+		return 0;
+
+	return strtoull(buf, NULL, 10);
+}
+
+
+/* Fill entry 'e' from device directory 'dirfd'.
+ * Return 0 when device should be probed or -1 to skip it */
+static int devscan_entry_read(int dirfd, const char *name,
+		struct devscan_entry *e)
+{
+	const char *disk;	/* Path to disk's directory */
+
+	if (strlen(name) >= sizeof(e->name)) return -1;
+	strcpy(e->name, name);
+
+	if (-1 == sysfs_read_dev(dirfd, "dev", &e->major, &e->minor))
+		return -1;
+
+	/* Size is in 512-byte sectors */
+	e->blocks = sysfs_read_num(dirfd, "size") >> 1;
+	e->has_parts = 0;
+
+	/* Partition's directory is inside of its disk's one */
+	if (0 == faccessat(dirfd, "partition", F_OK, 0)) {
+		if (-1 == sysfs_read_dev(dirfd, "../dev", &e->pmajor, &e->pminor))
+			return -1;
+		disk = "../device";
+	} else {
+		e->pmajor = e->pminor = -1;
+		disk = "device";
+	}
+
+	/* Empty loop devices, card readers without media etc */
+	if (0 == e->blocks) return -1;
+
+	/* Read-only pseudo devices: ro loops, ramdisks and mmcblkXbootY.
+	 * Pseudo devices have no underlying hardware device */
+	if ( sysfs_read_num(dirfd, "ro")
+			&& ( (0 != faccessat(dirfd, disk, F_OK, AT_SYMLINK_NOFOLLOW))
+				|| (!strncmp(name, "mmcblk", 6) && strstr(name, "boot")) ) )
+	{
+		log_msg(lg, "Device '%s' is read-only, skipped", name);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/* Sort devices by numbers to get stable devices order */
+static int devscan_entry_cmp(const void *a, const void *b)
+{
+	const struct devscan_entry *ea = a, *eb = b;
+
+	if (ea->major != eb->major) return ea->major - eb->major;
+	return ea->minor - eb->minor;
+}
+
+
+/* Collect devices from /sys/class/block. Return -1 when sysfs
+ * is not available */
+static int devscan_sysfs(struct devscan *ds)
+{
+	DIR *dir;
+	struct dirent *de;
+	struct devscan_entry *e;
+	unsigned int size, i, j;
+	int dfd;
+
+	dir = opendir(SYSFS_BLOCK);
+	if (NULL == dir) return -1;
+
+	size = 16;
+	ds->list = malloc(size * sizeof(*(ds->list)));
+	if (NULL == ds->list) {
+		DPRINTF("Can't allocate devices list");
+		closedir(dir);
+		return -1;
+	}
+
+	while ((de = readdir(dir))) {
+		if ('.' == de->d_name[0]) continue;
+
+		/* Resize list when needed before adding device */
+		if (ds->count >= size) {
+			struct devscan_entry *new_list;
+
+			size <<= 1;	/* size *= 2; */
+			new_list = realloc(ds->list, size * sizeof(*(ds->list)));
+			if (NULL == new_list) {
+				DPRINTF("Can't resize devices list");
+				break;
+			}
+			ds->list = new_list;
+		}
+
+		dfd = openat(dirfd(dir), de->d_name,
+				O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (-1 == dfd) continue;
+
+		if (0 == devscan_entry_read(dfd, de->d_name, &ds->list[ds->count]))
+			++ds->count;
+		close(dfd);
+	}
+	closedir(dir);
+
+	/* Mark disks having partitions */
+	for (i = 0; i < ds->count; i++) {
+		e = &ds->list[i];
+		if (e->pmajor < 0) continue;
+		for (j = 0; j < ds->count; j++) {
+			if ((ds->list[j].major == e->pmajor)
+					&& (ds->list[j].minor == e->pminor))
+				ds->list[j].has_parts = 1;
+		}
+	}
+
+	qsort(ds->list, ds->count, sizeof(*(ds->list)), devscan_entry_cmp);
+	return 0;
+}
+
+
+struct devscan *devscan_open(struct fs_registry **fsreg)
+{
+	struct devscan *ds;
+	struct fs_registry *reg;
 	char line[80];
 
-    /* Get a list of all filesystems registered in the kernel */
-	fl = scan_filesystems();
-	if (NULL == fl) {
+	/* Get filesystems supported by the kernel */
+	reg = fsreg_open();
+	if (NULL == reg) {
+		log_msg(lg, "+ can't open /proc/filesystems: %s", ERRMSG);
 		return NULL;
 	}
 
+	ds = malloc(sizeof(*ds));
+	if (NULL == ds) {
+		DPRINTF("Can't allocate devices scanning state");
+		goto free_reg;
+	}
+	ds->fp = NULL;
+	ds->list = NULL;
+	ds->count = 0;
+	ds->next = 0;
+
+	if (0 == devscan_sysfs(ds)) {
+		*fsreg = reg;
+		return ds;
+	}
+	dispose(ds->list);
+	ds->count = 0;
+
 	/* Get a list of available partitions on all devices
 	 * See kernel/block/genhd.c for details on interface */
-	f = fopen("/proc/partitions", "r");
-	if (NULL == f) {
+	ds->fp = fopen("/proc/partitions", "r");
+	if (NULL == ds->fp) {
 		log_msg(lg, "Can't open /proc/partitions: %s", ERRMSG);
-		goto free_fl;
+		goto free_ds;
 	}
 
 	// First two lines are bogus.
-	fgets(line, sizeof(line), f);
-	fgets(line, sizeof(line), f);
+	fgets(line, sizeof(line), ds->fp);
+	fgets(line, sizeof(line), ds->fp);
 
-	*fslist = fl;
-	return f;
+	*fsreg = reg;
+	return ds;
 
-free_fl:
-	free_charlist(fl);
+free_ds:
+	free(ds);
+free_reg:
+	fsreg_close(reg);
 
 	return NULL;
 }
 
-int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev)
+
+void devscan_close(struct devscan *ds)
+{
+	if (ds->fp) fclose(ds->fp);
+	dispose(ds->list);
+	free(ds);
+}
+
+static int devscan_fill(struct device_t *dev, const char *name, int len,
+		int major, int minor, unsigned long long blocks)
+{
+#ifdef USE_DEVICES_RECREATING
+	int ts;
+	struct stat st;
+#endif
+	char *device, *p;
+
+	/* Format device name */
+	device = malloc(len + 5 + 1); /* 5 = strlen("/dev/") */
+	if (NULL == device) {
+		DPRINTF("Can't allocate memory for device name '%s'", name);
+		return -1;
+	}
+	strcpy(device, "/dev/");
+	strncat(device, name, len);
+
+	/* Sysfs names have '!' instead of '/' (cciss!c0d0) */
+	for (p = device; *p; p++)
+		if ('!' == *p) *p = '/';
+
+	log_msg(lg, "Found device '%s' (%d, %d) of size %lluMb",
+			device, major, minor, blocks>>10);
+
+#ifdef USE_DEVICES_RECREATING
+	/* Node is fine already (devtmpfs e.g.) */
+	if ( (0 == stat(device, &st)) && S_ISBLK(st.st_mode)
+			&& (st.st_rdev == makedev(major, minor)) )
+		goto fill;
+
+	ts = trace_begin("mknod", device);
+
+	/* Remove old device node. We don't care about unlink() result. */
+	unlink(device);
+
+	/* Re-create device node */
+	log_msg(lg, "+ creating device node");
+	if ( -1 == mknod( device,
+			(S_IFBLK | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH),
+			makedev(major, minor) ) )
+	{
+		log_msg(lg, "+ mknod failed: %s", ERRMSG);
+	}
+
+	trace_end(ts);
+
+fill:
+#endif
+	dev->device = device;
+	dev->fstype = NULL;
+	dev->blocks = blocks;
+	dev->major = major;
+	dev->minor = minor;
+	dev->stamp = 0;
+#ifdef USE_MOUNT_FDS
+	dev->mntfd = -1;
+#endif
+
+	return 1;
+}
+
+/* Fill 'dev' from sysfs entry 'e' */
+static int devscan_read_entry(struct devscan_entry *e, struct device_t *dev)
+{
+	/* FIXME: 200k is hardcoded below */
+	if (e->blocks < 200) {
+		log_msg(lg, "+ device (%d, %d) is too small (%lluk < 200k), skipped",
+				e->major, e->minor, e->blocks);
+		return -1;
+	}
+
+	return devscan_fill(dev, e->name, strlen(e->name),
+			e->major, e->minor, e->blocks);
+}
+
+int devscan_read(struct devscan *ds, struct device_t *dev)
 {
 	int major, minor, len;
 	unsigned long long blocks;
 	char *tmp, *p;
-	char *device;
 	char line[80];
+	struct devscan_entry *e;
 
-	if (NULL == fgets(line, sizeof(line), fp)) {
+	if (!ds->fp) {
+		if (ds->next >= ds->count) return 0;
+
+		e = &ds->list[ds->next++];
+		if (e->has_parts) return -1;	/* Partitions will be probed */
+		return devscan_read_entry(e, dev);
+	}
+
+	if (NULL == fgets(line, sizeof(line), ds->fp)) {
 		return 0;
 	}
 
@@ -350,43 +793,85 @@ int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev)
 		return -1;
 	}
 
-	/* Format device name */
-	len = p - tmp;
-	device = malloc(len + 5 + 1); /* 5 = strlen("/dev/") */
-	if (NULL == device) {
-		DPRINTF("Can't allocate memory for device name '%s'", tmp);
-		return -1;
-	}
-	strcpy(device, "/dev/");
-	strncat(device, tmp, len);
+	return devscan_fill(dev, tmp, p - tmp, major, minor, blocks);
+}
 
-	log_msg(lg, "Found device '%s' (%d, %d) of size %lluMb",
-			device, major, minor, blocks>>10);
+#if defined(USE_HOTPLUG) || defined(USE_BOOT_HISTORY)
+/* Check that whole disk directory 'dirfd' have partitions. Kernel adds
+ * partitions to sysfs before it reports disk itself */
+static int devscan_has_parts(int dirfd)
+{
+	DIR *dir;
+	struct dirent *de;
+	char attr[sizeof(de->d_name) + sizeof("/partition")];
+	int fd, rc;
 
-#ifdef USE_DEVICES_RECREATING
-	/* Remove old device node. We don't care about unlink() result. */
-	unlink(device);
+	fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (-1 == fd) return 0;
 
-	/* Re-create device node */
-	log_msg(lg, "+ creating device node");
-	if ( -1 == mknod( device,
-			(S_IFBLK | S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH),
-			makedev(major, minor) ) )
-	{
-		log_msg(lg, "+ mknod failed: %s", ERRMSG);
+	dir = fdopendir(fd);
+	if (NULL == dir) {
+		close(fd);
+		return 0;
 	}
-#endif
 
-	dev->fstype = detect_fstype(device, fslist);
-	if (NULL == dev->fstype) {
-		free(device);
+	/* Partitions are subdirectories (sdb1, mmcblk0p1) */
+	rc = 0;
+	while (!rc && (de = readdir(dir))) {
+		if (('.' == de->d_name[0]) || (DT_DIR != de->d_type)) continue;
+		snprintf(attr, sizeof(attr), "%s/partition", de->d_name);
+		rc = (0 == faccessat(dirfd, attr, F_OK, 0));
+	}
+	closedir(dir);
+
+	return rc;
+}
+
+int devscan_get(const char *name, int major, int minor, struct device_t *dev)
+{
+	struct devscan_entry e;
+	char path[64];
+	int dfd, rc;
+
+	snprintf(path, sizeof(path), "/sys/dev/block/%d:%d", major, minor);
+	dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (-1 == dfd) {
+		log_msg(lg, "Can't open %s: %s", path, ERRMSG);
 		return -1;
 	}
 
-	dev->device = device;
-	dev->blocks = blocks;
+	rc = devscan_entry_read(dfd, name, &e);
+	if ((0 == rc) && (e.pmajor < 0) && devscan_has_parts(dfd)) {
+		/* Partitions are probed instead, as by devscan_read() */
+		log_msg(lg, "Device '%s' have partitions, skipped", name);
+		rc = -1;
+	}
+	close(dfd);
+	if (-1 == rc) return -1;
 
-	return 1;
+	return devscan_read_entry(&e, dev);
+}
+#endif
+
+int devscan_probe(struct fs_registry *fsreg, struct device_t *dev)
+{
+	dev->fstype = detect_fstype(dev->device, fsreg, &dev->stamp);
+	if (NULL == dev->fstype) return -1;
+
+	return 0;
 }
 
+int devscan_next(struct devscan *ds, struct fs_registry *fsreg, struct device_t *dev)
+{
+	int rc;
+
+	rc = devscan_read(ds, dev);
+	if (rc <= 0) return rc;
+
+	if (-1 == devscan_probe(fsreg, dev)) {
+		free(dev->device);
+		return -1;
+	}
 
+	return 1;
+}
@@ -22,11 +22,21 @@
 #include "util.h"
 #include "cfgparser.h"
 
+/* Don't re-create devices when executing on host */
+#ifdef USE_HOST_DEBUG
+#undef USE_DEVICES_RECREATING
+#endif
+
 /* Device structure */
 struct device_t {
 	char *device;		/* Device path (/dev/mmcblk0p1) */
 	const char *fstype;	/* Filesystem (ext2) */
 	unsigned long long blocks;	/* Device size in 1K blocks */
+	int major, minor;	/* Device numbers */
+	unsigned long long stamp;	/* Superblock stamp (0 - unknown) */
+#ifdef USE_MOUNT_FDS
+	int mntfd;			/* Detached mount of device (-1 - none) */
+#endif
 };
 
 enum dtype_t {
@@ -41,6 +51,7 @@ struct boot_item_t {
 	char *device;		/* Device path (/dev/mmcblk0p1) */
 	const char *fstype;	/* Filesystem (ext2) */
 	unsigned long long blocks;	/* Device size in 1K blocks */
+	int major, minor;	/* Device numbers */
 	char *label;		/* Partition label (name) */
 	char *dtbpath;		/* Found dtb (/boot/dtb) */
 	char *kernelpath;	/* Found kernel (/boot/zImage) */
@@ -49,7 +60,19 @@ struct boot_item_t {
 	char *initrd;		/* Initial ramdisk file */
 	void *icondata;		/* Icon data */
 	int priority;		/* Priority of item in menu */
+	int ubivol;			/* UBI volume to boot from (ubi only) */
 	enum dtype_t dtype;	/* Device type */
+#ifdef USE_MOUNT_FDS
+	int mntfd;			/* Detached mount of device (-1 - none) */
+#endif
+};
+
+/* Device scanned into bootconf */
+struct bootdev_t {
+	int major, minor;	/* Device numbers */
+	unsigned long long blocks;	/* Device size in 1K blocks */
+	int seen;			/* Device is found by current scan */
+	kx_arena arena;		/* Memory of boot items of device */
 };
 
 /* Boot configuration structure */
@@ -62,29 +85,67 @@ struct bootconf_t {
 	struct boot_item_t **list;	/* Boot items list */
 	unsigned int size;			/* Count of boot items in list */
 	unsigned int fill;			/* Filled items count */
+
+	struct bootdev_t *devs;		/* Devices scanned, with items or not */
+	unsigned int devs_size;
+	unsigned int devs_fill;
 };
 
 extern char *machine_kernel;
 extern char *default_kernels[];
 
-/* Prepare devicescan loop */
-FILE *devscan_open(struct charlist **fslist);
+struct devscan;
+struct fs_registry;
+
+/* Prepare devicescan loop (fsreg out) */
+struct devscan *devscan_open(struct fs_registry **fsreg);
+
+/* Finish devicescan loop */
+void devscan_close(struct devscan *ds);
 
-/* Get next device (fp & fslist in, dev out) */
-int devscan_next(FILE *fp, struct charlist *fslist, struct device_t *dev);
+/* Get next device (ds & fsreg in, dev out) */
+int devscan_next(struct devscan *ds, struct fs_registry *fsreg,
+		struct device_t *dev);
+
+/* Get next device without detecting its FS (ds in, dev out) */
+int devscan_read(struct devscan *ds, struct device_t *dev);
+
+#if defined(USE_HOTPLUG) || defined(USE_BOOT_HISTORY)
+/* Get device 'name' (sdb1) reported by hotplug or remembered (dev out) */
+int devscan_get(const char *name, int major, int minor, struct device_t *dev);
+#endif
+
+/* Detect FS of device got from devscan_read() (fsreg in, dev in/out) */
+int devscan_probe(struct fs_registry *fsreg, struct device_t *dev);
 
 /* Allocate bootconf structure */
 struct bootconf_t *create_bootcfg(unsigned int size);
 
+/* Free boot item */
+void free_bootitem(struct boot_item_t *bi);
+
 /* Free bootconf structure */
 void free_bootcfg(struct bootconf_t *bc);
 
-/* Import values from cfgdata and boot to bootconf */
+/* Import values from cfgdata and boot to bootconf.
+ * Device is remembered even when cfgdata is NULL (nothing to boot) */
 int addto_bootcfg(struct bootconf_t *bc, struct device_t *dev,
 		struct cfgdata_t *cfgdata);
 
-/* Check and parse config file */
-int get_bootinfo(struct cfgdata_t *cfgdata);
+/* Find device scanned into bootconf. Size should match too */
+struct bootdev_t *bootcfg_find_device(struct bootconf_t *bc,
+		int major, int minor, unsigned long long blocks);
+
+/* Forget devices which are not seen by last scan */
+void bootcfg_sweep_devices(struct bootconf_t *bc);
+
+/* Check and parse config file of device mounted at 'mountpoint' */
+int get_bootinfo(struct cfgdata_t *cfgdata, const char *mountpoint);
+
+#ifdef USE_FS_LOOKUP
+/* Check that device have nothing to boot without mounting it (0 - nothing) */
+int lookup_bootinfo(struct device_t *dev);
+#endif
 
 #ifdef DEBUG
 /* Print bootconf structure */
@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <linux/input.h>
 #include <limits.h>
+#include <time.h>
 
 #include "config.h"
 #include "evdevs.h"
@@ -126,6 +127,32 @@ void evdev_prepare_fd(int fd)
 #endif
 }
 
+#if defined(USE_TIMEOUT) && defined(USE_BOOT_HISTORY)
+/* Restart timeout countdown */
+static void inputs_arm_timeout(kx_inputs *inputs)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	inputs->deadline = (unsigned long long)ts.tv_sec * 1000
+			+ ts.tv_nsec / 1000000 + USE_TIMEOUT * 1000;
+}
+
+/* Time left to deadline */
+static void inputs_time_left(kx_inputs *inputs, struct timeval *tv)
+{
+	struct timespec ts;
+	unsigned long long now, left;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = (unsigned long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+	left = (inputs->deadline > now) ? inputs->deadline - now : 0;
+
+	tv->tv_sec = left / 1000;
+	tv->tv_usec = (left % 1000) * 1000;
+}
+#endif
+
 /* Initialize inputs structure */
 int inputs_init(kx_inputs *inputs, unsigned int size)
 {
@@ -267,10 +294,30 @@ void inputs_close(kx_inputs *inputs)
 int inputs_preprocess(kx_inputs *inputs)
 {
 	++inputs->maxfd;
+#if defined(USE_TIMEOUT) && defined(USE_BOOT_HISTORY)
+	/* Countdown starts right away, not when scanning is finished */
+	inputs_arm_timeout(inputs);
+#endif
 	return 0;
 }
 
-int inputs_process_evdev(int fd)
+#ifdef USE_TYPE_FILTER
+/* Characters of keys for menu filter (lowercase only) */
+static const char key_chars[] = {
+	[KEY_ESC] = '\033', [KEY_BACKSPACE] = '\b',
+	[KEY_1] = '1', [KEY_2] = '2', [KEY_3] = '3', [KEY_4] = '4', [KEY_5] = '5',
+	[KEY_6] = '6', [KEY_7] = '7', [KEY_8] = '8', [KEY_9] = '9', [KEY_0] = '0',
+	[KEY_MINUS] = '-', [KEY_DOT] = '.', [KEY_SLASH] = '/',
+	[KEY_Q] = 'q', [KEY_W] = 'w', [KEY_E] = 'e', [KEY_R] = 'r', [KEY_T] = 't',
+	[KEY_Y] = 'y', [KEY_U] = 'u', [KEY_I] = 'i', [KEY_O] = 'o', [KEY_P] = 'p',
+	[KEY_A] = 'a', [KEY_S] = 's', [KEY_D] = 'd', [KEY_F] = 'f', [KEY_G] = 'g',
+	[KEY_H] = 'h', [KEY_J] = 'j', [KEY_K] = 'k', [KEY_L] = 'l',
+	[KEY_Z] = 'z', [KEY_X] = 'x', [KEY_C] = 'c', [KEY_V] = 'v', [KEY_B] = 'b',
+	[KEY_N] = 'n', [KEY_M] = 'm',
+};
+#endif
+
+int inputs_process_evdev(kx_inputs *inputs, int fd)
 {
 	int nready;
 	enum actions_t action = A_NONE;
@@ -333,11 +380,40 @@ int inputs_process_evdev(int fd)
 		case KEY_7: action = A_KEY7; break;
 		case KEY_8: action = A_KEY8; break;
 		case KEY_9: action = A_KEY9; break;
+#endif
+#ifdef USE_TYPE_FILTER
+		case KEY_SLASH:
+			action = A_FILTER;
+			break;
 #endif
 		default:
 			action = A_NONE;
 			break;
 		}
+
+#ifdef USE_TYPE_FILTER
+		/* Character is used instead of action while filter is typed */
+		if ((evt.code < ROWS(key_chars)) && key_chars[evt.code]) {
+			inputs->key_char = key_chars[evt.code];
+			if (A_NONE == action) action = A_CHAR;
+		}
+#endif
+	}
+
+	return action;
+}
+
+
+/* Read actions written into pipe and return latest one */
+int inputs_process_pipe(int fd)
+{
+	int n;
+	unsigned char buf[16];
+	enum actions_t action = A_NONE;
+
+	/* Pipe is non-blocking so read everything available */
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		action = buf[n - 1];
 	}
 
 	return action;
@@ -352,16 +428,23 @@ enum actions_t inputs_process(kx_inputs *inputs)
 	enum actions_t action = A_NONE;
 	struct timeval timeout;
 
+#if defined(USE_TIMEOUT) && defined(USE_BOOT_HISTORY)
+	/* Only user's input restarts countdown, scan events don't */
+	inputs_time_left(inputs, &timeout);
+#elif defined(USE_TIMEOUT)
 	timeout.tv_usec = 0;
-#ifdef USE_TIMEOUT
 	timeout.tv_sec = USE_TIMEOUT;
 #else
+	timeout.tv_usec = 0;
 	timeout.tv_sec = 60;	// exit after timeout to allow to do something above
 #endif
 
 	if (0 == inputs->count) return A_ERROR;		/* A_EXIT ? */
 
 	fds = inputs->fdset;
+#ifdef USE_TYPE_FILTER
+	inputs->key_char = 0;
+#endif
 
 	/* Wait for some input */
 	nready = select(inputs->maxfd, &fds, NULL, NULL, &timeout);	/* Wait for input or timeout */
@@ -375,6 +458,9 @@ enum actions_t inputs_process(kx_inputs *inputs)
 	} else if (0 == nready) {	// timeout reached
 #ifdef USE_TIMEOUT
 		log_msg(lg, "Timeout reached!");
+#ifdef USE_BOOT_HISTORY
+		inputs_arm_timeout(inputs);
+#endif
 		return A_TIMEOUT;
 #else
 		return A_NONE;
@@ -388,14 +474,29 @@ enum actions_t inputs_process(kx_inputs *inputs)
 			switch (inputs->fdtypes[i]) {
 			case KX_IT_EVDEV:
 				/* Process input from event device */
-				action = inputs_process_evdev(fd);
+				action = inputs_process_evdev(inputs, fd);
 				if (A_ERROR == action) continue; /* continue on short read */
+#if defined(USE_TIMEOUT) && defined(USE_BOOT_HISTORY)
+				if (A_NONE != action) inputs_arm_timeout(inputs);
+#endif
 				break;
 			case KX_IT_TTY:
 				/* Process input from tty */
 				break;
 			case KX_IT_SOCKET:
 				/* Process input from sockets */
+#ifdef USE_HOTPLUG
+				/* Uevents are read by main loop. Leave them for
+				 * next call if we have user's action */
+				if (A_NONE == action)
+					action = A_HOTPLUG;
+#endif
+				break;
+			case KX_IT_PIPE:
+				/* Process actions from other threads.
+				 * Leave them for next call if we have user's action */
+				if (A_NONE == action)
+					action = inputs_process_pipe(fd);
 				break;
 			}
 		}
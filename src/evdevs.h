@@ -37,6 +37,17 @@ enum actions_t {
 #ifdef USE_TIMEOUT
 	A_TIMEOUT,
 #endif
+#ifdef USE_ASYNC_SCAN
+	A_SCAN_ITEMS,	/* Scanning thread found new boot items */
+	A_SCAN_DONE,	/* Scanning thread is finished */
+#endif
+#ifdef USE_HOTPLUG
+	A_HOTPLUG,		/* Block devices are added or removed */
+#endif
+#ifdef USE_TYPE_FILTER
+	A_FILTER,		/* Start typing filter of menu items */
+	A_CHAR,			/* Key with character (kx_inputs.key_char) */
+#endif
 #ifdef USE_NUMKEYS
 	A_KEY0,
 	A_KEY1,
@@ -55,7 +66,8 @@ enum actions_t {
 typedef enum {
 	KX_IT_EVDEV,
 	KX_IT_TTY,
-	KX_IT_SOCKET
+	KX_IT_SOCKET,
+	KX_IT_PIPE		/* Actions written by other threads */
 } kx_input_type;
 
 typedef struct {
@@ -65,6 +77,12 @@ typedef struct {
 	kx_input_type *fdtypes;
 	fd_set fdset;
 	int maxfd;
+#if defined(USE_TIMEOUT) && defined(USE_BOOT_HISTORY)
+	unsigned long long deadline;	/* Timeout time (CLOCK_MONOTONIC, ms) */
+#endif
+#ifdef USE_TYPE_FILTER
+	char key_char;		/* Character of last key pressed (0 - none) */
+#endif
 } kx_inputs;
 
 
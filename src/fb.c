@@ -120,169 +120,132 @@ fb_respect_angle(int x, int y, int *dx, int *dy, int *nx)
 }
 
 /**************************************************************************
- * Pixel plotting routines
+ * Pixel plotting and horizontal line drawing routines.
+ * One set is generated for each pixel size and angle so drawing loops
+ * don't look at fb.angle. 18bpp pixels are stored as 24bpp ones
  */
-#ifdef USE_32BPP
-static void
-fb_plot_pixel_32bpp(int x, int y, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy;
-
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 2);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	*(volatile uint32_t *) offset = (uint32_t) color;
-}
-#endif
-
-#ifdef USE_24BPP
-static void
-fb_plot_pixel_24bpp(int x, int y, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy;
-
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
 
-	*(volatile char *) (offset) = (color & 0x000000FF);
-	*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-	*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-}
-#endif
-
-#ifdef USE_18BPP
-static void
-fb_plot_pixel_18bpp(int x, int y, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy;
-
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	*(volatile char *) (offset) = (color & 0x000000FF);
-	*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-	*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-}
+/* Real coordinates of screen point (x,y) and direction of screen X axis
+ * in real pixels (SX) and lines (SY) */
+#define FB_RX_0(x, y)		(x)
+#define FB_RY_0(x, y)		(y)
+#define FB_SX_0				1
+#define FB_SY_0				0
+
+#define FB_RX_90(x, y)		(y)
+#define FB_RY_90(x, y)		(fb.real_height - (x) - 1)
+#define FB_SX_90			0
+#define FB_SY_90			-1
+
+#define FB_RX_180(x, y)		(fb.real_width - (x) - 1)
+#define FB_RY_180(x, y)		(fb.real_height - (y) - 1)
+#define FB_SX_180			-1
+#define FB_SY_180			0
+
+#define FB_RX_270(x, y)		(fb.real_width - (y) - 1)
+#define FB_RY_270(x, y)		(x)
+#define FB_SX_270			0
+#define FB_SY_270			1
+
+/* Store pixel of 'size' bytes */
+#define FB_PUT_4(p, color) \
+	*(volatile uint32_t *) (p) = (uint32_t) (color)
+
+#define FB_PUT_3(p, color) \
+	do { \
+		*(volatile char *) (p) = ((color) & 0x000000FF); \
+		*(volatile char *) ((p) + 1) = ((color) & 0x0000FF00) >> 8; \
+		*(volatile char *) ((p) + 2) = ((color) & 0x00FF0000) >> 16; \
+	} while (0)
+
+#define FB_PUT_2(p, color) \
+	*(volatile uint16_t *) (p) = (uint16_t) (color)
+
+#ifdef USE_FB_SIMD
+/* Fill line by kernel when it goes along memory */
+#define FB_FILL_SPAN(p, size, sx, sy, length, color) \
+	if ((0 == (sy)) && fb.fill_span && ((length) > 0)) { \
+		fb.fill_span(((sx) < 0) ? (p) - ((length) - 1) * (size) : (p), \
+				(color), (length)); \
+		return; \
+	}
+#else
+#define FB_FILL_SPAN(p, size, sx, sy, length, color)
 #endif
 
-#ifdef USE_16BPP
-static void
-fb_plot_pixel_16bpp(int x, int y, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy;
-
-	fb_respect_angle(x, y, &ox, &oy, NULL);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 1);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	*(volatile uint16_t *) offset = (uint16_t) color;
+#define FB_BLITTERS(name, size, angle) \
+static void \
+fb_plot_pixel_##name##_##angle(int x, int y, kx_rgba color) \
+{ \
+	char *offset; \
+\
+	offset = fb.backbuffer + FB_RY_##angle(x, y) * fb.stride \
+			+ FB_RX_##angle(x, y) * (size); \
+	if (offset > (fb.backbuffer + fb.screensize - (size))) return; \
+\
+	FB_PUT_##size(offset, color); \
+} \
+\
+static void \
+fb_draw_hline_##name##_##angle(int x, int y, int length, kx_rgba color) \
+{ \
+	char *offset; \
+	int nx; \
+\
+	offset = fb.backbuffer + FB_RY_##angle(x, y) * fb.stride \
+			+ FB_RX_##angle(x, y) * (size); \
+	if (offset > (fb.backbuffer + fb.screensize - (size))) return; \
+\
+	if (length > fb.width - x) \
+		length = fb.width - x; \
+\
+	FB_FILL_SPAN(offset, size, FB_SX_##angle, FB_SY_##angle, length, color) \
+\
+	nx = FB_SX_##angle * (size) + FB_SY_##angle * fb.stride; \
+	for(; length > 0; length--) { \
+		FB_PUT_##size(offset, color); \
+		offset += nx; \
+	} \
 }
-#endif
-
-/**************************************************************************
- * Horizontal line drawing routines
- */
-#ifdef USE_32BPP
-static void
-fb_draw_hline_32bpp(int x, int y, int length, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy, nx;
 
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 2);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
-
-	for(; oy > 0; oy--) {
-		*(volatile uint32_t *) offset = color;
-		offset += nx;
+#define FB_BLITTERS_ALL(name, size) \
+	FB_BLITTERS(name, size, 0) \
+	FB_BLITTERS(name, size, 90) \
+	FB_BLITTERS(name, size, 180) \
+	FB_BLITTERS(name, size, 270)
+
+/* Bind routines of 'name' set for current angle */
+#define FB_BIND_BLITTERS(name) \
+	switch (fb.angle) { \
+	case 270: \
+		fb.plot_pixel = fb_plot_pixel_##name##_270; \
+		fb.draw_hline = fb_draw_hline_##name##_270; \
+		break; \
+	case 180: \
+		fb.plot_pixel = fb_plot_pixel_##name##_180; \
+		fb.draw_hline = fb_draw_hline_##name##_180; \
+		break; \
+	case 90: \
+		fb.plot_pixel = fb_plot_pixel_##name##_90; \
+		fb.draw_hline = fb_draw_hline_##name##_90; \
+		break; \
+	case 0: \
+	default: \
+		fb.plot_pixel = fb_plot_pixel_##name##_0; \
+		fb.draw_hline = fb_draw_hline_##name##_0; \
+		break; \
 	}
-}
-#endif
-
-#ifdef USE_24BPP
-static void
-fb_draw_hline_24bpp(int x, int y, int length, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy, nx;
-
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
 
-	for(; oy > 0; oy--) {
-		*(volatile char *) (offset) = (color & 0x000000FF);
-		*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-		*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-		offset += nx;
-	}
-}
+#ifdef USE_32BPP
+FB_BLITTERS_ALL(32bpp, 4)
 #endif
 
-#ifdef USE_18BPP
-static void
-fb_draw_hline_18bpp(int x, int y, int length, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy, nx;
-
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox + (ox << 1));
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
-
-	for(; oy > 0; oy--) {
-		*(volatile char *) (offset) = (color & 0x000000FF);
-		*(volatile char *) (offset + 1) = (color & 0x0000FF00) >> 8;
-		*(volatile char *) (offset + 2) = (color & 0x00FF0000) >> 16;
-		offset += nx;
-	}
-}
+#if defined(USE_24BPP) || defined(USE_18BPP)
+FB_BLITTERS_ALL(24bpp, 3)
 #endif
 
 #ifdef USE_16BPP
-static void
-fb_draw_hline_16bpp(int x, int y, int length, kx_rgba color)
-{
-	static char *offset;
-	static int ox, oy, nx;
-
-	fb_respect_angle(x, y, &ox, &oy, &nx);
-	offset = fb.backbuffer + oy * fb.stride + (ox << 1);
-	if (offset > (fb.backbuffer + fb.screensize - fb.byte_pp)) return;
-
-	if (length > fb.width - x)
-		oy = fb.width - x;
-	else
-		oy = length;
-
-	for(; oy > 0; oy--) {
-		*(volatile uint16_t *) offset = (uint16_t) color;
-		offset += nx;
-	}
-}
+FB_BLITTERS_ALL(16bpp, 2)
 #endif
 
 /*
@@ -298,6 +261,13 @@ fb_memcpy(char *src, char *dst, int length)
 	static USE_FB_TRANS_TYPE *s, *d;
 	static int n;
 
+#ifdef USE_FB_SIMD
+	if (fb.copy) {
+		fb.copy(src, dst, length);
+		return;
+	}
+#endif
+
 	s = (USE_FB_TRANS_TYPE *)src;
 	d = (USE_FB_TRANS_TYPE *)dst;
 	n = USE_FB_TRANS_LENGTH(length);
@@ -307,6 +277,35 @@ fb_memcpy(char *src, char *dst, int length)
 	}
 }
 
+#ifdef USE_FB_SIMD
+/* Use SIMD kernels for spans and copies when CPU has them */
+static void fb_select_kernels(void)
+{
+	const fb_kernels *k;
+
+	k = fb_kernels_select();
+	if (NULL == k) return;
+
+	switch (fb.depth) {
+	case 32:
+		fb.fill_span = k->fill32;
+		break;
+	case 24:
+	case 18:
+		/* Pixels are 3 bytes long as drawing routines expect */
+		if (3 == fb.byte_pp)
+			fb.fill_span = k->fill24;
+		break;
+	case 16:
+		fb.fill_span = k->fill16;
+		break;
+	}
+	fb.copy = k->copy;
+
+	log_msg(lg, "Using %s framebuffer kernels", k->name);
+}
+#endif
+
 #ifdef USE_FBUI_UPDATE
 
 /*
@@ -334,18 +333,18 @@ static int fb_quirk_check_manual_update(void)
 	return 0;
 }
 
-/* Flush command mode LCD if needed */
-static void fb_quirk_manual_update(void)
+/* Flush area 'r' of command mode LCD if needed */
+static void fb_quirk_manual_update(struct fb_rect *r)
 {
 	struct omapfb_update_window uw;
 
 	if (!fb.needs_manual_update)
 		return;
 
-	uw.x = 0;
-	uw.y = 0;
-	uw.width = fb.real_width;
-	uw.height = fb.real_height;
+	uw.x = r->x1;
+	uw.y = r->y1;
+	uw.width = r->x2 - r->x1;
+	uw.height = r->y2 - r->y1;
 
 	ioctl(fb.fd, OMAPFB_UPDATE_WINDOW, &uw);
 	ioctl(fb.fd, OMAPFB_SYNC_GFX);
@@ -356,16 +355,173 @@ static inline int fb_quirk_check_manual_update(void)
 {
 	return 0;
 }
-static inline void fb_quirk_manual_update(void)
+static inline void fb_quirk_manual_update(struct fb_rect *r)
 {
 }
 #endif
 
+#ifdef USE_FBUI_FLIP
+/* Screen info used for panning */
+static struct fb_var_screeninfo flip_var;
+
+/* Ask for virtual screen of two pages */
+static int fb_flip_request(struct fb_var_screeninfo *fb_var)
+{
+	fb_var->xres_virtual = fb_var->xres;
+	fb_var->yres_virtual = fb_var->yres * 2;
+	fb_var->xoffset = 0;
+	fb_var->yoffset = 0;
+
+	if (ioctl(fb.fd, FBIOPUT_VSCREENINFO, fb_var) == -1)
+		return -1;
+	if (ioctl(fb.fd, FBIOGET_VSCREENINFO, fb_var) == -1)
+		return -1;
+
+	return (fb_var->yres_virtual < fb_var->yres * 2) ? -1 : 0;
+}
+
+/* Show page 'page' */
+static int fb_pan(int page)
+{
+	flip_var.xoffset = 0;
+	flip_var.yoffset = page * fb.real_height;
+
+	return ioctl(fb.fd, FBIOPAN_DISPLAY, &flip_var);
+}
+
+/* Show backbuffer page and draw into previously shown one then */
+static int fb_flip(void)
+{
+	char *page;
+	__u32 screen = 0;
+
+	if (!fb.flip) return -1;
+
+	/* Pan during vertical blank to avoid tearing */
+	if (fb.vsync && (ioctl(fb.fd, FBIO_WAITFORVSYNC, &screen) == -1))
+		fb.vsync = 0;
+
+	if (fb_pan(fb.backbuffer > fb.data) == -1) {
+		log_msg(lg, "Can't pan framebuffer, copying backbuffer: %s", ERRMSG);
+		fb.flip = 0;
+		return -1;
+	}
+
+	page = fb.data;
+	fb.data = fb.backbuffer;
+	fb.backbuffer = page;
+	return 0;
+}
+#else
+static inline int fb_flip(void)
+{
+	return -1;
+}
+#endif
+
+/* Convert area in screen coordinates to real ones and clip it */
+static void fb_real_rect(int x, int y, int width, int height,
+		struct fb_rect *r)
+{
+	int x1, y1, x2, y2;
+
+	fb_respect_angle(x, y, &x1, &y1, NULL);
+	fb_respect_angle(x + width - 1, y + height - 1, &x2, &y2, NULL);
+
+	r->x1 = (x1 < x2) ? x1 : x2;
+	r->x2 = ((x1 < x2) ? x2 : x1) + 1;
+	r->y1 = (y1 < y2) ? y1 : y2;
+	r->y2 = ((y1 < y2) ? y2 : y1) + 1;
+
+	if (r->x1 < 0) r->x1 = 0;
+	if (r->y1 < 0) r->y1 = 0;
+	if (r->x2 > fb.real_width) r->x2 = fb.real_width;
+	if (r->y2 > fb.real_height) r->y2 = fb.real_height;
+}
+
+/* Copy area 'r' between buffers of screen size */
+static void fb_copy_rect(char *src, char *dst, struct fb_rect *r)
+{
+	int start, end, offset, y;
+
+	if ((r->x2 <= r->x1) || (r->y2 <= r->y1)) return;
+
+	/* fb_memcpy() moves USE_FB_TRANS_TYPE units */
+	start = (r->x1 * fb.byte_pp) & ~(sizeof(USE_FB_TRANS_TYPE) - 1);
+	end = (r->x2 * fb.byte_pp + sizeof(USE_FB_TRANS_TYPE) - 1)
+			& ~(sizeof(USE_FB_TRANS_TYPE) - 1);
+	if (end > fb.stride) end = fb.stride;
+
+	if ((0 == start) && (fb.stride == end)) {
+		/* Whole lines are continuous */
+		offset = r->y1 * fb.stride;
+		fb_memcpy(src + offset, dst + offset, (r->y2 - r->y1) * fb.stride);
+		return;
+	}
+
+	for (y = r->y1; y < r->y2; y++) {
+		offset = y * fb.stride + start;
+		fb_memcpy(src + offset, dst + offset, end - start);
+	}
+}
+
+void fb_damage(int x, int y, int width, int height)
+{
+	struct fb_rect r, *d;
+
+	if ((width <= 0) || (height <= 0)) return;
+	fb_real_rect(x, y, width, height, &r);
+	if ((r.x2 <= r.x1) || (r.y2 <= r.y1)) return;
+
+	if (fb.damage_count < FB_DAMAGE_MAX) {
+		fb.damage[fb.damage_count++] = r;
+		return;
+	}
+
+	/* Merge into last area */
+	d = &fb.damage[FB_DAMAGE_MAX - 1];
+	if (r.x1 < d->x1) d->x1 = r.x1;
+	if (r.y1 < d->y1) d->y1 = r.y1;
+	if (r.x2 > d->x2) d->x2 = r.x2;
+	if (r.y2 > d->y2) d->y2 = r.y2;
+}
+
 /* Move backbuffer contents to videomemory */
 void fb_render()
 {
-	fb_memcpy(fb.backbuffer, fb.data, fb.screensize);
-	fb_quirk_manual_update();
+	struct fb_rect all;
+	int i;
+
+	all.x1 = 0;
+	all.y1 = 0;
+	all.x2 = fb.real_width;
+	all.y2 = fb.real_height;
+
+	if (0 == fb.damage_count) {
+		/* Whole frame is drawn into hidden page. Just show it */
+		if (-1 == fb_flip())
+			fb_memcpy(fb.backbuffer, fb.data, fb.screensize);
+		fb_quirk_manual_update(&all);
+		return;
+	}
+
+	/* Copy damaged areas and flush their bounding box. Rest of
+	 * hidden page can be older than shown one so it is never shown */
+	all.x1 = fb.real_width;
+	all.y1 = fb.real_height;
+	all.x2 = 0;
+	all.y2 = 0;
+	for (i = 0; i < fb.damage_count; i++) {
+		fb_copy_rect(fb.backbuffer, fb.data, &fb.damage[i]);
+		if (fb.damage[i].x1 < all.x1) all.x1 = fb.damage[i].x1;
+		if (fb.damage[i].y1 < all.y1) all.y1 = fb.damage[i].y1;
+		if (fb.damage[i].x2 > all.x2) all.x2 = fb.damage[i].x2;
+		if (fb.damage[i].y2 > all.y2) all.y2 = fb.damage[i].y2;
+	}
+	fb.damage_count = 0;
+
+	if ((all.x2 > all.x1) && (all.y2 > all.y1))
+		fb_quirk_manual_update(&all);
 }
 
 /* Save backbuffer contents to further usage */
@@ -387,12 +543,23 @@ void fb_restore(char *dump)
 	fb_memcpy(dump, fb.backbuffer, fb.screensize);
 }
 
+/* Restore area of saved backbuffer */
+void fb_restore_rect(char *dump, int x, int y, int width, int height)
+{
+	struct fb_rect r;
+
+	if ((NULL == dump) || (width <= 0) || (height <= 0)) return;
+
+	fb_real_rect(x, y, width, height, &r);
+	fb_copy_rect(dump, fb.backbuffer, &r);
+}
+
 
 void fb_destroy(FB fb)
 {
 	if (fb.fd >= 0)
 		close(fb.fd);
-	if(fb.backbuffer)
+	if (fb.backbuffer && (fb.pages < 2))
 		free(fb.backbuffer);
 }
 
@@ -519,6 +686,12 @@ int fb_new(int angle)
 		goto fail;
 	}
 
+#ifdef USE_FBUI_FLIP
+	/* Try two pages first */
+	if (0 == fb_flip_request(&fb_var))
+		fb.pages = 2;
+	else
+#endif
 	if (clear_virtual(&fb_var))
 	{
 		log_msg(lg, "Could not clear virtual resolution\n");
@@ -558,7 +731,6 @@ int fb_new(int angle)
 	strncpy(fb.id, fb_fix.id, 16);
 
 	fb.screensize = fb.stride * fb.height;
-	fb.backbuffer = malloc(fb.screensize);
 
 	fb.red_offset = fb_var.red.offset;
 	fb.red_length = fb_var.red.length;
@@ -581,9 +753,20 @@ int fb_new(int angle)
 	if (fb_quirk_check_manual_update())
 		fb.needs_manual_update = 1;
 
+	/* Second page should fit into videomemory and driver should pan */
+	if ((fb.pages > 1) && ((fb_var.yres_virtual < fb_var.yres * 2)
+			|| (fb_fix.ypanstep == 0)
+			|| (fb_fix.smem_len < 2 * fb.screensize)))
+	{
+		log_msg(lg, "Framebuffer can't flip pages");
+		fb.pages = 1;
+	}
+	if (fb.pages < 1)
+		fb.pages = 1;
+
 	fb.base = (char *) mmap((caddr_t) NULL,
 				 /*fb_fix.smem_len */
-				 fb.stride * fb.height,
+				 fb.pages * fb.stride * fb.height,
 				 PROT_READ | PROT_WRITE,
 				 MAP_SHARED, fb.fd, 0);
 
@@ -599,6 +782,28 @@ int fb_new(int angle)
 	fb.data = fb.base + off;
 	fb.angle = angle;
 
+#ifdef USE_FBUI_FLIP
+	if (fb.pages > 1) {
+		flip_var = fb_var;
+		if (-1 == fb_pan(0)) {
+			log_msg(lg, "Can't pan framebuffer: %s", ERRMSG);
+			fb.pages = 1;
+		} else {
+			fb.backbuffer = fb.data + fb.screensize;
+			fb.flip = 1;
+			fb.vsync = 1;
+		}
+	}
+#endif
+
+	if (fb.pages < 2) {
+		fb.backbuffer = malloc(fb.screensize);
+		if (NULL == fb.backbuffer) {
+			log_msg(lg, "Can't allocate backbuffer");
+			goto fail;
+		}
+	}
+
 	switch (fb.angle) {
 	case 270:
 	case 90:
@@ -618,26 +823,22 @@ int fb_new(int angle)
 	switch (fb.depth) {
 #ifdef USE_32BPP
 	case 32:
-		fb.plot_pixel = fb_plot_pixel_32bpp;
-		fb.draw_hline = fb_draw_hline_32bpp;
+		FB_BIND_BLITTERS(32bpp);
 		break;
 #endif
 #ifdef USE_24BPP
 	case 24:
-		fb.plot_pixel = fb_plot_pixel_24bpp;
-		fb.draw_hline = fb_draw_hline_24bpp;
+		FB_BIND_BLITTERS(24bpp);
 		break;
 #endif
 #ifdef USE_18BPP
 	case 18:
-		fb.plot_pixel = fb_plot_pixel_18bpp;
-		fb.draw_hline = fb_draw_hline_18bpp;
+		FB_BIND_BLITTERS(24bpp);
 		break;
 #endif
 #ifdef USE_16BPP
 	case 16:
-		fb.plot_pixel = fb_plot_pixel_16bpp;
-		fb.draw_hline = fb_draw_hline_16bpp;
+		FB_BIND_BLITTERS(16bpp);
 		break;
 #endif
 	default:
@@ -648,6 +849,10 @@ int fb_new(int angle)
 		break;
 	}
 
+#ifdef USE_FB_SIMD
+	fb_select_kernels();
+#endif
+
 	return 0;
 
 fail:
@@ -38,6 +38,7 @@
 #include "util.h"
 #include "../res/fonts/font.h"
 #include "rgb.h"
+#include "fbsimd.h"
 
 typedef void (*plot_pixel_func)(int x, int y,
 		kx_rgba color);
@@ -45,6 +46,15 @@ typedef void (*plot_pixel_func)(int x, int y,
 typedef void (*draw_hline_func)(int x, int y, int length,
 		kx_rgba color);
 
+/* Max number of damaged areas kept apart. Extra ones are merged */
+#define FB_DAMAGE_MAX	8
+
+/* Area of framebuffer in real (rotated) coordinates, ends are excluded */
+struct fb_rect {
+	int x1, y1;
+	int x2, y2;
+};
+
 typedef struct FB {
 	int fd;
 	int type;
@@ -75,6 +85,19 @@ typedef struct FB {
 
 	plot_pixel_func plot_pixel;
 	draw_hline_func draw_hline;
+#ifdef USE_FB_SIMD
+	fb_fill_func fill_span;		/* Fills pixels along memory */
+	fb_copy_func copy;			/* Used by fb_memcpy() */
+#endif
+
+	/* Areas changed since last fb_render() when only part is redrawn */
+	struct fb_rect damage[FB_DAMAGE_MAX];
+	int damage_count;
+
+	/* Backbuffer is hidden page of videomemory when there are 2 pages */
+	int pages;
+	int flip;		/* Pages can be switched by panning */
+	int vsync;		/* FBIO_WAITFORVSYNC works */
 } FB;
 
 extern FB fb;
@@ -119,7 +142,10 @@ void
 fb_draw_text(int x, int y, kx_rgba rgba,
 		const Font * font, const char *text);
 
-/* Move backbuffer contents to videomemory */
+/* Mark area as changed. Next fb_render() will copy changed areas only */
+void fb_damage(int x, int y, int width, int height);
+
+/* Move backbuffer contents (or damaged areas only) to videomemory */
 void fb_render();
 
 /* Save backbuffer contents to further usage */
@@ -128,6 +154,9 @@ char *fb_dump();
 /* Restore saved backbuffer */
 void fb_restore(char *dump);
 
+/* Restore area of saved backbuffer */
+void fb_restore_rect(char *dump, int x, int y, int width, int height);
+
 /* Draw picture on framebuffer */
 void fb_draw_picture(int x, int y, kx_picture *pic);
 
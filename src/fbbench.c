@@ -0,0 +1,198 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Framebuffer kernels benchmark
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Usage: kexecboot-fbbench [<width> <height> [<rounds>]]
+ *
+ * Draws horizontal lines over whole screen and copies it with scalar
+ * routines and with kernels chosen by fb_kernels_select() for every
+ * enabled depth. Screen is kept in memory, no framebuffer is opened.
+ * Results of both ways are compared.
+ *
+ * Drawing routines are static in fb.c so that file is built in here.
+ */
+
+#include <time.h>
+
+#include "fb.c"
+
+#ifdef USE_FB_SIMD
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Draw every line of screen 'rounds' times. Return seconds spent */
+static double bench_hline(int rounds, kx_rgba color)
+{
+	double t;
+	int i, y;
+
+	/* Lines start at different offsets to get all heads and tails */
+	t = now();
+	for (i = 0; i < rounds; i++)
+		for (y = 0; y < fb.height; y++)
+			fb.draw_hline(y & 15, y, fb.width - (y & 15), color);
+	return now() - t;
+}
+
+/* Copy backbuffer to screen 'rounds' times. Return seconds spent */
+static double bench_copy(int rounds)
+{
+	double t;
+	int i;
+
+	t = now();
+	for (i = 0; i < rounds; i++)
+		fb_memcpy(fb.backbuffer, fb.data, fb.screensize);
+	return now() - t;
+}
+
+/* Compare scalar and kernel routines at 'depth'. Return -1 on mismatch */
+static int bench_depth(const fb_kernels *k, int depth, int byte_pp,
+		int width, int height, int rounds)
+{
+	fb_fill_func fill;
+	char *scalar;
+	double ts, tk, mb;
+	int rc = 0;
+
+	fb.depth = depth;
+	fb.bpp = byte_pp * 8;
+	fb.byte_pp = byte_pp;
+	fb.width = fb.real_width = width;
+	fb.height = fb.real_height = height;
+	fb.angle = 0;
+	fb.stride = width * byte_pp;
+	fb.screensize = fb.stride * height;
+
+	fb.backbuffer = malloc(fb.screensize);
+	fb.data = malloc(fb.screensize);
+	scalar = malloc(fb.screensize);
+	if (!fb.backbuffer || !fb.data || !scalar) {
+		printf("Can't allocate %d bytes\n", fb.screensize);
+		rc = -1;
+		goto out;
+	}
+
+	switch (depth) {
+#ifdef USE_32BPP
+	case 32:
+		FB_BIND_BLITTERS(32bpp);
+		fill = k->fill32;
+		break;
+#endif
+#if defined(USE_24BPP) || defined(USE_18BPP)
+	case 24:
+	case 18:
+		FB_BIND_BLITTERS(24bpp);
+		fill = k->fill24;
+		break;
+#endif
+#ifdef USE_16BPP
+	case 16:
+		FB_BIND_BLITTERS(16bpp);
+		fill = k->fill16;
+		break;
+#endif
+	default:
+		goto out;
+	}
+
+	mb = (double)fb.screensize * rounds / (1024 * 1024);
+	printf("%2d bpp %dx%d:\n", depth, width, height);
+
+	/* Color bytes differ to catch byte order mistakes */
+	fb.fill_span = NULL;
+	memset(fb.backbuffer, 0, fb.screensize);
+	ts = bench_hline(rounds, 0x123456);
+	memcpy(scalar, fb.backbuffer, fb.screensize);
+	fb.fill_span = fill;
+	memset(fb.backbuffer, 0, fb.screensize);
+	tk = bench_hline(rounds, 0x123456);
+	printf("  draw_hline: scalar %8.1f MB/s, %s %8.1f MB/s\n",
+			mb / ts, k->name, mb / tk);
+	if (memcmp(scalar, fb.backbuffer, fb.screensize)) {
+		printf("  draw_hline results differ\n");
+		rc = -1;
+	}
+
+	fb.copy = NULL;
+	memset(fb.data, 0, fb.screensize);
+	ts = bench_copy(rounds);
+	memcpy(scalar, fb.data, fb.screensize);
+	fb.copy = k->copy;
+	memset(fb.data, 0, fb.screensize);
+	tk = bench_copy(rounds);
+	printf("  fb_memcpy:  scalar %8.1f MB/s, %s %8.1f MB/s\n",
+			mb / ts, k->name, mb / tk);
+	if (memcmp(scalar, fb.data, fb.screensize)) {
+		printf("  fb_memcpy results differ\n");
+		rc = -1;
+	}
+
+out:
+	fb.fill_span = NULL;
+	fb.copy = NULL;
+	dispose(fb.backbuffer);
+	dispose(fb.data);
+	free(scalar);
+	return rc;
+}
+#endif
+
+int main(int argc, char **argv)
+{
+#ifdef USE_FB_SIMD
+	const fb_kernels *k;
+	int width, height, rounds, rc = 0;
+
+	width = (argc > 2) ? atoi(argv[1]) : 1024;
+	height = (argc > 2) ? atoi(argv[2]) : 768;
+	rounds = (argc > 3) ? atoi(argv[3]) : 50;
+	if ((width <= 0) || (height <= 0) || (rounds <= 0)) {
+		fprintf(stderr, "Usage: %s [<width> <height> [<rounds>]]\n", argv[0]);
+		return 2;
+	}
+
+	k = fb_kernels_select();
+	if (NULL == k) {
+		printf("No framebuffer kernels for this CPU\n");
+		return 0;
+	}
+
+#ifdef USE_32BPP
+	if (-1 == bench_depth(k, 32, 4, width, height, rounds)) rc = 1;
+#endif
+#ifdef USE_24BPP
+	if (-1 == bench_depth(k, 24, 3, width, height, rounds)) rc = 1;
+#endif
+#ifdef USE_18BPP
+	if (-1 == bench_depth(k, 18, 3, width, height, rounds)) rc = 1;
+#endif
+#ifdef USE_16BPP
+	if (-1 == bench_depth(k, 16, 2, width, height, rounds)) rc = 1;
+#endif
+
+	return rc;
+#else
+	printf("Framebuffer kernels are disabled (--enable-fb-simd)\n");
+	return 0;
+#endif
+}
@@ -0,0 +1,343 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  SIMD kernels for framebuffer fills and copies
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_FB_SIMD
+#include <stddef.h>
+
+#include "fbsimd.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_KERNELS
+/* AVX2 code is built for target attribute and chosen at runtime */
+#if defined(__clang__) || (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9))
+#include <immintrin.h>
+#define HAVE_AVX2_KERNELS
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HAVE_NEON_KERNELS
+#endif
+
+#if defined(HAVE_SSE2_KERNELS) || defined(HAVE_NEON_KERNELS)
+
+typedef USE_FB_TRANS_TYPE fb_unit;
+
+/**************************************************************************
+ * Scalar parts: heads and tails of spans
+ */
+static inline void fill32_tail(char *dst, uint32_t color, int count)
+{
+	for (; count > 0; count--, dst += 4)
+		*(uint32_t *)dst = color;
+}
+
+static inline void fill16_tail(char *dst, uint32_t color, int count)
+{
+	for (; count > 0; count--, dst += 2)
+		*(uint16_t *)dst = (uint16_t)color;
+}
+
+static inline void fill24_tail(char *dst, uint32_t color, int count)
+{
+	for (; count > 0; count--, dst += 3) {
+		dst[0] = (color & 0x000000FF);
+		dst[1] = (color & 0x0000FF00) >> 8;
+		dst[2] = (color & 0x00FF0000) >> 16;
+	}
+}
+
+/* Copy whole units of transfer type */
+static inline void copy_units(char **src, char **dst, int *length, int limit)
+{
+	while ((*length >= (int)sizeof(fb_unit)) && (limit > 0)) {
+		*(fb_unit *)*dst = *(fb_unit *)*src;
+		*src += sizeof(fb_unit);
+		*dst += sizeof(fb_unit);
+		*length -= sizeof(fb_unit);
+		limit -= sizeof(fb_unit);
+	}
+}
+
+#endif
+
+#if defined(HAVE_SSE2_KERNELS)
+/* Pattern of 'count' pixels of 3 bytes */
+static void pattern24(uint8_t *p, uint32_t color, int count)
+{
+	for (; count > 0; count--, p += 3) {
+		p[0] = (color & 0x000000FF);
+		p[1] = (color & 0x0000FF00) >> 8;
+		p[2] = (color & 0x00FF0000) >> 16;
+	}
+}
+#endif
+
+
+#ifdef HAVE_SSE2_KERNELS
+/**************************************************************************
+ * SSE2 kernels
+ */
+static void sse2_fill32(char *dst, uint32_t color, int count)
+{
+	__m128i v = _mm_set1_epi32(color);
+
+	for (; count >= 4; count -= 4, dst += 16)
+		_mm_storeu_si128((__m128i *)dst, v);
+	fill32_tail(dst, color, count);
+}
+
+static void sse2_fill16(char *dst, uint32_t color, int count)
+{
+	__m128i v = _mm_set1_epi16((short)color);
+
+	for (; count >= 8; count -= 8, dst += 16)
+		_mm_storeu_si128((__m128i *)dst, v);
+	fill16_tail(dst, color, count);
+}
+
+static void sse2_fill24(char *dst, uint32_t color, int count)
+{
+	uint8_t p[48];
+	__m128i v0, v1, v2;
+
+	if (count >= 16) {
+		/* 16 pixels fit in 3 vectors */
+		pattern24(p, color, 16);
+		v0 = _mm_loadu_si128((__m128i *)p);
+		v1 = _mm_loadu_si128((__m128i *)(p + 16));
+		v2 = _mm_loadu_si128((__m128i *)(p + 32));
+
+		for (; count >= 16; count -= 16, dst += 48) {
+			_mm_storeu_si128((__m128i *)dst, v0);
+			_mm_storeu_si128((__m128i *)(dst + 16), v1);
+			_mm_storeu_si128((__m128i *)(dst + 32), v2);
+		}
+	}
+	fill24_tail(dst, color, count);
+}
+
+static void sse2_copy(char *src, char *dst, int length)
+{
+	__m128i v0, v1, v2, v3;
+
+	/* Streaming stores need aligned destination */
+	copy_units(&src, &dst, &length, (16 - ((size_t)dst & 15)) & 15);
+
+	if (0 == ((size_t)dst & 15)) {
+		for (; length >= 64; length -= 64, src += 64, dst += 64) {
+			v0 = _mm_loadu_si128((__m128i *)src);
+			v1 = _mm_loadu_si128((__m128i *)(src + 16));
+			v2 = _mm_loadu_si128((__m128i *)(src + 32));
+			v3 = _mm_loadu_si128((__m128i *)(src + 48));
+			_mm_stream_si128((__m128i *)dst, v0);
+			_mm_stream_si128((__m128i *)(dst + 16), v1);
+			_mm_stream_si128((__m128i *)(dst + 32), v2);
+			_mm_stream_si128((__m128i *)(dst + 48), v3);
+		}
+		for (; length >= 16; length -= 16, src += 16, dst += 16)
+			_mm_stream_si128((__m128i *)dst,
+					_mm_loadu_si128((__m128i *)src));
+		_mm_sfence();
+	} else {
+		for (; length >= 16; length -= 16, src += 16, dst += 16)
+			_mm_storeu_si128((__m128i *)dst,
+					_mm_loadu_si128((__m128i *)src));
+	}
+
+	copy_units(&src, &dst, &length, length);
+}
+
+static const fb_kernels sse2_kernels = {
+	"SSE2",
+	sse2_fill32,
+	sse2_fill24,
+	sse2_fill16,
+	sse2_copy
+};
+#endif	/* HAVE_SSE2_KERNELS */
+
+
+#ifdef HAVE_AVX2_KERNELS
+/**************************************************************************
+ * AVX2 kernels
+ */
+#define AVX2_KERNEL __attribute__((target("avx2")))
+
+AVX2_KERNEL static void avx2_fill32(char *dst, uint32_t color, int count)
+{
+	__m256i v = _mm256_set1_epi32(color);
+
+	for (; count >= 8; count -= 8, dst += 32)
+		_mm256_storeu_si256((__m256i *)dst, v);
+	fill32_tail(dst, color, count);
+}
+
+AVX2_KERNEL static void avx2_fill16(char *dst, uint32_t color, int count)
+{
+	__m256i v = _mm256_set1_epi16((short)color);
+
+	for (; count >= 16; count -= 16, dst += 32)
+		_mm256_storeu_si256((__m256i *)dst, v);
+	fill16_tail(dst, color, count);
+}
+
+AVX2_KERNEL static void avx2_fill24(char *dst, uint32_t color, int count)
+{
+	uint8_t p[96];
+	__m256i v0, v1, v2;
+
+	if (count >= 32) {
+		/* 32 pixels fit in 3 vectors */
+		pattern24(p, color, 32);
+		v0 = _mm256_loadu_si256((__m256i *)p);
+		v1 = _mm256_loadu_si256((__m256i *)(p + 32));
+		v2 = _mm256_loadu_si256((__m256i *)(p + 64));
+
+		for (; count >= 32; count -= 32, dst += 96) {
+			_mm256_storeu_si256((__m256i *)dst, v0);
+			_mm256_storeu_si256((__m256i *)(dst + 32), v1);
+			_mm256_storeu_si256((__m256i *)(dst + 64), v2);
+		}
+	}
+	fill24_tail(dst, color, count);
+}
+
+AVX2_KERNEL static void avx2_copy(char *src, char *dst, int length)
+{
+	__m256i v0, v1;
+
+	/* Streaming stores need aligned destination */
+	copy_units(&src, &dst, &length, (32 - ((size_t)dst & 31)) & 31);
+
+	if (0 == ((size_t)dst & 31)) {
+		for (; length >= 64; length -= 64, src += 64, dst += 64) {
+			v0 = _mm256_loadu_si256((__m256i *)src);
+			v1 = _mm256_loadu_si256((__m256i *)(src + 32));
+			_mm256_stream_si256((__m256i *)dst, v0);
+			_mm256_stream_si256((__m256i *)(dst + 32), v1);
+		}
+		for (; length >= 32; length -= 32, src += 32, dst += 32)
+			_mm256_stream_si256((__m256i *)dst,
+					_mm256_loadu_si256((__m256i *)src));
+		_mm_sfence();
+	} else {
+		for (; length >= 32; length -= 32, src += 32, dst += 32)
+			_mm256_storeu_si256((__m256i *)dst,
+					_mm256_loadu_si256((__m256i *)src));
+	}
+
+	copy_units(&src, &dst, &length, length);
+}
+
+static const fb_kernels avx2_kernels = {
+	"AVX2",
+	avx2_fill32,
+	avx2_fill24,
+	avx2_fill16,
+	avx2_copy
+};
+#endif	/* HAVE_AVX2_KERNELS */
+
+
+#ifdef HAVE_NEON_KERNELS
+/**************************************************************************
+ * NEON kernels. There are no non-temporal store intrinsics so
+ * copies use plain stores
+ */
+static void neon_fill32(char *dst, uint32_t color, int count)
+{
+	uint8x16_t v = vreinterpretq_u8_u32(vdupq_n_u32(color));
+
+	for (; count >= 4; count -= 4, dst += 16)
+		vst1q_u8((uint8_t *)dst, v);
+	fill32_tail(dst, color, count);
+}
+
+static void neon_fill16(char *dst, uint32_t color, int count)
+{
+	uint8x16_t v = vreinterpretq_u8_u16(vdupq_n_u16((uint16_t)color));
+
+	for (; count >= 8; count -= 8, dst += 16)
+		vst1q_u8((uint8_t *)dst, v);
+	fill16_tail(dst, color, count);
+}
+
+static void neon_fill24(char *dst, uint32_t color, int count)
+{
+	uint8x16x3_t v;
+
+	/* Interleaving store puts 16 pixels at once */
+	v.val[0] = vdupq_n_u8(color & 0x000000FF);
+	v.val[1] = vdupq_n_u8((color & 0x0000FF00) >> 8);
+	v.val[2] = vdupq_n_u8((color & 0x00FF0000) >> 16);
+
+	for (; count >= 16; count -= 16, dst += 48)
+		vst3q_u8((uint8_t *)dst, v);
+	fill24_tail(dst, color, count);
+}
+
+static void neon_copy(char *src, char *dst, int length)
+{
+	uint8x16_t v0, v1, v2, v3;
+
+	for (; length >= 64; length -= 64, src += 64, dst += 64) {
+		v0 = vld1q_u8((uint8_t *)src);
+		v1 = vld1q_u8((uint8_t *)(src + 16));
+		v2 = vld1q_u8((uint8_t *)(src + 32));
+		v3 = vld1q_u8((uint8_t *)(src + 48));
+		vst1q_u8((uint8_t *)dst, v0);
+		vst1q_u8((uint8_t *)(dst + 16), v1);
+		vst1q_u8((uint8_t *)(dst + 32), v2);
+		vst1q_u8((uint8_t *)(dst + 48), v3);
+	}
+	for (; length >= 16; length -= 16, src += 16, dst += 16)
+		vst1q_u8((uint8_t *)dst, vld1q_u8((uint8_t *)src));
+
+	copy_units(&src, &dst, &length, length);
+}
+
+static const fb_kernels neon_kernels = {
+	"NEON",
+	neon_fill32,
+	neon_fill24,
+	neon_fill16,
+	neon_copy
+};
+#endif	/* HAVE_NEON_KERNELS */
+
+
+const fb_kernels *fb_kernels_select(void)
+{
+#if defined(HAVE_SSE2_KERNELS)
+#ifdef HAVE_AVX2_KERNELS
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return &avx2_kernels;
+#endif
+	return &sse2_kernels;
+#elif defined(HAVE_NEON_KERNELS)
+	return &neon_kernels;
+#else
+	return NULL;
+#endif
+}
+
+#endif	/* USE_FB_SIMD */
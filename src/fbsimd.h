@@ -0,0 +1,45 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  SIMD kernels for framebuffer fills and copies
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_FBSIMD_H_
+#define _HAVE_FBSIMD_H_
+
+#include "config.h"
+
+#ifdef USE_FB_SIMD
+#include <stdint.h>
+
+/* Fill 'count' pixels starting at 'dst' with 'color' */
+typedef void (*fb_fill_func)(char *dst, uint32_t color, int count);
+
+/* Copy 'length' bytes from 'src' to 'dst'. Tail shorter than
+ * USE_FB_TRANS_TYPE is not copied as with fb_memcpy() */
+typedef void (*fb_copy_func)(char *src, char *dst, int length);
+
+typedef struct {
+	const char *name;
+	fb_fill_func fill32;	/* 4 bytes per pixel */
+	fb_fill_func fill24;	/* 3 bytes per pixel (24bpp and 18bpp) */
+	fb_fill_func fill16;	/* 2 bytes per pixel */
+	fb_copy_func copy;		/* Streams data to videomemory if possible */
+} fb_kernels;
+
+/* Return fastest kernels supported by CPU or NULL when there are none */
+const fb_kernels *fb_kernels_select(void);
+
+#endif	/* USE_FB_SIMD */
+
+#endif	/* _HAVE_FBSIMD_H_ */
@@ -0,0 +1,809 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Files lookup on unmounted filesystems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_FS_LOOKUP
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+
+#if defined(HAVE_ZLIB_H) && defined(HAVE_LIBZ)
+#include <zlib.h>
+#define FSL_ZLIB
+#endif
+
+#include "fslookup.h"
+
+/* Don't walk directories bigger than that */
+#define FSL_MAX_DIR		(16 << 20)
+
+/* Type of directory entry */
+enum { FSL_T_DIR, FSL_T_LINK, FSL_T_OTHER };
+
+/* Find 'name' in directory 'dir' of filesystem 'fs'.
+ * Directory references are filesystem specific */
+typedef int (*fsl_find_t)(void *fs, unsigned long long dir, const char *name,
+		unsigned long long *child, int *type);
+
+
+static unsigned int get_le16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static unsigned int get_le32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+static unsigned long long get_le64(const unsigned char *p)
+{
+	return get_le32(p) | ((unsigned long long)get_le32(p + 4) << 32);
+}
+
+static int read_at(int fd, void *buf, size_t len, unsigned long long pos)
+{
+	return (pread(fd, buf, len, pos) == (ssize_t)len) ? 0 : -1;
+}
+
+
+/* Walk 'path' component by component starting from 'root' directory */
+static int fsl_walk(void *fs, fsl_find_t find, unsigned long long root,
+		const char *path)
+{
+	char name[256];
+	const char *end;
+	size_t len;
+	int rc, type;
+	unsigned long long dir = root;
+
+	for (;;) {
+		while ('/' == *path) path++;
+		if ('\0' == *path) return FSL_FOUND;
+
+		end = strchr(path, '/');
+		len = end ? (size_t)(end - path) : strlen(path);
+		if (len >= sizeof(name)) return FSL_UNKNOWN;
+		memcpy(name, path, len);
+		name[len] = '\0';
+		path += len;
+
+		if (!strcmp(name, ".") || !strcmp(name, ".."))
+			return FSL_UNKNOWN;
+
+		rc = find(fs, dir, name, &dir, &type);
+		if (FSL_FOUND != rc) return rc;
+
+		while ('/' == *path) path++;
+		if ('\0' == *path) return FSL_FOUND;
+
+		/* Intermediate component should be directory */
+		if (FSL_T_LINK == type) return FSL_UNKNOWN;
+		if (FSL_T_DIR != type) return FSL_MISSING;
+	}
+}
+
+
+/*
+ * ext2/3/4
+ */
+#define EXT_SB_MAGIC		0xEF53
+#define EXT_ROOT_INO		2
+#define EXT_INODE_LEN		128		/* Part of inode we need */
+
+/* Incompatible features which don't change directories lookup */
+#define EXT_INCOMPAT_OK		(0x0002 /* filetype */ | 0x0040 /* extents */ \
+		| 0x0080 /* 64bit */ | 0x0100 /* mmp */ | 0x0200 /* flex_bg */ \
+		| 0x0400 /* ea_inode */ | 0x2000 /* csum_seed */ \
+		| 0x4000 /* largedir */ | 0x8000 /* inline_data */ \
+		| 0x10000 /* encrypt */ | 0x20000 /* casefold */)
+
+/* Inode flags we can't handle */
+#define EXT_FL_UNSUPPORTED	(0x00000004 /* compressed */ \
+		| 0x00000800 /* encrypted */ | 0x10000000 /* inline data */ \
+		| 0x40000000 /* casefold */)
+#define EXT_FL_EXTENTS		0x00080000
+
+struct ext_fs {
+	int fd;
+	unsigned int block_size;
+	unsigned int inode_size;
+	unsigned int inodes_per_group;
+	unsigned int groups;
+	unsigned int desc_size;
+	unsigned long long gdt;		/* Group descriptors position */
+	unsigned char *buf;			/* Directory block */
+};
+
+struct ext_search {
+	const char *name;
+	unsigned int len;
+	unsigned long long blocks;	/* Directory blocks left */
+	unsigned int ino;			/* Inode found */
+};
+
+static int ext_read_inode(struct ext_fs *fs, unsigned int ino,
+		unsigned char *inode)
+{
+	unsigned char desc[64];
+	unsigned int group, index;
+	unsigned long long table;
+
+	if (0 == ino) return -1;
+	group = (ino - 1) / fs->inodes_per_group;
+	index = (ino - 1) % fs->inodes_per_group;
+	if (group >= fs->groups) return -1;
+
+	if (read_at(fs->fd, desc, fs->desc_size >= 64 ? 64 : 32,
+			fs->gdt + (unsigned long long)group * fs->desc_size))
+		return -1;
+
+	table = get_le32(desc + 0x08);
+	if (fs->desc_size >= 64)
+		table |= (unsigned long long)get_le32(desc + 0x28) << 32;
+
+	return read_at(fs->fd, inode, EXT_INODE_LEN,
+			table * fs->block_size + (unsigned long long)index * fs->inode_size);
+}
+
+static int ext_type(const unsigned char *inode)
+{
+	switch (get_le16(inode) & 0xF000) {
+	case 0x4000:
+		return FSL_T_DIR;
+	case 0xA000:
+		return FSL_T_LINK;
+	default:
+		return FSL_T_OTHER;
+	}
+}
+
+static int ext_scan_block(struct ext_fs *fs, unsigned long long block,
+		struct ext_search *s)
+{
+	unsigned char *p = fs->buf;
+	unsigned int pos, rec_len;
+
+	if (0 == s->blocks) return FSL_MISSING;
+	s->blocks--;
+	if (0 == block) return FSL_MISSING;	/* Hole */
+
+	if (read_at(fs->fd, p, fs->block_size, block * fs->block_size))
+		return FSL_UNKNOWN;
+
+	for (pos = 0; pos + 8 <= fs->block_size; pos += rec_len) {
+		rec_len = get_le16(p + pos + 4);
+		if ((65536 == fs->block_size) && ((0 == rec_len) || (65535 == rec_len)))
+			rec_len = 65536;
+		if ((rec_len < 8) || (rec_len & 3) || (pos + rec_len > fs->block_size))
+			return FSL_UNKNOWN;
+
+		/* Deleted entries and htree nodes have zero inode */
+		if (get_le32(p + pos) && (p[pos + 6] == s->len)
+				&& (8 + s->len <= rec_len)
+				&& !memcmp(p + pos + 8, s->name, s->len))
+		{
+			s->ino = get_le32(p + pos);
+			return FSL_FOUND;
+		}
+	}
+
+	return FSL_MISSING;
+}
+
+static int ext_scan_indirect(struct ext_fs *fs, unsigned long long block,
+		int level, struct ext_search *s)
+{
+	unsigned char *map;
+	unsigned int i;
+	int rc = FSL_MISSING;
+
+	if (0 == level) return ext_scan_block(fs, block, s);
+	if (0 == block) return FSL_MISSING;
+
+	map = malloc(fs->block_size);
+	if (NULL == map) return FSL_UNKNOWN;
+
+	if (read_at(fs->fd, map, fs->block_size, block * fs->block_size)) {
+		free(map);
+		return FSL_UNKNOWN;
+	}
+
+	for (i = 0; (i < fs->block_size / 4) && s->blocks; i++) {
+		rc = ext_scan_indirect(fs, get_le32(map + i * 4), level - 1, s);
+		if (FSL_MISSING != rc) break;
+	}
+
+	free(map);
+	return rc;
+}
+
+static int ext_scan_extents(struct ext_fs *fs, const unsigned char *node,
+		unsigned int size, unsigned int max_depth, struct ext_search *s)
+{
+	const unsigned char *e;
+	unsigned char *child;
+	unsigned int entries, depth, len, i, b;
+	unsigned long long start;
+	int rc;
+
+	if ((size < 12) || (get_le16(node) != 0xF30A))
+		return FSL_UNKNOWN;
+
+	entries = get_le16(node + 2);
+	depth = get_le16(node + 6);
+	if ((12 + entries * 12 > size) || (depth > max_depth))
+		return FSL_UNKNOWN;
+
+	for (i = 0; (i < entries) && s->blocks; i++) {
+		e = node + 12 + i * 12;
+
+		if (0 == depth) {
+			len = get_le16(e + 4);
+			if (len > 32768) continue;	/* Uninitialized, reads as zeros */
+			start = get_le32(e + 8) | ((unsigned long long)get_le16(e + 6) << 32);
+
+			for (b = 0; b < len; b++) {
+				rc = ext_scan_block(fs, start + b, s);
+				if (FSL_MISSING != rc) return rc;
+			}
+			continue;
+		}
+
+		start = get_le32(e + 4) | ((unsigned long long)get_le16(e + 8) << 32);
+		child = malloc(fs->block_size);
+		if (NULL == child) return FSL_UNKNOWN;
+
+		if (read_at(fs->fd, child, fs->block_size, start * fs->block_size))
+			rc = FSL_UNKNOWN;
+		else
+			rc = ext_scan_extents(fs, child, fs->block_size, depth - 1, s);
+		free(child);
+		if (FSL_MISSING != rc) return rc;
+	}
+
+	return FSL_MISSING;
+}
+
+static int ext_find(void *ctx, unsigned long long dir, const char *name,
+		unsigned long long *child, int *type)
+{
+	struct ext_fs *fs = ctx;
+	struct ext_search s;
+	unsigned char inode[EXT_INODE_LEN];
+	unsigned long long size;
+	unsigned int flags;
+	int i, rc;
+
+	if (ext_read_inode(fs, dir, inode)) return FSL_UNKNOWN;
+
+	flags = get_le32(inode + 0x20);
+	if (flags & EXT_FL_UNSUPPORTED) return FSL_UNKNOWN;
+
+	size = get_le32(inode + 0x04) | ((unsigned long long)get_le32(inode + 0x6C) << 32);
+	if (size > FSL_MAX_DIR) return FSL_UNKNOWN;
+
+	s.name = name;
+	s.len = strlen(name);
+	s.blocks = (size + fs->block_size - 1) / fs->block_size;
+
+	/* i_block: extents tree root or 12 direct and 3 indirect blocks */
+	if (flags & EXT_FL_EXTENTS) {
+		rc = ext_scan_extents(fs, inode + 0x28, 60, 5, &s);
+	} else {
+		rc = FSL_MISSING;
+		for (i = 0; (i < 15) && (FSL_MISSING == rc) && s.blocks; i++)
+			rc = ext_scan_indirect(fs, get_le32(inode + 0x28 + i * 4),
+					(i < 12) ? 0 : i - 11, &s);
+	}
+	if (FSL_FOUND != rc) return rc;
+
+	if (ext_read_inode(fs, s.ino, inode)) return FSL_UNKNOWN;
+
+	*child = s.ino;
+	*type = ext_type(inode);
+	return FSL_FOUND;
+}
+
+static int ext_lookup(int fd, const char *path)
+{
+	struct ext_fs fs;
+	unsigned char sb[1024];
+	unsigned int log_size, incompat;
+	int rc;
+
+	if (read_at(fd, sb, sizeof(sb), 1024)) return FSL_UNKNOWN;
+	if (get_le16(sb + 0x38) != EXT_SB_MAGIC) return FSL_UNKNOWN;
+
+	/* Journal needing recovery, meta_bg, compression, ... */
+	incompat = get_le32(sb + 0x60);
+	if (incompat & ~EXT_INCOMPAT_OK) return FSL_UNKNOWN;
+
+	log_size = get_le32(sb + 0x18);
+	if (log_size > 6) return FSL_UNKNOWN;
+
+	fs.fd = fd;
+	fs.block_size = 1024 << log_size;
+	fs.inode_size = get_le32(sb + 0x4C) ? get_le16(sb + 0x58) : 128;
+	fs.inodes_per_group = get_le32(sb + 0x28);
+	fs.desc_size = (incompat & 0x0080) ? get_le16(sb + 0xFE) : 32;
+	fs.gdt = (get_le32(sb + 0x14) + 1ULL) * fs.block_size;
+
+	if ((fs.inode_size < EXT_INODE_LEN) || (fs.inode_size > fs.block_size)
+			|| (0 == fs.inodes_per_group) || (fs.desc_size < 32))
+		return FSL_UNKNOWN;
+
+	fs.groups = (get_le32(sb) + fs.inodes_per_group - 1) / fs.inodes_per_group;
+
+	fs.buf = malloc(fs.block_size);
+	if (NULL == fs.buf) return FSL_UNKNOWN;
+
+	rc = fsl_walk(&fs, ext_find, EXT_ROOT_INO, path);
+
+	free(fs.buf);
+	return rc;
+}
+
+
+/*
+ * vfat
+ */
+#define FAT_EOC				0xFFFFFFFF
+#define FAT_ATTR_VOLUME		0x08
+#define FAT_ATTR_DIR		0x10
+#define FAT_ATTR_LFN		0x0F
+
+struct fat_fs {
+	int fd;
+	int bits;					/* FAT12/16/32 */
+	unsigned int cluster_size;
+	unsigned int clusters;		/* Data clusters count */
+	unsigned int sector_size;
+	unsigned int root_cluster;	/* FAT32 only */
+	unsigned int root_size;		/* FAT12/16 only */
+	unsigned long long root_pos;
+	unsigned long long fat_pos;
+	unsigned long long data_pos;	/* Position of cluster 2 */
+	unsigned char *buf;			/* Directory cluster */
+};
+
+struct fat_search {
+	const char *name;
+	char short_name[11];		/* 8.3 form of name */
+	int has_short;
+	char lfn[20 * 13 + 1];		/* Long name of following entry */
+	int lfn_ok;
+	unsigned int cluster;		/* Entry found */
+	int is_dir;
+};
+
+/* Return next cluster in chain, FAT_EOC at end or 0 on error */
+static unsigned int fat_next(struct fat_fs *fs, unsigned int c)
+{
+	unsigned char b[4];
+	unsigned int v;
+
+	switch (fs->bits) {
+	case 32:
+		if (read_at(fs->fd, b, 4, fs->fat_pos + c * 4ULL)) return 0;
+		v = get_le32(b) & 0x0FFFFFFF;
+		return (v >= 0x0FFFFFF8) ? FAT_EOC : v;
+	case 16:
+		if (read_at(fs->fd, b, 2, fs->fat_pos + c * 2ULL)) return 0;
+		v = get_le16(b);
+		return (v >= 0xFFF8) ? FAT_EOC : v;
+	default:
+		if (read_at(fs->fd, b, 2, fs->fat_pos + c + c / 2)) return 0;
+		v = get_le16(b);
+		v = (c & 1) ? (v >> 4) : (v & 0xFFF);
+		return (v >= 0xFF8) ? FAT_EOC : v;
+	}
+}
+
+/* Convert name to 8.3 form. Return -1 if name is not 8.3 one */
+static int fat_short_name(const char *name, char *sn)
+{
+	const char *dot;
+	size_t len, ext, i;
+
+	dot = strrchr(name, '.');
+	len = dot ? (size_t)(dot - name) : strlen(name);
+	ext = dot ? strlen(dot + 1) : 0;
+	if ((0 == len) || (len > 8) || (ext > 3)) return -1;
+
+	memset(sn, ' ', 11);
+	for (i = 0; i < len + ext; i++) {
+		unsigned char c = (i < len) ? name[i] : dot[1 + i - len];
+
+		if (!isalnum(c) && !strchr("$%'-_@~`!(){}^#&", c)) return -1;
+		sn[(i < len) ? i : 8 + i - len] = toupper(c);
+	}
+	if (0xE5 == (unsigned char)sn[0]) sn[0] = 0x05;
+
+	return 0;
+}
+
+/* Add part of long name from LFN entry 'e' */
+static void fat_lfn_add(struct fat_search *s, const unsigned char *e)
+{
+	static const unsigned char offs[13] =
+			{ 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+	unsigned int seq, pos, c, i;
+
+	/* Parts go in reverse order, last one is marked */
+	if (e[0] & 0x40) {
+		memset(s->lfn, 0, sizeof(s->lfn));
+		s->lfn_ok = 1;
+	}
+
+	seq = e[0] & 0x1F;
+	if (!s->lfn_ok || (0 == seq) || (seq > 20)) {
+		s->lfn_ok = 0;
+		return;
+	}
+
+	pos = (seq - 1) * 13;
+	for (i = 0; i < 13; i++) {
+		c = get_le16(e + offs[i]);
+		if (0 == c) break;
+		/* We are looking for ASCII names only */
+		s->lfn[pos + i] = (c < 0x80) ? c : 1;
+	}
+}
+
+/* Scan 'size' bytes of directory entries. 'end' is set at end of directory */
+static int fat_scan(struct fat_search *s, const unsigned char *p,
+		unsigned int size, int *end)
+{
+	const unsigned char *e;
+	unsigned int pos;
+	int match;
+
+	for (pos = 0; pos + 32 <= size; pos += 32) {
+		e = p + pos;
+
+		if (0 == e[0]) {
+			*end = 1;
+			return FSL_MISSING;
+		}
+
+		if (0xE5 == e[0]) {
+			s->lfn_ok = 0;
+			continue;
+		}
+
+		if (FAT_ATTR_LFN == (e[11] & 0x3F)) {
+			fat_lfn_add(s, e);
+			continue;
+		}
+
+		if (e[11] & FAT_ATTR_VOLUME) {
+			s->lfn_ok = 0;
+			continue;
+		}
+
+		match = (s->has_short && !memcmp(e, s->short_name, 11))
+				|| (s->lfn_ok && !strcasecmp(s->lfn, s->name));
+		s->lfn_ok = 0;
+
+		if (match) {
+			s->cluster = get_le16(e + 26) | (get_le16(e + 20) << 16);
+			s->is_dir = e[11] & FAT_ATTR_DIR;
+			return FSL_FOUND;
+		}
+	}
+
+	return FSL_MISSING;
+}
+
+static int fat_find(void *ctx, unsigned long long dir, const char *name,
+		unsigned long long *child, int *type)
+{
+	struct fat_fs *fs = ctx;
+	struct fat_search s;
+	unsigned int c, n, off;
+	int rc = FSL_MISSING, end = 0;
+
+	s.name = name;
+	s.has_short = (0 == fat_short_name(name, s.short_name));
+	s.lfn_ok = 0;
+
+	if ((0 == dir) && (32 != fs->bits)) {
+		/* FAT12/16 root directory has fixed place */
+		for (off = 0; (off < fs->root_size) && !end; off += fs->sector_size) {
+			if (read_at(fs->fd, fs->buf, fs->sector_size, fs->root_pos + off))
+				return FSL_UNKNOWN;
+			rc = fat_scan(&s, fs->buf, fs->sector_size, &end);
+			if (FSL_MISSING != rc) break;
+		}
+	} else {
+		c = dir ? dir : fs->root_cluster;
+		for (n = 0; ; n++) {
+			if ((c < 2) || (c >= fs->clusters + 2)
+					|| ((unsigned long long)n * fs->cluster_size > FSL_MAX_DIR))
+				return FSL_UNKNOWN;
+
+			if (read_at(fs->fd, fs->buf, fs->cluster_size,
+					fs->data_pos + (unsigned long long)(c - 2) * fs->cluster_size))
+				return FSL_UNKNOWN;
+
+			rc = fat_scan(&s, fs->buf, fs->cluster_size, &end);
+			if ((FSL_MISSING != rc) || end) break;
+
+			c = fat_next(fs, c);
+			if (FAT_EOC == c) break;
+		}
+	}
+	if (FSL_FOUND != rc) return rc;
+
+	/* Cluster 0 of directory means root */
+	*child = (32 == fs->bits) ? s.cluster : (s.cluster & 0xFFFF);
+	*type = s.is_dir ? FSL_T_DIR : FSL_T_OTHER;
+	return FSL_FOUND;
+}
+
+static int fat_lookup(int fd, const char *path)
+{
+	struct fat_fs fs;
+	unsigned char bs[512];
+	unsigned int spc, reserved, fats, root_entries, fat_size;
+	unsigned long long total, data_sectors;
+	int rc;
+
+	if (read_at(fd, bs, sizeof(bs), 0)) return FSL_UNKNOWN;
+
+	fs.fd = fd;
+	fs.sector_size = get_le16(bs + 11);
+	spc = bs[13];
+	reserved = get_le16(bs + 14);
+	fats = bs[16];
+	root_entries = get_le16(bs + 17);
+	total = get_le16(bs + 19) ? get_le16(bs + 19) : get_le32(bs + 32);
+	fat_size = get_le16(bs + 22) ? get_le16(bs + 22) : get_le32(bs + 36);
+
+	if ((fs.sector_size < 512) || (fs.sector_size > 4096)
+			|| (fs.sector_size & (fs.sector_size - 1))
+			|| (0 == spc) || (spc & (spc - 1))
+			|| (0 == reserved) || (0 == fats) || (0 == fat_size))
+		return FSL_UNKNOWN;
+
+	data_sectors = reserved + (unsigned long long)fats * fat_size
+			+ (root_entries * 32 + fs.sector_size - 1) / fs.sector_size;
+	if (total <= data_sectors) return FSL_UNKNOWN;
+
+	fs.clusters = (total - data_sectors) / spc;
+	fs.bits = (fs.clusters < 4085) ? 12 : (fs.clusters < 65525) ? 16 : 32;
+	fs.cluster_size = fs.sector_size * spc;
+	fs.fat_pos = (unsigned long long)reserved * fs.sector_size;
+	fs.root_pos = fs.fat_pos + (unsigned long long)fats * fat_size * fs.sector_size;
+	fs.root_size = root_entries * 32;
+	fs.root_cluster = (32 == fs.bits) ? get_le32(bs + 44) : 0;
+	fs.data_pos = data_sectors * fs.sector_size;
+
+	fs.buf = malloc(fs.cluster_size);
+	if (NULL == fs.buf) return FSL_UNKNOWN;
+
+	rc = fsl_walk(&fs, fat_find, 0, path);
+
+	free(fs.buf);
+	return rc;
+}
+
+
+/*
+ * squashfs 4.0
+ */
+#define SQ_MAGIC			0x73717368
+#define SQ_META_SIZE		8192
+#define SQ_ZLIB				1
+
+struct sq_fs {
+	int fd;
+	int compression;
+	unsigned long long bytes_used;
+	unsigned long long inode_table;
+	unsigned long long dir_table;
+	unsigned long long cached;	/* Position of cached metadata block */
+	unsigned long long next;	/* Position of following block */
+	unsigned int fill;
+	unsigned char data[SQ_META_SIZE];
+#ifdef FSL_ZLIB
+	unsigned char raw[SQ_META_SIZE];
+#endif
+};
+
+/* Read metadata block at 'pos' into cache */
+static int sq_load(struct sq_fs *fs, unsigned long long pos)
+{
+	unsigned char hdr[2];
+	unsigned int size;
+#ifdef FSL_ZLIB
+	uLongf len;
+#endif
+
+	if (pos == fs->cached) return 0;
+
+	if (read_at(fs->fd, hdr, 2, pos)) return -1;
+	size = get_le16(hdr) & 0x7FFF;
+	if ((0 == size) || (size > SQ_META_SIZE) || (pos + 2 + size > fs->bytes_used))
+		return -1;
+
+	if (get_le16(hdr) & 0x8000) {
+		/* Stored uncompressed */
+		if (read_at(fs->fd, fs->data, size, pos + 2)) return -1;
+		fs->fill = size;
+	} else {
+#ifdef FSL_ZLIB
+		if (SQ_ZLIB != fs->compression) return -1;
+		if (read_at(fs->fd, fs->raw, size, pos + 2)) return -1;
+		len = SQ_META_SIZE;
+		if (Z_OK != uncompress(fs->data, &len, fs->raw, size)) return -1;
+		fs->fill = len;
+#else
+		return -1;
+#endif
+	}
+
+	fs->cached = pos;
+	fs->next = pos + 2 + size;
+	return 0;
+}
+
+/* Read 'len' bytes of metadata from block 'blk' of 'table' at 'off' */
+static int sq_read(struct sq_fs *fs, unsigned long long table,
+		unsigned long long *blk, unsigned int *off, void *buf, unsigned int len)
+{
+	unsigned char *p = buf;
+	unsigned int n;
+
+	while (len > 0) {
+		if (sq_load(fs, table + *blk)) return -1;
+		if (*off > fs->fill) return -1;
+
+		if (*off == fs->fill) {
+			*blk = fs->next - table;
+			*off = 0;
+			continue;
+		}
+
+		n = fs->fill - *off;
+		if (n > len) n = len;
+		memcpy(p, fs->data + *off, n);
+		p += n;
+		len -= n;
+		*off += n;
+	}
+
+	return 0;
+}
+
+static int sq_find(void *ctx, unsigned long long dir, const char *name,
+		unsigned long long *child, int *type)
+{
+	struct sq_fs *fs = ctx;
+	unsigned char in[40], hdr[12], ent[8];
+	char ename[256];
+	unsigned long long blk;
+	unsigned int off, size, count, start, nlen, len, t;
+
+	/* Directory inode */
+	blk = dir >> 16;
+	off = dir & 0xFFFF;
+	if (sq_read(fs, fs->inode_table, &blk, &off, in, 32)) return FSL_UNKNOWN;
+
+	switch (get_le16(in)) {
+	case 1:		/* Basic directory */
+		blk = get_le32(in + 16);
+		size = get_le16(in + 24);
+		off = get_le16(in + 26);
+		break;
+	case 8:		/* Extended directory */
+		if (sq_read(fs, fs->inode_table, &blk, &off, in + 32, 8))
+			return FSL_UNKNOWN;
+		size = get_le32(in + 20);
+		blk = get_le32(in + 24);
+		off = get_le16(in + 34);
+		break;
+	default:
+		return FSL_UNKNOWN;
+	}
+
+	/* Size includes 3 bytes of "." and ".." */
+	if (size <= 3) return FSL_MISSING;
+	size -= 3;
+	if (size > FSL_MAX_DIR) return FSL_UNKNOWN;
+
+	len = strlen(name);
+	while (size > 0) {
+		if ((size < 12) || sq_read(fs, fs->dir_table, &blk, &off, hdr, 12))
+			return FSL_UNKNOWN;
+		size -= 12;
+
+		count = get_le32(hdr) + 1;
+		start = get_le32(hdr + 4);
+		if (count > 256) return FSL_UNKNOWN;
+
+		while (count--) {
+			if ((size < 8) || sq_read(fs, fs->dir_table, &blk, &off, ent, 8))
+				return FSL_UNKNOWN;
+			nlen = get_le16(ent + 6) + 1;
+			if ((nlen > sizeof(ename)) || (size - 8 < nlen)
+					|| sq_read(fs, fs->dir_table, &blk, &off, ename, nlen))
+				return FSL_UNKNOWN;
+			size -= 8 + nlen;
+
+			if ((nlen == len) && !memcmp(ename, name, len)) {
+				*child = ((unsigned long long)start << 16) | get_le16(ent);
+				t = get_le16(ent + 4);
+				if ((1 == t) || (8 == t))
+					*type = FSL_T_DIR;
+				else if ((3 == t) || (10 == t))
+					*type = FSL_T_LINK;
+				else
+					*type = FSL_T_OTHER;
+				return FSL_FOUND;
+			}
+		}
+	}
+
+	return FSL_MISSING;
+}
+
+static int sq_lookup(int fd, const char *path)
+{
+	struct sq_fs *fs;
+	unsigned char sb[96];
+	int rc;
+
+	if (read_at(fd, sb, sizeof(sb), 0)) return FSL_UNKNOWN;
+	if ((get_le32(sb) != SQ_MAGIC) || (get_le16(sb + 28) != 4))
+		return FSL_UNKNOWN;
+
+	fs = malloc(sizeof(*fs));
+	if (NULL == fs) return FSL_UNKNOWN;
+
+	fs->fd = fd;
+	fs->compression = get_le16(sb + 20);
+	fs->bytes_used = get_le64(sb + 40);
+	fs->inode_table = get_le64(sb + 64);
+	fs->dir_table = get_le64(sb + 72);
+	fs->cached = (unsigned long long)-1;
+
+	rc = fsl_walk(fs, sq_find, get_le64(sb + 32), path);
+
+	free(fs);
+	return rc;
+}
+
+
+int fs_lookup(int fd, const char *fstype, const char *path)
+{
+	if (!strncmp(fstype, "ext", 3))
+		return ext_lookup(fd, path);
+
+	if (!strcmp(fstype, "vfat"))
+		return fat_lookup(fd, path);
+
+	if (!strcmp(fstype, "squashfs"))
+		return sq_lookup(fd, path);
+
+	return FSL_UNKNOWN;
+}
+
+#endif	/* USE_FS_LOOKUP */
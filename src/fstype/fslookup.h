@@ -0,0 +1,31 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Files lookup on unmounted filesystems
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef FSLOOKUP_H
+#define FSLOOKUP_H
+
+enum fs_lookup_rc {
+	FSL_UNKNOWN = -1,	/* Can't tell, filesystem should be mounted */
+	FSL_MISSING = 0,	/* There is no such file */
+	FSL_FOUND = 1		/* File exists */
+};
+
+/* Look for absolute 'path' on filesystem 'fstype' of device opened as 'fd'.
+ * Only ext2/3/4, vfat and squashfs are read, FSL_UNKNOWN is returned for
+ * other filesystems and for anything looking unusual */
+int fs_lookup(int fd, const char *fstype, const char *path);
+
+#endif
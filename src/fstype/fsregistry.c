@@ -0,0 +1,238 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Registry of filesystems supported by running kernel
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
+
+#include "fsregistry.h"
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+struct fs_entry {
+	char *name;					/* NULL - free slot */
+	enum fs_support support;
+};
+
+/* Open addressing hash table, size is power of 2 */
+struct fs_registry {
+	struct fs_entry *table;
+	unsigned int size;
+	unsigned int fill;
+	int modules_loaded;			/* modules.dep was read already */
+#ifdef USE_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+#ifdef USE_THREADS
+#define fsreg_lock(reg)		pthread_mutex_lock(&(reg)->lock)
+#define fsreg_unlock(reg)	pthread_mutex_unlock(&(reg)->lock)
+#else
+#define fsreg_lock(reg)		do { } while (0)
+#define fsreg_unlock(reg)	do { } while (0)
+#endif
+
+
+/* FNV-1a */
+static unsigned int fsreg_hash(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while (*name) {
+		h ^= (unsigned char)*name++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/* Return slot of 'name' or free slot where it should be placed */
+static struct fs_entry *fsreg_slot(struct fs_entry *table, unsigned int size,
+		const char *name)
+{
+	unsigned int i;
+
+	i = fsreg_hash(name) & (size - 1);
+	while (table[i].name && strcmp(table[i].name, name))
+		i = (i + 1) & (size - 1);
+
+	return &table[i];
+}
+
+
+static int fsreg_grow(struct fs_registry *reg)
+{
+	struct fs_entry *table, *e;
+	unsigned int size, i;
+
+	size = reg->size ? reg->size * 2 : 32;
+	table = calloc(size, sizeof(*table));
+	if (NULL == table) return -1;
+
+	for (i = 0; i < reg->size; i++) {
+		if (!reg->table[i].name) continue;
+		e = fsreg_slot(table, size, reg->table[i].name);
+		*e = reg->table[i];
+	}
+
+	free(reg->table);
+	reg->table = table;
+	reg->size = size;
+	return 0;
+}
+
+
+/* Add filesystem, better support wins */
+static void fsreg_add(struct fs_registry *reg, const char *name,
+		enum fs_support support)
+{
+	struct fs_entry *e;
+
+	if ('\0' == *name) return;
+
+	/* Keep table at most half full */
+	if ((reg->fill + 1) * 2 > reg->size && -1 == fsreg_grow(reg))
+		return;
+
+	e = fsreg_slot(reg->table, reg->size, name);
+	if (e->name) {
+		if (support > e->support) e->support = support;
+		return;
+	}
+
+	e->name = strdup(name);
+	if (NULL == e->name) return;
+	e->support = support;
+	++reg->fill;
+}
+
+
+/* Add modules listed in modules.dep of running kernel */
+static void fsreg_load_modules(struct fs_registry *reg)
+{
+	struct utsname uts;
+	FILE *f;
+	char buf[1024], *cp, *t;
+
+	reg->modules_loaded = 1;
+
+	if (uname(&uts))
+		return;
+	snprintf(buf, sizeof(buf), "/lib/modules/%s/modules.dep", uts.release);
+
+	f = fopen(buf, "r");
+	if (!f)
+		return;
+
+	/* kernel/fs/ext4/ext4.ko[.xz]: deps */
+	while (fgets(buf, sizeof(buf), f)) {
+		if ((cp = strchr(buf, ':')) != NULL)
+			*cp = 0;
+		else
+			continue;
+		if ((cp = strrchr(buf, '/')) != NULL)
+			cp++;
+		else
+			cp = buf;
+		if ((t = strstr(cp, ".ko")) != NULL)
+			*t = 0;
+		fsreg_add(reg, cp, FS_MODULE);
+	}
+	fclose(f);
+}
+
+
+struct fs_registry *fsreg_open(void)
+{
+	struct fs_registry *reg;
+	FILE *f;
+	char line[80], *name, *t;
+
+	f = fopen("/proc/filesystems", "r");
+	if (NULL == f)
+		return NULL;
+
+	reg = malloc(sizeof(*reg));
+	if (NULL == reg) {
+		fclose(f);
+		return NULL;
+	}
+	reg->table = NULL;
+	reg->size = 0;
+	reg->fill = 0;
+	reg->modules_loaded = 0;
+	if (-1 == fsreg_grow(reg)) {
+		free(reg);
+		fclose(f);
+		return NULL;
+	}
+#ifdef USE_THREADS
+	pthread_mutex_init(&reg->lock, NULL);
+#endif
+
+	/* "nodev\tproc\n" or "\text4\n" */
+	while (fgets(line, sizeof(line), f)) {
+		name = strchr(line, '\t');
+		if (NULL == name) continue;
+		++name;
+		if ((t = strchr(name, '\n')) != NULL)
+			*t = 0;
+		fsreg_add(reg, name, FS_NATIVE);
+	}
+	fclose(f);
+
+	return reg;
+}
+
+
+void fsreg_close(struct fs_registry *reg)
+{
+	unsigned int i;
+
+	if (!reg) return;
+
+	for (i = 0; i < reg->size; i++)
+		free(reg->table[i].name);
+	free(reg->table);
+#ifdef USE_THREADS
+	pthread_mutex_destroy(&reg->lock);
+#endif
+	free(reg);
+}
+
+
+enum fs_support fsreg_lookup(struct fs_registry *reg, const char *name)
+{
+	struct fs_entry *e;
+	enum fs_support support;
+
+	fsreg_lock(reg);
+	e = fsreg_slot(reg->table, reg->size, name);
+	if (!e->name && !reg->modules_loaded) {
+		fsreg_load_modules(reg);
+		e = fsreg_slot(reg->table, reg->size, name);
+	}
+	support = e->name ? e->support : FS_NONE;
+	fsreg_unlock(reg);
+
+	return support;
+}
@@ -0,0 +1,38 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Registry of filesystems supported by running kernel
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef FSREGISTRY_H
+#define FSREGISTRY_H
+
+enum fs_support {
+	FS_NONE = 0,	/* Filesystem is not supported */
+	FS_MODULE,		/* Filesystem is available as module */
+	FS_NATIVE		/* Filesystem is registered in kernel */
+};
+
+struct fs_registry;
+
+/* Build registry from /proc/filesystems. Return NULL on error */
+struct fs_registry *fsreg_open(void);
+
+/* Destroy registry */
+void fsreg_close(struct fs_registry *reg);
+
+/* Return support of filesystem 'name'. modules.dep is read once,
+ * on first lookup of filesystem not registered in kernel */
+enum fs_support fsreg_lookup(struct fs_registry *reg, const char *name);
+
+#endif
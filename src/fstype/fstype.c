@@ -12,13 +12,13 @@
 
 #include <sys/types.h>
 #include <stdio.h>
-#include <ctype.h>
+#include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <endian.h>
 #include <netinet/in.h>
-#include <sys/utsname.h>
 #include <sys/vfs.h>
 #include <linux/types.h>
 #define cpu_to_be32(x) __cpu_to_be32(x)	/* Needed by romfs_fs.h */
@@ -58,6 +58,7 @@
 #include "reiserfs_fs.h"
 #include "reiser4_fs.h"
 
+#include "fsregistry.h"
 #include "fstype.h"
 
 #define ARRAY_SIZE(x)	(sizeof(x) / sizeof(x[0]))
@@ -157,83 +158,7 @@ static int minix_image(const void *buf, unsigned long long *bytes)
 	return 0;
 }
 
-/*
- * Check to see if a filesystem is in /proc/filesystems.
- * Returns 1 if found, 0 if not
- */
-static int fs_proc_check(const char *fs_name)
-{
-	FILE	*f;
-	char	buf[80], *cp, *t;
-
-	f = fopen("/proc/filesystems", "r");
-	if (!f)
-		return (0);
-	while (fgets(buf, sizeof(buf), f)) {
-		cp = buf;
-		if (!isspace(*cp)) {
-			while (*cp && !isspace(*cp))
-				cp++;
-		}
-		while (*cp && isspace(*cp))
-			cp++;
-		if ((t = strchr(cp, '\n')) != NULL)
-			*t = 0;
-		if ((t = strchr(cp, '\t')) != NULL)
-			*t = 0;
-		if ((t = strchr(cp, ' ')) != NULL)
-			*t = 0;
-		if (!strcmp(fs_name, cp)) {
-			fclose(f);
-			return (1);
-		}
-	}
-	fclose(f);
-	return (0);
-}
-
-/*
- * Check to see if a filesystem is available as a module
- * Returns 1 if found, 0 if not
- */
-static int check_for_modules(const char *fs_name)
-{
-	struct utsname	uts;
-	FILE		*f;
-	char		buf[1024], *cp, *t;
-	int		i;
-
-	if (uname(&uts))
-		return (0);
-	snprintf(buf, sizeof(buf), "/lib/modules/%s/modules.dep", uts.release);
-
-	f = fopen(buf, "r");
-	if (!f)
-		return (0);
-	while (fgets(buf, sizeof(buf), f)) {
-		if ((cp = strchr(buf, ':')) != NULL)
-			*cp = 0;
-		else
-			continue;
-		if ((cp = strrchr(buf, '/')) != NULL)
-			cp++;
-		i = strlen(cp);
-		if (i > 3) {
-			t = cp + i - 3;
-			if (!strcmp(t, ".ko"))
-				*t = 0;
-		}
-		if (!strcmp(cp, fs_name)) {
-			fclose(f);
-			return (1);
-		}
-	}
-	fclose(f);
-	return (0);
-}
-
-static int base_ext4_image(const void *buf, unsigned long long *bytes,
-			   int *test_fs)
+static int ext4_image(const void *buf, unsigned long long *bytes)
 {
 	const struct ext3_super_block *sb =
 		(const struct ext3_super_block *)buf;
@@ -248,38 +173,43 @@ static int base_ext4_image(const void *buf, unsigned long long *bytes,
 	     & __cpu_to_le32(EXT3_FEATURE_RO_COMPAT_UNSUPPORTED))) {
 		*bytes = (unsigned long long)__le32_to_cpu(sb->s_blocks_count)
 			<< (10 + __le32_to_cpu(sb->s_log_block_size));
-		*test_fs = (sb->s_flags &
-			    __cpu_to_le32(EXT2_FLAGS_TEST_FILESYS)) != 0;
 		return 1;
 	}
 	return 0;
 }
 
-static int ext4_image(const void *buf, unsigned long long *bytes)
+static int fs_present(struct fs_registry *reg, const char *name)
 {
-	int ret, test_fs, ext4dev_present, ext4_present;
+	/* Assume plain ext4 kernel when nothing is known */
+	if (!reg)
+		return !strcmp(name, "ext4");
 
-	ret = base_ext4_image(buf, bytes, &test_fs);
-	if (ret == 0)
-		return 0;
-	ext4dev_present = (fs_proc_check("ext4dev") ||
-			   check_for_modules("ext4dev"));
-	ext4_present = (fs_proc_check("ext4") || check_for_modules("ext4"));
+	return (FS_NONE != fsreg_lookup(reg, name));
+}
+
+static int ext4_accept(const void *buf, struct fs_registry *reg)
+{
+	const struct ext3_super_block *sb =
+		(const struct ext3_super_block *)buf;
+	int test_fs, ext4dev_present, ext4_present;
+
+	test_fs = (sb->s_flags & __cpu_to_le32(EXT2_FLAGS_TEST_FILESYS)) != 0;
+	ext4dev_present = fs_present(reg, "ext4dev");
+	ext4_present = fs_present(reg, "ext4");
 	if ((test_fs || !ext4_present) && ext4dev_present)
 		return 0;
 	return 1;
 }
 
-static int ext4dev_image(const void *buf, unsigned long long *bytes)
+static int ext4dev_accept(const void *buf, struct fs_registry *reg)
 {
-	int ret, test_fs, ext4dev_present, ext4_present;
+	const struct ext3_super_block *sb =
+		(const struct ext3_super_block *)buf;
+	int test_fs, ext4dev_present, ext4_present;
 
-	ret = base_ext4_image(buf, bytes, &test_fs);
-	if (ret == 0)
-		return 0;
-	ext4dev_present = (fs_proc_check("ext4dev") ||
-			   check_for_modules("ext4dev"));
-	ext4_present = (fs_proc_check("ext4") || check_for_modules("ext4"));
+	test_fs = (sb->s_flags & __cpu_to_le32(EXT2_FLAGS_TEST_FILESYS)) != 0;
+	ext4dev_present = fs_present(reg, "ext4dev");
+	ext4_present = fs_present(reg, "ext4");
 	if ((!test_fs || !ext4dev_present) && ext4_present)
 		return 0;
 	return 1;
@@ -522,10 +452,163 @@ static int f2fs_image(const void *buf, unsigned long long *bytes)
 	return 0;
 }
 
+/*
+ * Superblock stamps. Stamp should change whenever filesystem content
+ * may change (write time, mount count, generation, checksum, ...).
+ * Filesystems without such fields have no stamp (0).
+ */
+static unsigned long long stamp_mix(unsigned long long h, unsigned long long v)
+{
+	/* FNV-1a like mixing */
+	return (h ^ v) * 0x100000001b3ULL;
+}
+
+static unsigned long long ext_stamp(const void *buf)
+{
+	const struct ext2_super_block *sb =
+	    (const struct ext2_super_block *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, __le32_to_cpu(sb->s_wtime));
+	h = stamp_mix(h, __le32_to_cpu(sb->s_mtime));
+	h = stamp_mix(h, __le16_to_cpu(sb->s_mnt_count));
+	h = stamp_mix(h, __le32_to_cpu(sb->s_free_blocks_count));
+	h = stamp_mix(h, __le32_to_cpu(sb->s_free_inodes_count));
+	return h;
+}
+
+static unsigned long long cramfs_stamp(const void *buf)
+{
+	const struct cramfs_super *sb = (const struct cramfs_super *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, sb->size);
+	h = stamp_mix(h, sb->fsid.crc);
+	h = stamp_mix(h, sb->fsid.edition);
+	return h;
+}
+
+static unsigned long long romfs_stamp(const void *buf)
+{
+	const struct romfs_super_block *sb =
+	    (const struct romfs_super_block *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, sb->size);
+	h = stamp_mix(h, sb->checksum);
+	return h;
+}
+
+static unsigned long long squashfs_stamp(const void *buf)
+{
+	const struct squashfs_super_block *sb =
+		(const struct squashfs_super_block *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, sb->mkfs_time);
+	h = stamp_mix(h, sb->bytes_used);
+	return h;
+}
+
+static unsigned long long nilfs2_stamp(const void *buf)
+{
+	const struct nilfs_super_block *sb =
+	    (const struct nilfs_super_block *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, __le64_to_cpu(sb->s_last_cno));
+	h = stamp_mix(h, __le64_to_cpu(sb->s_wtime));
+	return h;
+}
+
+static unsigned long long btrfs_stamp(const void *buf)
+{
+	const struct btrfs_super_block *sb =
+	    (const struct btrfs_super_block *)buf;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = stamp_mix(h, __le64_to_cpu(sb->generation));
+	h = stamp_mix(h, __le64_to_cpu(sb->bytes_used));
+	return h;
+}
+
+/*
+ * Magic signatures. Image is identified only when one of its signatures
+ * matches (or when it has no signatures at all), so identify functions
+ * are not called for every filesystem in table.
+ */
+struct fs_magic {
+	unsigned short offset;		/* Offset inside image block */
+	unsigned char len;
+	const char *magic;
+};
+
+#define FS_MAGIC(off, str)	{ (off), sizeof(str) - 1, (str) }
+#define FS_MAGIC_END		{ 0, 0, NULL }
+
+static const struct fs_magic gzip_magic[] = {
+	FS_MAGIC(0, "\037"), FS_MAGIC_END };
+static const struct fs_magic cramfs_magic[] = {
+	FS_MAGIC(0, "\x45\x3d\xcd\x28"), FS_MAGIC(0, "\x28\xcd\x3d\x45"),
+	FS_MAGIC_END };
+static const struct fs_magic romfs_magic[] = {
+	FS_MAGIC(0, "-rom1fs-"), FS_MAGIC_END };
+static const struct fs_magic xfs_magic[] = {
+	FS_MAGIC(0, "XFSB"), FS_MAGIC_END };
+static const struct fs_magic squashfs_magic[] = {
+	FS_MAGIC(0, "hsqs"), FS_MAGIC(0, "sqsh"),
+	FS_MAGIC(0, "shsq"), FS_MAGIC(0, "qshs"), FS_MAGIC_END };
+static const struct fs_magic ext_magic[] = {
+	FS_MAGIC(offsetof(struct ext3_super_block, s_magic), "\x53\xef"),
+	FS_MAGIC_END };
+static const struct fs_magic ubi_magic[] = {
+	FS_MAGIC(0, "UBI#"), FS_MAGIC_END };
+static const struct fs_magic jffs2_magic[] = {
+	FS_MAGIC(0, "\x85\x19"), FS_MAGIC_END };
+static const struct fs_magic vfat_magic[] = {
+	FS_MAGIC(54, "FAT1"), FS_MAGIC(82, "FAT32   "), FS_MAGIC_END };
+static const struct fs_magic nilfs2_magic[] = {
+	FS_MAGIC(offsetof(struct nilfs_super_block, s_magic), "\x34\x34"),
+	FS_MAGIC_END };
+static const struct fs_magic f2fs_magic[] = {
+	FS_MAGIC(offsetof(struct f2fs_super_block, magic), "\x10\x20\xf5\xf2"),
+	FS_MAGIC_END };
+static const struct fs_magic ocfs2_magic[] = {
+	FS_MAGIC(offsetof(struct ocfs2_dinode, i_signature),
+		OCFS2_SUPER_BLOCK_SIGNATURE), FS_MAGIC_END };
+static const struct fs_magic reiser4_magic[] = {
+	FS_MAGIC(offsetof(struct reiser4_master_sb, ms_magic),
+		REISER4_SUPER_MAGIC_STRING), FS_MAGIC_END };
+static const struct fs_magic gfs2_magic[] = {
+	FS_MAGIC(0, "\x01\x16\x19\x70"), FS_MAGIC_END };
+static const struct fs_magic btrfs_magic[] = {
+	FS_MAGIC(offsetof(struct btrfs_super_block, magic), BTRFS_MAGIC),
+	FS_MAGIC_END };
+static const struct fs_magic jfs_magic[] = {
+	FS_MAGIC(offsetof(struct jfs_superblock, s_magic), JFS_MAGIC),
+	FS_MAGIC_END };
+static const struct fs_magic iso_magic[] = {
+	FS_MAGIC(offsetof(struct iso_volume_descriptor, id), ISO_MAGIC),
+	FS_MAGIC(offsetof(struct iso_hs_volume_descriptor, id), ISO_HS_MAGIC),
+	FS_MAGIC_END };
+static const struct fs_magic luks_magic[] = {
+	FS_MAGIC(0, LUKS_MAGIC), FS_MAGIC_END };
+static const struct fs_magic swap_magic[] = {
+	FS_MAGIC(SWAP_RESERVED_L, SWAP_MAGIC_1),
+	FS_MAGIC(SWAP_RESERVED_L, SWAP_MAGIC_2), FS_MAGIC_END };
+static const struct fs_magic suspend_magic[] = {
+	FS_MAGIC(SWAP_RESERVED_L, SUSP_MAGIC_1),
+	FS_MAGIC(SWAP_RESERVED_L, SUSP_MAGIC_2),
+	FS_MAGIC(SWAP_RESERVED_L, SUSP_MAGIC_U), FS_MAGIC_END };
+
 struct imagetype {
 	off_t block;
 	const char name[12];
 	int (*identify) (const void *, unsigned long long *);
+	unsigned long long (*stamp) (const void *);
+	const struct fs_magic *magics;	/* NULL - always call identify */
+	/* Kernel specific check of identified image (may be NULL) */
+	int (*accept) (const void *, struct fs_registry *);
 };
 
 /*
@@ -541,44 +624,66 @@ struct imagetype {
  * The same goes for LUKS as for LVM.
  */
 static struct imagetype images[] = {
-	{0, "gzip", gzip_image},
-	{0, "cramfs", cramfs_image},
-	{0, "romfs", romfs_image},
-	{0, "xfs", xfs_image},
-	{0, "squashfs", squashfs_image},
-	{1, "ext4dev", ext4dev_image},
-	{1, "ext4", ext4_image},
-	{1, "ext3", ext3_image},
-	{1, "ext2", ext2_image},
-	{1, "minix", minix_image},
-	{0, "ubi", ubi_image},
-	{0, "jffs2", jffs2_image},
-	{0, "vfat", vfat_image},
-	{1, "nilfs2", nilfs2_image},
-	{1, "f2fs", f2fs_image},
-	{2, "ocfs2", ocfs2_image},
-	{8, "reiserfs", reiserfs_image},
-	{64, "reiserfs", reiserfs_image},
-	{64, "reiser4", reiser4_image},
-	{64, "gfs2", gfs2_image},
-	{64, "btrfs", btrfs_image},
-	{32, "jfs", jfs_image},
-	{32, "iso9660", iso_image},
-	{0, "luks", luks_image},
-	{0, "lvm2", lvm2_image},
-	{1, "lvm2", lvm2_image},
-	{-1, "swap", swap_image},
-	{-1, "suspend", suspend_image},
-	{0, "", NULL}
+	{0, "gzip", gzip_image, NULL, gzip_magic, NULL},
+	{0, "cramfs", cramfs_image, cramfs_stamp, cramfs_magic, NULL},
+	{0, "romfs", romfs_image, romfs_stamp, romfs_magic, NULL},
+	{0, "xfs", xfs_image, NULL, xfs_magic, NULL},
+	{0, "squashfs", squashfs_image, squashfs_stamp, squashfs_magic, NULL},
+	{1, "ext4dev", ext4_image, ext_stamp, ext_magic, ext4dev_accept},
+	{1, "ext4", ext4_image, ext_stamp, ext_magic, ext4_accept},
+	{1, "ext3", ext3_image, ext_stamp, ext_magic, NULL},
+	{1, "ext2", ext2_image, ext_stamp, ext_magic, NULL},
+	{1, "minix", minix_image, NULL, NULL, NULL},
+	{0, "ubi", ubi_image, NULL, ubi_magic, NULL},
+	{0, "jffs2", jffs2_image, NULL, jffs2_magic, NULL},
+	{0, "vfat", vfat_image, NULL, vfat_magic, NULL},
+	{1, "nilfs2", nilfs2_image, nilfs2_stamp, nilfs2_magic, NULL},
+	{1, "f2fs", f2fs_image, NULL, f2fs_magic, NULL},
+	{2, "ocfs2", ocfs2_image, NULL, ocfs2_magic, NULL},
+	{8, "reiserfs", reiserfs_image, NULL, NULL, NULL},
+	{64, "reiserfs", reiserfs_image, NULL, NULL, NULL},
+	{64, "reiser4", reiser4_image, NULL, reiser4_magic, NULL},
+	{64, "gfs2", gfs2_image, NULL, gfs2_magic, NULL},
+	{64, "btrfs", btrfs_image, btrfs_stamp, btrfs_magic, NULL},
+	{32, "jfs", jfs_image, NULL, jfs_magic, NULL},
+	{32, "iso9660", iso_image, NULL, iso_magic, NULL},
+	{0, "luks", luks_image, NULL, luks_magic, NULL},
+	{0, "lvm2", lvm2_image, NULL, NULL, NULL},
+	{1, "lvm2", lvm2_image, NULL, NULL, NULL},
+	{-1, "swap", swap_image, NULL, swap_magic, NULL},
+	{-1, "suspend", suspend_image, NULL, suspend_magic, NULL},
+	{0, "", NULL, NULL, NULL, NULL}
 };
 
+/*
+ * Probe window: all blocks from images[] (up to 64 + 1 for reiser4/gfs2/
+ * btrfs, swap block is below it for pages up to 64K) are read at once.
+ * Window is page aligned and page sized to be usable with O_DIRECT.
+ */
+#define PROBE_ALIGN		4096
+#define PROBE_WINDOW	((65 * BLOCK_SIZE + PROBE_ALIGN - 1) & ~(PROBE_ALIGN - 1))
+
+static int magic_match(const unsigned char *buf, const struct fs_magic *m)
+{
+	if (!m)
+		return 1;
+
+	for (; m->magic; m++) {
+		if (!memcmp(buf + m->offset, m->magic, m->len))
+			return 1;
+	}
+	return 0;
+}
+
 int identify_fs(int fd, const char **fstype,
-		unsigned long long *bytes, off_t offset)
+		unsigned long long *bytes, unsigned long long *stamp, off_t offset,
+		struct fs_registry *reg)
 {
-	uint64_t buf[BLOCK_SIZE >> 3];	/* 64-bit worst case alignment */
-	off_t cur_block = (off_t) - 1;
+	unsigned char *window, *buf;
+	ssize_t len;
+	off_t block;
 	struct imagetype *ip;
-	int ret;
+	int ret = 1;		/* Unknown filesystem */
 	unsigned long long dummy;
 
 	if (!bytes)
@@ -587,27 +692,36 @@ int identify_fs(int fd, const char **fstype,
 	*fstype = NULL;
 	*bytes = 0;
 
+	if (posix_memalign((void **)&window, PROBE_ALIGN, PROBE_WINDOW))
+		return -1;
+
+	/* Short read is fine: small devices have no blocks far away */
+	len = pread(fd, window, PROBE_WINDOW, offset);
+	if (len < BLOCK_SIZE) {
+		free(window);
+		return -1;	/* error */
+	}
+
 	for (ip = images; ip->identify; ip++) {
 		/* Hack for swap, which apparently is dependent on page size */
-		if (ip->block == -1)
-			ip->block = SWAP_OFFSET();
-
-		if (cur_block != ip->block) {
-			/*
-			 * Read block.
-			 */
-			cur_block = ip->block;
-			ret = pread(fd, buf, BLOCK_SIZE,
-				    offset + cur_block * BLOCK_SIZE);
-			if (ret != BLOCK_SIZE)
-				return -1;	/* error */
-		}
+		block = (ip->block == -1) ? SWAP_OFFSET() : ip->block;
+		if ((block + 1) * BLOCK_SIZE > len)
+			continue;
+
+		buf = window + block * BLOCK_SIZE;
+		if (!magic_match(buf, ip->magics))
+			continue;
 
-		if (ip->identify(buf, bytes)) {
+		if (ip->identify(buf, bytes)
+				&& (!ip->accept || ip->accept(buf, reg))) {
 			*fstype = ip->name;
-			return 0;
+			if (stamp)
+				*stamp = ip->stamp ? ip->stamp(buf) : 0;
+			ret = 0;
+			break;
 		}
 	}
 
-	return 1;		/* Unknown filesystem */
+	free(window);
+	return ret;
 }
@@ -14,7 +14,13 @@
 
 #include <unistd.h>
 
+struct fs_registry;
+
+/* 'stamp' (if not NULL) receives superblock fingerprint which changes
+ * with filesystem content or 0 when filesystem have no such data.
+ * 'reg' (may be NULL) tells which of ext4/ext4dev kernel supports */
 int identify_fs(int fd, const char **fstype,
-		unsigned long long *bytes, off_t offset);
+		unsigned long long *bytes, unsigned long long *stamp, off_t offset,
+		struct fs_registry *reg);
 
 #endif
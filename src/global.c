@@ -3,3 +3,6 @@
 
 FB fb;
 kx_text* lg;
+
+/* Init mode flag */
+int initmode = 0;
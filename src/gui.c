@@ -25,6 +25,7 @@
 
 #include "fb.h"
 #include "gui.h"
+#include "trace.h"
 
 #ifdef USE_ICONS
 #include "xpm.h"
@@ -79,7 +80,7 @@ void draw_background_low(struct gui_t *gui)
 struct gui_t *gui_init(int angle)
 {
 	struct gui_t *gui;
-	int ret;
+	int ret, ts;
 	gui = malloc(sizeof(*gui));
 	if (NULL == gui) {
 		DPRINTF("Can't allocate memory for GUI structure");
@@ -87,7 +88,9 @@ struct gui_t *gui_init(int angle)
 	}
 
 	/* init framebuffer */
+	ts = trace_begin("fb_new", NULL);
 	ret = fb_new(angle);
+	trace_end(ts);
 
 	if (-1 == ret) {
 		log_msg(lg, "Can't initialize framebuffer");
@@ -112,12 +115,15 @@ struct gui_t *gui_init(int angle)
 
 	gui->x = (fb.width - gui->width)/2;
 	gui->y = (fb.height - gui->height)/2;
+	gui->busy = 0;
+	gui->shown = NULL;
 
 #ifdef USE_ICONS
 	/* Parse compiled images.
 	 * We don't care about result because drawing code is aware
 	 */
 
+	ts = trace_begin("icons", NULL);
 	gui->icons = malloc(sizeof(*(gui->icons)) * ICON_ARRAY_SIZE);
 
 	gui->icons[ICON_LOGO] = xpm_parse_image(logo_xpm, ROWS(logo_xpm));
@@ -131,6 +137,7 @@ struct gui_t *gui_init(int angle)
 	gui->icons[ICON_REBOOT] = xpm_parse_image(reboot_xpm, ROWS(reboot_xpm));
 	gui->icons[ICON_SHUTDOWN] = xpm_parse_image(shutdown_xpm, ROWS(shutdown_xpm));
 	gui->icons[ICON_EXIT] = xpm_parse_image(exit_xpm, ROWS(exit_xpm));
+	trace_end(ts);
 #endif
 
 #ifdef USE_BG_BUFFER
@@ -164,6 +171,7 @@ void gui_destroy(struct gui_t *gui)
 
 /* Clear screen */
 void gui_clear(struct gui_t *gui) {
+	gui->shown = NULL;
 	fb_draw_rect(0, 0, fb.width, fb.height, CLR_BG);
 	fb_render();
 }
@@ -206,6 +214,13 @@ void draw_background(struct gui_t *gui, const char *text)
 }
 
 
+/* Top of slot in menu. Slots are numbered from 1 */
+static inline int gui_slot_top(struct gui_t *gui, int slot)
+{
+	return gui->y + LYT_MENU_AREA_TOP + LYT_MNI_HEIGHT * (slot - 1);
+}
+
+
 /* Draw one slot in menu */
 void draw_slot(struct gui_t *gui, kx_menu_item *item, int slot, int height,
 		int iscurrent)
@@ -230,7 +245,7 @@ void draw_slot(struct gui_t *gui, kx_menu_item *item, int slot, int height,
 	icon = (kx_picture *)item->data;
 #endif
 
-	slot_top = gui->y + LYT_MENU_AREA_TOP + LYT_MNI_HEIGHT * (slot-1); /* Slots are numbered from 1 */
+	slot_top = gui_slot_top(gui, slot);
 
 	/* Draw background */
 	if (iscurrent) {
@@ -293,6 +308,23 @@ void draw_slot(struct gui_t *gui, kx_menu_item *item, int slot, int height,
 }
 
 
+#ifdef USE_BG_BUFFER
+/* Draw slot of item 'no' again over saved background */
+static void redraw_slot(struct gui_t *gui, kx_menu_level *ml, int no,
+		int firstslot, int iscurrent)
+{
+	int top;
+
+	top = gui_slot_top(gui, no - firstslot + 1);
+	fb_restore_rect(gui->bg_buffer, 0, top, fb.width, LYT_MNI_HEIGHT);
+	if (no < ml->count)
+		draw_slot(gui, ml->list[no], no - firstslot + 1, LYT_MNI_HEIGHT,
+				iscurrent);
+	fb_damage(0, top, fb.width, LYT_MNI_HEIGHT);
+}
+#endif
+
+
 /* Display bootlist menu with selection */
 void gui_show_menu(struct gui_t *gui, kx_menu *menu)
 {
@@ -304,28 +336,63 @@ void gui_show_menu(struct gui_t *gui, kx_menu *menu)
 	kx_menu_level *ml;
 	// struct boot that is in fist slot
 	static int firstslot=0;
-	int cur_no;
+	int cur_no, prev_no, moved;
 
 	ml = menu->current;			/* active menu level */
 	cur_no = ml->current_no;	/* active menu item index */
-	
+
+	if(cur_no < firstslot)
+		firstslot = cur_no;
+	if(cur_no > firstslot + slots -1)
+		firstslot = cur_no - (slots -1);
+
+	/* Only selection is moved since last frame */
+	moved = ((ml == gui->shown) && (ml->serial == gui->shown_serial)
+			&& (firstslot == gui->shown_first)
+			&& (gui->busy == gui->shown_busy));
+	if (moved && (cur_no == gui->shown_current)) return;
+
+	prev_no = gui->shown_current;
+	gui->shown = ml;
+	gui->shown_serial = ml->serial;
+	gui->shown_first = firstslot;
+	gui->shown_current = cur_no;
+	gui->shown_busy = gui->busy;
+
+#ifdef USE_BG_BUFFER
+	if (moved && gui->bg_buffer) {
+		redraw_slot(gui, ml, prev_no, firstslot, 0);
+		redraw_slot(gui, ml, cur_no, firstslot, 1);
+		fb_render();
+		return;
+	}
+#endif
+
 	/* FIXME: shouldn't be done here */
-	if (1 == ml->count) {
+	if (ml->title) {
+		draw_background(gui, ml->title);
+	} else if ((1 == ml->count) && gui->busy) {
+		/* Only system menu in list but more items may come */
+		draw_background(gui, "Scanning devices.\nPlease wait...");
+	} else if (1 == ml->count) {
 		/* Only system menu in list */
 		draw_background(gui, "No boot devices found\nR: Reboot S: Rescan");
 	} else {
 		draw_background(gui, "KEXECBOOT");
 	}
 
-	if(cur_no < firstslot)
-		firstslot = cur_no;
-	if(cur_no > firstslot + slots -1)
-		firstslot = cur_no - (slots -1);
-
 	for(i=1, j=firstslot; i <= slots && j< ml->count; i++, j++) {
 		draw_slot(gui, ml->list[j], i, slotheight, j == cur_no);
 	}
 
+	/* Whole frame is drawn but only two slots differ on screen */
+	if (moved) {
+		fb_damage(0, gui_slot_top(gui, prev_no - firstslot + 1), fb.width,
+				slotheight);
+		fb_damage(0, gui_slot_top(gui, cur_no - firstslot + 1), fb.width,
+				slotheight);
+	}
+
 	fb_render();
 }
 
@@ -337,6 +404,7 @@ void gui_show_text(struct gui_t *gui, kx_text *text)
 	int i, y;
 	int max_x, max_y;
 
+	gui->shown = NULL;
 	draw_background(gui, "KEXECBOOT");
 
 	/* No text to show */
@@ -364,6 +432,7 @@ void gui_show_msg(struct gui_t *gui, const char *text)
 {
 	if (!gui) return;
 
+	gui->shown = NULL;
 	draw_background(gui, text);
 	fb_render();
 }
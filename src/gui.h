@@ -48,12 +48,18 @@ enum icon_id_t {
 struct gui_t {
 	int x,y;
 	int height, width;
+	int busy;	/* Boot devices are being scanned */
 #ifdef USE_BG_BUFFER
 	char *bg_buffer;
 #endif
 #ifdef USE_ICONS
 	kx_picture **icons;
 #endif
+	/* Last menu frame. Only slots of moved selection are redrawn
+	 * when nothing else is changed since then */
+	kx_menu_level *shown;	/* NULL - something else is on screen */
+	unsigned int shown_serial;
+	int shown_first, shown_current, shown_busy;
 };
 
 
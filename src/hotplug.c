@@ -0,0 +1,143 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Block devices hotplug support
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_HOTPLUG
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+
+#include "util.h"
+#include "hotplug.h"
+
+/* Kernel uevents multicast group */
+#define UEVENT_GROUP_KERNEL	1
+
+int hotplug_open(void)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			NETLINK_KOBJECT_UEVENT);
+	if (-1 == fd) {
+		log_msg(lg, "Can't open uevent socket: %s", ERRMSG);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = UEVENT_GROUP_KERNEL;
+
+	if (-1 == bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		log_msg(lg, "Can't bind uevent socket: %s", ERRMSG);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
+/* Parse message 'buf' of 'len' bytes: "add@/devpath\0KEY=value\0..."
+ * Return 1 when it is block device event */
+static int hotplug_parse(char *buf, int len, struct hotplug_event_t *ev)
+{
+	char *p, *end, *action, *subsystem, *name;
+
+	action = subsystem = name = NULL;
+	ev->major = ev->minor = -1;
+
+	end = buf + len;
+	for (p = buf; p < end; p += strlen(p) + 1) {
+		if (!strncmp(p, "ACTION=", 7))
+			action = p + 7;
+		else if (!strncmp(p, "SUBSYSTEM=", 10))
+			subsystem = p + 10;
+		else if (!strncmp(p, "DEVNAME=", 8))
+			name = p + 8;
+		else if (!strncmp(p, "MAJOR=", 6))
+			ev->major = atoi(p + 6);
+		else if (!strncmp(p, "MINOR=", 6))
+			ev->minor = atoi(p + 6);
+	}
+
+	if (!action || !subsystem || !name || strcmp(subsystem, "block")
+			|| (ev->major < 0) || (ev->minor < 0))
+		return 0;
+
+	if (!strcmp(action, "add"))
+		ev->action = HP_ADD;
+	else if (!strcmp(action, "remove"))
+		ev->action = HP_REMOVE;
+	else if (!strcmp(action, "change"))
+		ev->action = HP_CHANGE;
+	else
+		return 0;
+
+	/* Names may be "/dev/sdb1" or "sdb1" */
+	if (!strncmp(name, "/dev/", 5)) name += 5;
+	strncpy(ev->name, name, sizeof(ev->name) - 1);
+	ev->name[sizeof(ev->name) - 1] = '\0';
+
+	return 1;
+}
+
+
+int hotplug_read(int fd, struct hotplug_event_t *ev)
+{
+	char buf[2048];
+	struct sockaddr_nl addr;
+	struct iovec iov;
+	struct msghdr msg;
+	int len;
+
+	for (;;) {
+		iov.iov_base = buf;
+		iov.iov_len = sizeof(buf) - 1;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &addr;
+		msg.msg_namelen = sizeof(addr);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+
+		len = recvmsg(fd, &msg, 0);
+		if (-1 == len) {
+			if ((EAGAIN == errno) || (EWOULDBLOCK == errno)) return 0;
+			/* Events are lost but socket is still usable */
+			if (ENOBUFS == errno) {
+				log_msg(lg, "Some uevents are lost");
+				continue;
+			}
+			log_msg(lg, "Can't read uevent: %s", ERRMSG);
+			return -1;
+		}
+
+		/* Accept messages from kernel only */
+		if (0 != addr.nl_pid) continue;
+
+		buf[len] = '\0';
+		if (hotplug_parse(buf, len, ev)) return 1;
+	}
+}
+
+#endif	/* USE_HOTPLUG */
@@ -0,0 +1,46 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Block devices hotplug support
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_HOTPLUG_H_
+#define _HAVE_HOTPLUG_H_
+
+#include "config.h"
+
+#ifdef USE_HOTPLUG
+
+enum hotplug_action_t {
+	HP_ADD,
+	HP_REMOVE,
+	HP_CHANGE		/* Media is changed */
+};
+
+/* Block device event */
+struct hotplug_event_t {
+	enum hotplug_action_t action;
+	char name[32];		/* Device name (sdb1) */
+	int major, minor;	/* Device numbers */
+};
+
+/* Open non-blocking uevent socket. Return fd or -1 on error */
+int hotplug_open(void);
+
+/* Read next block device event from socket 'fd'.
+ * Return 1 when 'ev' is filled, 0 when no more events or -1 on error */
+int hotplug_read(int fd, struct hotplug_event_t *ev);
+
+#endif	/* USE_HOTPLUG */
+
+#endif	/* _HAVE_HOTPLUG_H_ */
@@ -30,14 +30,39 @@
 #include <sys/reboot.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <limits.h>
+#include <fcntl.h>
 
 #include "config.h"
 #include "util.h"
 #include "cfgparser.h"
 #include "devicescan.h"
+#include "fstype/fsregistry.h"
 #include "evdevs.h"
 #include "menu.h"
+#include "menufilter.h"
 #include "kexecboot.h"
+#include "bootmenu.h"
+#include "trace.h"
+#include "scancache.h"
+#include "boothistory.h"
+#include "mountfd.h"
+#include "hotplug.h"
+
+#ifdef USE_KEXEC_PRELOAD
+#include <signal.h>
+#include <sys/wait.h>
+#endif
+
+#ifdef USE_PROBE_TIMEOUT
+#include <time.h>
+#endif
+
+#ifdef USE_NATIVE_KEXEC
+#include <sys/syscall.h>
+#include <linux/reboot.h>
+#include <linux/kexec.h>
+#endif
 
 #ifdef USE_FBMENU
 #include "gui.h"
@@ -47,12 +72,16 @@
 #include "tui.h"
 #endif
 
-/* Don't re-create devices when executing on host */
-#ifdef USE_HOST_DEBUG
-#undef USE_DEVICES_RECREATING
+#define PREPEND_MOUNTPATH(string) MOUNTPOINT""string
+
+#ifdef USE_THREADS
+#include <pthread.h>
 #endif
 
-#define PREPEND_MOUNTPATH(string) MOUNTPOINT""string
+#ifdef USE_PARALLEL_SCAN
+/* Private mountpoints of scanning threads (number is appended) */
+#define SCAN_MOUNTPOINT	MOUNTPOINT "/.scan"
+#endif
 
 #define MAX_LOAD_ARGV_NR	(12 + 1)
 #define MAX_EXEC_ARGV_NR	(3 + 1)
@@ -72,29 +101,6 @@ char *default_kernels[] = {
 	NULL
 };
 
-/* Init mode flag */
-int initmode = 0;
-
-/* Contexts available - menu and textview */
-typedef enum {
-	KX_CTX_MENU,
-	KX_CTX_TEXTVIEW,
-} kx_context;
-
-/* Common parameters */
-struct params_t {
-	struct cfgdata_t *cfg;
-	struct bootconf_t *bootcfg;
-	kx_menu *menu;
-	kx_context context;
-#ifdef USE_FBMENU
-	struct gui_t *gui;
-#endif
-#ifdef USE_TEXTUI
-	kx_tui *tui;
-#endif
-};
-
 static char *kxb_ttydev = NULL;
 static int kxb_echo_state = 0;
 
@@ -167,27 +173,21 @@ static int check_for_ubi(struct boot_item_t *item,
 
 	if (!strncmp(item->fstype,"ubi",3)) {
 
-		/* mtd id [0-15] - one or two digits */
-		if(isdigit(atoi(item->device+strlen(item->device)-2))) {
-			strcpy(str_mtd_id, item->device+strlen(item->device)-2);
-			strcat(str_mtd_id, item->device+strlen(item->device)-1);
-		} else {
-			strcpy(str_mtd_id, item->device+strlen(item->device)-1);
+		if (-1 == mtd_id_of(item->device, str_mtd_id, MTD_ID_SIZE)) {
+			log_msg(lg, "Can't get MTD number of %s", item->device);
+			return 0;
 		}
 		/* get corresponding ubi dev to mount */
 		u = find_attached_ubi_device(str_mtd_id);
 
-		sprintf(mount_dev, "/dev/ubi%d", u);
-		/* FIXME: first volume is hardcoded */
-		strcat(mount_dev, "_0");
+		sprintf(mount_dev, "/dev/ubi%d_%d", u, item->ubivol);
 
 		/* HARDCODED: we assume it's ubifs */
 		strcpy(mount_fstype,"ubifs");
 
 		/* extra cmdline tags when we detect ubi */
 		strcat(cmdline_arg, str_ubirootdev);
-		/* FIXME: first volume is hardcoded */
-		strcat(cmdline_arg, "_0");
+		sprintf(cmdline_arg + strlen(cmdline_arg), "_%d", item->ubivol);
 
 		strcat(cmdline_arg, str_ubimtd);
 		strcat(cmdline_arg, str_mtd_id);
@@ -201,15 +201,160 @@ static int check_for_ubi(struct boot_item_t *item,
 }
 
 
-void start_kernel(struct params_t *params, int choice)
+#ifdef USE_NATIVE_KEXEC
+/* Open file 'path' of 'item' on boot device mounted at MOUNTPOINT.
+ * Absolute symlink is resolved relative to MOUNTPOINT */
+static int open_boot_file(struct boot_item_t *item, const char *path)
 {
-	int n, idx, u;
-	struct stat sinfo;
+	char buf[PATH_MAX], target[PATH_MAX];
+	int len;
+
+#ifdef USE_MOUNT_FDS
+	/* Device is still mounted since scan */
+	if (item->mntfd >= 0)
+		return mountfd_openat(item->mntfd, path, O_RDONLY);
+#endif
+
+	len = readlink(path, buf, sizeof(buf) - 1);
+	if ((len > 0) && ('/' == buf[0])) {
+		buf[len] = '\0';
+		if (snprintf(target, sizeof(target), "%s%s", MOUNTPOINT, buf)
+				>= (int)sizeof(target)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		path = target;
+	}
+
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Load kernel of 'item' with 'cmdline' by kexec_file_load() syscall.
+ * Return 0 on success or -1 when kexec binary should be used instead */
+static int kexec_native_load(struct boot_item_t *item, const char *cmdline)
+{
+#ifdef SYS_kexec_file_load
+	int kfd, ifd, rc;
+	unsigned long flags = 0;
+
+	/* kexec_file_load() have no way to pass dtb */
+	if (item->dtbpath) {
+		log_msg(lg, "DTB is specified, using %s", KEXEC_PATH);
+		return -1;
+	}
+
+	kfd = open_boot_file(item, item->kernelpath);
+	if (kfd < 0) {
+		log_msg(lg, "Can't open kernel %s: %s", item->kernelpath, ERRMSG);
+		return -1;
+	}
+
+	ifd = -1;
+	if (item->initrd) {
+		ifd = open_boot_file(item, item->initrd);
+		if (ifd < 0) {
+			log_msg(lg, "Can't open initrd %s: %s", item->initrd, ERRMSG);
+			close(kfd);
+			return -1;
+		}
+	} else {
+		flags |= KEXEC_FILE_NO_INITRAMFS;
+	}
+
+#ifdef USE_HOST_DEBUG
+	log_msg(lg, "kexec_file_load(%s, %s, '%s', %lu)", item->kernelpath,
+			item->initrd ? item->initrd : "-", cmdline, flags);
+	rc = 0;
+#else
+	rc = syscall(SYS_kexec_file_load, kfd, ifd,
+			(unsigned long)strlen(cmdline) + 1, cmdline, flags);
+	if (-1 == rc) {
+		/* ENOSYS/ENOEXEC: kernel can't do it, kexec binary may */
+		log_msg(lg, "kexec_file_load failed: %s, using %s",
+				ERRMSG, KEXEC_PATH);
+	}
+#endif
+
+	if (ifd >= 0) close(ifd);
+	close(kfd);
+	return rc;
+#else
+	return -1;
+#endif
+}
+
+/* Boot kernel loaded by kexec_native_load() */
+static void kexec_native_exec(void)
+{
+#ifdef USE_HOST_DEBUG
+	log_msg(lg, "reboot(LINUX_REBOOT_CMD_KEXEC)");
+#else
+	sync();
+	if (-1 == reboot(LINUX_REBOOT_CMD_KEXEC))
+		perror("Can't boot loaded kernel");
+#endif
+}
+#endif
+
+
+#if defined(USE_TIMEOUT) || defined(USE_KEXEC_PRELOAD)
+/* Return index of boot item to boot on timeout or -1 when none.
+ * This is last booted item, item marked as DEFAULT or first item
+ * of main menu */
+static int default_choice(struct params_t *params)
+{
+	kx_menu_level *ml;
+	struct bootconf_t *bl;
+	unsigned int i;
+
+#ifdef USE_BOOT_HISTORY
+	if (params->history_choice >= 0) return params->history_choice;
+#endif
+
+	bl = params->bootcfg;
+	if (!bl || !params->menu) return -1;
+
+	if (bl->default_item) {
+		for (i = 0; i < params->menu_filled; i++)
+			if (bl->list[i] == bl->default_item) return i;
+	}
+
+	ml = params->menu->top;
+	for (i = 0; i < ml->count; i++)
+		if (ml->list[i]->id >= A_DEVICES) return ml->list[i]->id - A_DEVICES;
+
+	return -1;
+}
+#endif
+
+
+/* Mount boot device of 'item' at MOUNTPOINT */
+static int mount_boot_device(struct boot_item_t *item,
+		const char *mount_dev, const char *mount_fstype)
+{
+#ifdef USE_MOUNT_FDS
+	/* Attach mount of scan instead of mounting device again */
+	if (item->mntfd >= 0) {
+		if (0 == mountfd_attach(item->mntfd, MOUNTPOINT))
+			return 0;
+		log_msg(lg, "Can't attach mount of %s: %s", item->device, ERRMSG);
+	}
+#endif
+	return mount(mount_dev, MOUNTPOINT, mount_fstype, MS_RDONLY, NULL);
+}
+
+
+/* Load kernel of boot item 'choice'.
+ * Return 0 when kernel is loaded by kexec binary, 1 when it is loaded
+ * by kexec_file_load() or -1 on error */
+static int load_kernel(struct params_t *params, int choice)
+{
+	int n, idx, u, ts, rc;
 	struct boot_item_t *item;
 
 	char mount_dev[16];
 	char mount_fstype[16];
-	char str_mtd_id[3];
+	char str_mtd_id[MTD_ID_SIZE];
 
 	/* empty environment */
 	char *const envp[] = { NULL };
@@ -220,6 +365,10 @@ void start_kernel(struct params_t *params, int choice)
 	/* for --command-line */
 	char *cmdline_arg = NULL;
 	const char str_cmdline_start[] = "--command-line=";
+#ifdef USE_NATIVE_KEXEC
+	const char *cmdline = "";
+	int native_tried = 0;
+#endif
 #ifdef UBI_VID_HDR_OFFSET
 	const char str_ubimtd_off[] = "," UBI_VID_HDR_OFFSET;
 #else
@@ -231,31 +380,22 @@ void start_kernel(struct params_t *params, int choice)
 	const char str_fbcon[] = " fbcon=";
 
 	/* initialize args */
-	char **load_argv, **exec_argv;
+	char **load_argv;
 
 	load_argv = calloc(MAX_LOAD_ARGV_NR, sizeof(*load_argv));
 	if (!load_argv)
-		return;
-
-	exec_argv = calloc(MAX_EXEC_ARGV_NR, sizeof(*exec_argv));
-	if (!exec_argv) {
-		free(load_argv);
-		return;
-	}
+		return -1;
 
 	/*len of following strings is known at compile time */
 	idx = 0;
 #ifdef USE_HOST_DEBUG
 	load_argv[idx] = strdup("/bin/echo");
-	exec_argv[idx] = strdup(load_argv[idx]);
 #else
 	load_argv[idx] = strdup(KEXEC_PATH);
-	exec_argv[idx] = strdup(load_argv[idx]);
 #endif
 	idx++;
 
 	load_argv[idx] = strdup("-d");
-	exec_argv[idx] = strdup("-e");
 	idx++;
 
 #ifdef MEM_MIN
@@ -356,6 +496,14 @@ void start_kernel(struct params_t *params, int choice)
 		}
 	}
 
+#ifdef USE_NATIVE_KEXEC
+	/* Bare cmdline for kexec_file_load() */
+	if (item->cmdline)
+		cmdline = item->cmdline;
+	else if (cmdline_arg)
+		cmdline = cmdline_arg + sizeof(str_cmdline_start) - 1;
+#endif
+
 	add_cmd_option(load_argv, "--dtb=", item->dtbpath, &idx);
 	add_cmd_option(load_argv, "--initrd=", item->initrd, &idx);
 	add_cmd_option(load_argv, NULL, item->kernelpath, &idx);
@@ -364,29 +512,95 @@ void start_kernel(struct params_t *params, int choice)
 		DPRINTF("load_argv[%d]: %s", u, load_argv[u]);
 	}
 
+	ts = trace_begin("kexec_load", item->kernelpath);
+
+#if defined(USE_NATIVE_KEXEC) && defined(USE_MOUNT_FDS)
+	/* Kernel files are opened on mount of scan, nothing to mount */
+	if (item->mntfd >= 0) {
+		native_tried = 1;
+		if (0 == kexec_native_load(item, cmdline)) {
+			rc = 1;
+			goto free;
+		}
+	}
+#endif
+
 	/* Mount boot device */
-	if ( -1 == mount(mount_dev, mount_point, mount_fstype,
-			MS_RDONLY, NULL) ) {
+	if (-1 == mount_boot_device(item, mount_dev, mount_fstype)) {
 		perror("Can't mount boot device");
-		exit(-1);
+		rc = -1;
+		goto free;
 	}
 
 	/* Load kernel */
-	n = fexecw(load_argv[0], (char *const *)load_argv, envp);
-	if (-1 == n) {
-		perror("Kexec can't load kernel");
-		exit(-1);
+#ifdef USE_NATIVE_KEXEC
+	if (!native_tried && (0 == kexec_native_load(item, cmdline))) {
+		rc = 1;
+	} else
+#endif
+	{
+		n = fexecw(load_argv[0], (char *const *)load_argv, envp);
+		if (0 != n) {
+			perror("Kexec can't load kernel");
+			rc = -1;
+		} else {
+			rc = 0;
+		}
 	}
 
 	umount(mount_point);
 
-	dispose(cmdline_arg);
+free:
+	trace_end(ts);
+
+	/* NOTE: cmdline_arg is freed as part of load_argv */
+	for (idx = 0; idx < MAX_LOAD_ARGV_NR; idx++)
+		free(load_argv[idx]);
+	dispose(load_argv);
+
+	return rc;
+}
+
+
+/* Boot kernel loaded by load_kernel() ('native' is its return value) */
+static void exec_kernel(int native)
+{
+	int idx;
+	struct stat sinfo;
+
+	/* empty environment */
+	char *const envp[] = { NULL };
+
+	char **exec_argv;
+
+#ifdef USE_NATIVE_KEXEC
+	if (native) {
+		/* No need to spawn kexec again */
+		kexec_native_exec();
+		return;
+	}
+#endif
+
+	exec_argv = calloc(MAX_EXEC_ARGV_NR, sizeof(*exec_argv));
+	if (!exec_argv)
+		return;
+
+	idx = 0;
+#ifdef USE_HOST_DEBUG
+	exec_argv[idx] = strdup("/bin/echo");
+#else
+	exec_argv[idx] = strdup(KEXEC_PATH);
+#endif
+	idx++;
+
+	exec_argv[idx] = strdup("-e");
+	idx++;
 
 	/* Check /proc/sys/net presence */
 	if ( -1 == stat("/proc/sys/net", &sinfo) ) {
 		if (ENOENT == errno) {
 			/* We have no network, don't issue ifdown() while kexec'ing */
-			exec_argv[2] = "-x";
+			exec_argv[idx] = strdup("-x");
 			DPRINTF("No network is detected, disabling ifdown()");
 		} else {
 			perror("Can't stat /proc/sys/net");
@@ -399,330 +613,1219 @@ void start_kernel(struct params_t *params, int choice)
 	/* Boot new kernel */
 	execve(exec_argv[0], (char *const *)exec_argv, envp);
 
-free:
-	dispose(cmdline_arg);
-	for (idx = 0; idx < MAX_LOAD_ARGV_NR; idx++)
-		free(load_argv[idx]);
-	dispose(load_argv);
 	for (idx = 0; idx < MAX_EXEC_ARGV_NR; idx++)
 		free(exec_argv[idx]);
 	dispose(exec_argv);
 }
 
 
-int scan_devices(struct params_t *params)
+#ifdef USE_KEXEC_PRELOAD
+/* Stop background loading of kernel if any */
+static void preload_cancel(struct params_t *params)
 {
-	struct charlist *fl;
-	struct bootconf_t *bootconf;
-	struct device_t dev;
-	struct cfgdata_t cfgdata;
-	int rc,n;
-	FILE *f;
+	if (params->preload.pid <= 0) return;
 
-	char mount_dev[16];
-	char mount_fstype[16];
-	char str_mtd_id[3];
+	/* Kill kexec spawned by preloading process too */
+	kill(-params->preload.pid, SIGKILL);
+	waitpid(params->preload.pid, NULL, 0);
+	params->preload.pid = 0;
+
+	/* Process may be killed while boot device is mounted */
+	umount(MOUNTPOINT);
+
+	log_msg(lg, "Kernel preloading is cancelled");
+}
+
+
+/* Start loading of kernel which will be booted on timeout
+ * while user looks at menu */
+static void preload_start(struct params_t *params)
+{
+	int choice, rc;
+	pid_t pid;
+
+#ifdef USE_ASYNC_SCAN
+	/* Scanning thread mounts devices under MOUNTPOINT */
+	if (params->scan.running) return;
+#endif
+
+	choice = default_choice(params);
+	if (choice < 0) return;
+
+	/* Preloading is started or done already */
+	if ((params->preload.pid > 0) && (params->preload.choice == choice))
+		return;
+	preload_cancel(params);
+
+	pid = fork();
+	if (pid < 0) {
+		log_msg(lg, "Can't fork to preload kernel: %s", ERRMSG);
+		return;
+	}
+
+	if (0 == pid) {
+		/* Separate process group to kill kexec with us */
+		setpgid(0, 0);
+		rc = load_kernel(params, choice);
+		_exit((rc < 0) ? 255 : rc);
+	}
+
+	/* Avoid race with kill() in preload_cancel() */
+	setpgid(pid, pid);
+
+	log_msg(lg, "Preloading kernel of item %d", choice);
+	params->preload.pid = pid;
+	params->preload.choice = choice;
+}
+
+
+/* Wait for preloading of kernel of item 'choice'.
+ * Return load_kernel() result or -1 when other kernel was preloaded */
+static int preload_wait(struct params_t *params, int choice)
+{
+	int status;
+
+	if (params->preload.pid <= 0) return -1;
+
+	if (params->preload.choice != choice) {
+		preload_cancel(params);
+		return -1;
+	}
+
+	if (-1 == waitpid(params->preload.pid, &status, 0)) {
+		params->preload.pid = 0;
+		return -1;
+	}
+	params->preload.pid = 0;
+
+	if (!WIFEXITED(status) || (255 == WEXITSTATUS(status)))
+		return -1;
+
+	return WEXITSTATUS(status);
+}
+#endif
+
+
+void start_kernel(struct params_t *params, int choice)
+{
+	int rc;
+
+#ifdef USE_KEXEC_PRELOAD
+	rc = preload_wait(params, choice);
+	if (rc < 0)
+#endif
+	rc = load_kernel(params, choice);
+
+#if defined(USE_TRACE) && defined(USE_HOST_DEBUG)
+	trace_dump(TRACE_FILE);
+#endif
+
+	if (rc < 0) exit(-1);
+
+#ifdef USE_BOOT_HISTORY
+	/* Remember item before kexec as we won't come back */
+	if (!boot_history_match(params->history, params->bootcfg->list[choice])) {
+		if (0 == boot_history_save(USE_BOOT_HISTORY,
+				params->bootcfg->list[choice]))
+			sync();
+		else
+			DPRINTF("Can't save boot history");
+	}
+#endif
+
+	exec_kernel(rc);
+}
+
+
+/* Mount 'mount_dev', search boot info at 'mountpoint' and umount it.
+ * With USE_MOUNT_FDS device 'dev' (when given) is kept mounted at
+ * dev->mntfd instead. Return 0 when cfgdata is filled, 1 when there is
+ * nothing to boot or -1 on error */
+static int scan_mount(struct params_t *params, struct device_t *dev,
+		const char *mount_dev, const char *mount_fstype,
+		const char *mountpoint, struct cfgdata_t *cfgdata)
+{
+	int rc, n, ts;
+#ifdef USE_MOUNT_FDS
+	char mntpath[MOUNTFD_PATH_SIZE];
+#endif
 
 #ifdef USE_ICONS
 	kx_cfg_section *sc;
 	int i;
 	int rows;
 	char **xpm_data;
-
+	char path[PATH_MAX];
 #endif
 
-	bootconf = create_bootcfg(4);
-	if (NULL == bootconf) {
-		DPRINTF("Can't allocate bootconf structure");
+	/* Mount device */
+	ts = trace_begin("mount", mount_dev);
+#ifdef USE_MOUNT_FDS
+	/* Detached mount is kept for loading of kernel */
+	if (dev) dev->mntfd = mountfd_open(mount_dev, mount_fstype);
+	if (dev && (dev->mntfd >= 0)) {
+		mountpoint = mountfd_path(mntpath, dev->mntfd);
+		n = 0;
+	} else
+#endif
+	n = mount(mount_dev, mountpoint, mount_fstype, MS_RDONLY, NULL);
+	trace_end(ts);
+	if (-1 == n) {
+		log_msg(lg, "+ can't mount device %s: %s", mount_dev, ERRMSG);
 		return -1;
 	}
 
-	f = devscan_open(&fl);
-	if (NULL == f) {
-		log_msg(lg, "Can't initiate device scan");
+	/* NOTE: Don't go out before umount'ing */
+
+	/* Search boot method and return boot info */
+	ts = trace_begin("parse_cfgfile", mount_dev);
+	rc = get_bootinfo(cfgdata, mountpoint);
+	trace_end(ts);
+
+#ifdef USE_ICONS
+	/* Iterate over sections found */
+	if ((0 == rc) && params->gui) {
+		ts = trace_begin("icons", mount_dev);
+		for (i = 0; i < cfgdata->count; i++) {
+			sc = cfgdata->list[i];
+			if (!sc) continue;
+
+			/* Load custom icon */
+			if (sc->iconpath) {
+				cfg_path_at(path, sizeof(path), mountpoint, sc->iconpath);
+				rows = xpm_load_image(&xpm_data, path);
+				if (-1 == rows) {
+					log_msg(lg, "+ can't load xpm icon %s", sc->iconpath);
+					continue;
+				}
+
+				sc->icondata = xpm_parse_image(xpm_data, rows);
+				if (!sc->icondata) {
+					log_msg(lg, "+ can't parse xpm icon %s", sc->iconpath);
+					continue;
+				}
+				xpm_destroy_image(xpm_data, rows);
+			}
+		}
+		trace_end(ts);
+	}
+#endif
+
+#ifdef USE_MOUNT_FDS
+	if (dev && (dev->mntfd >= 0)) {
+		/* Keep mount only when there is something to boot */
+		if (-1 == rc) {
+			close(dev->mntfd);
+			dev->mntfd = -1;
+		}
+		n = 0;
+	} else
+#endif
+	{
+		/* Umount device */
+		ts = trace_begin("umount", mount_dev);
+		n = umount(mountpoint);
+		trace_end(ts);
+	}
+	if (-1 == n) {
+		log_msg(lg, "+ can't umount device: %s", ERRMSG);
+		destroy_cfgdata(cfgdata);
 		return -1;
 	}
 
+	if (-1 == rc) {	/* Nothing to boot */
+		destroy_cfgdata(cfgdata);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* Search boot info on every volume of UBI device 'ubi_num' and put
+ * sections found into 'cfgdata' marked with their volumes.
+ * Return 0 when cfgdata is filled, 1 when there is nothing to boot
+ * or -1 on error */
+static int scan_ubi(struct params_t *params, int ubi_num,
+		const char *mountpoint, struct cfgdata_t *cfgdata)
+{
+	int vols[UBI_MAX_VOLUMES];
+	struct cfgdata_t vcfg;
+	char mount_dev[24];
+	int count, rc, i;
+	unsigned int j;
+
+	count = ubi_volumes(ubi_num, vols, UBI_MAX_VOLUMES);
+	if (count < 0) return -1;
+
+	init_cfgdata(cfgdata);
+	if (NULL == cfgdata->list) return -1;
+
+	for (i = 0; i < count; i++) {
+		sprintf(mount_dev, "/dev/ubi%d_%d", ubi_num, vols[i]);
+
+		/* HARDCODED: we assume it's ubifs */
+		rc = scan_mount(params, NULL, mount_dev, "ubifs", mountpoint, &vcfg);
+		if (0 != rc) continue;
+
+		for (j = 0; j < vcfg.count; j++)
+			if (vcfg.list[j]) vcfg.list[j]->ubivol = vols[i];
+
+		if (-1 == cfgdata_move(cfgdata, &vcfg)) {
+			destroy_cfgdata(cfgdata);
+			return -1;
+		}
+	}
+
+	if (0 == cfgdata->count) {
+		destroy_cfgdata(cfgdata);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+#ifdef USE_PARALLEL_SCAN
+struct scan_worker;
+
+/* Device probed by scanning threads */
+struct scan_slot {
+	struct device_t dev;
+	struct cfgdata_t cfgdata;
+	int rc;
+	int done;
+#ifdef USE_PROBE_TIMEOUT
+	struct scan_worker *worker;	/* Thread which took slot */
+	struct timespec deadline;	/* Time to give up at (CLOCK_MONOTONIC) */
+	int abandoned;			/* Slot is given up and left to its thread */
+#endif
+};
+
+/* Work shared by scanning threads. It is freed by last user
+ * as threads which are given up may outlive scanning */
+struct scan_pool {
+	struct params_t *params;
+	struct fs_registry *fsreg;
+	struct scan_slot *slots;
+	unsigned int count;
+	unsigned int next;		/* First slot not taken by any thread */
+	unsigned int refs;		/* Merging loop and threads using pool */
+#ifdef USE_PROBE_TIMEOUT
+	int timeout;			/* Seconds to probe one device (0 - forever) */
+#endif
+	pthread_mutex_t lock;
+	pthread_cond_t done;	/* Signalled when any slot is done */
+};
+
+/* Scanning thread. Each thread have own mountpoint */
+struct scan_worker {
+	pthread_t thread;
+	struct scan_pool *pool;
+#ifdef USE_PROBE_TIMEOUT
+	int abandoned;			/* Thread is detached and cleans up itself */
+#endif
+	char mountpoint[sizeof(SCAN_MOUNTPOINT) + 10];
+};
+
+/* Number of next mountpoint. Numbers are not reused by later scans
+ * as threads which are given up may still keep their mountpoints */
+static unsigned int scan_worker_next;
+
+#ifdef USE_PROBE_TIMEOUT
+/* Scanning thread running in current thread, NULL in other threads */
+static __thread struct scan_worker *scan_self;
+#endif
+#endif
+
+
+#ifdef USE_SCAN_CACHE
+/* Scanning thread which is given up don't use scan cache. Cache may be
+ * closed already or saved by later scan when device is probed at last.
+ * Return as scan_cache_lookup() */
+static int scan_cache_get(struct params_t *params, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+#ifdef USE_PROBE_TIMEOUT
+	struct scan_worker *w = scan_self;
+
+	if (w) {
+		int rc = -1;
+
+		pthread_mutex_lock(&w->pool->lock);
+		if (!w->abandoned)
+			rc = scan_cache_lookup(params->cache, dev, cfgdata);
+		pthread_mutex_unlock(&w->pool->lock);
+		return rc;
+	}
+#endif
+	return scan_cache_lookup(params->cache, dev, cfgdata);
+}
+
+/* Store boot info of device unless thread is given up */
+static void scan_cache_put(struct params_t *params, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+#ifdef USE_PROBE_TIMEOUT
+	struct scan_worker *w = scan_self;
+
+	if (w) {
+		pthread_mutex_lock(&w->pool->lock);
+		if (!w->abandoned)
+			scan_cache_store(params->cache, dev, cfgdata);
+		pthread_mutex_unlock(&w->pool->lock);
+		return;
+	}
+#endif
+	scan_cache_store(params->cache, dev, cfgdata);
+}
+#endif
+
+
+/* Search boot info on device 'dev' mounting it at 'mountpoint'.
+ * With USE_MOUNT_FDS device is kept mounted at dev->mntfd instead.
+ * Return 0 when cfgdata is filled, 1 when device have nothing to boot
+ * or -1 on error */
+static int scan_device(struct params_t *params, struct device_t *dev,
+		const char *mountpoint, struct cfgdata_t *cfgdata)
+{
+	int rc, n;
+	char str_mtd_id[MTD_ID_SIZE];
+#ifdef USE_FS_LOOKUP
+	int ts;
+#endif
+
+#ifdef USE_SCAN_CACHE
+	/* Skip mounting of unchanged device */
+	rc = scan_cache_get(params, dev, cfgdata);
+	if (-1 != rc) {
+		log_msg(lg, "+ boot info is taken from cache");
+		return rc;
+	}
+#endif
+
+#ifdef USE_FS_LOOKUP
+	/* Don't mount device which surely have nothing to boot */
+	ts = trace_begin("lookup", dev->device);
+	rc = lookup_bootinfo(dev);
+	trace_end(ts);
+	if (0 == rc) {
+		log_msg(lg, "+ no config file nor any kernels found");
+#ifdef USE_SCAN_CACHE
+		scan_cache_put(params, dev, NULL);
+#endif
+		return 1;
+	}
+#endif
+
+	/* We found an ubi erase counter */
+	if (!strncmp(dev->fstype, "ubi",3)) {
+
+		/* attach ubi boot device */
+		if (-1 == mtd_id_of(dev->device, str_mtd_id, sizeof(str_mtd_id))) {
+			log_msg(lg, "+ can't get MTD number of %s", dev->device);
+			return -1;
+		}
+
+		n = ubi_attach(str_mtd_id);
+		if (-1 == n) return -1;
+
+		/* Every volume is searched for boot info */
+		rc = scan_ubi(params, n, mountpoint, cfgdata);
+	} else {
+		rc = scan_mount(params, dev, dev->device, dev->fstype,
+				mountpoint, cfgdata);
+	}
+
+	if (-1 == rc) return -1;
+
+#ifdef USE_SCAN_CACHE
+	scan_cache_put(params, dev, (0 == rc) ? cfgdata : NULL);
+#endif
+	return rc;
+}
+
+
+/* Check that scanning should be stopped */
+static inline int scan_stopped(struct params_t *params)
+{
+#ifdef USE_ASYNC_SCAN
+	return params->scan.stop;
+#else
+	return 0;
+#endif
+}
+
+/* Check that device is scanned already and is not changed since then.
+ * Such device is marked as seen by current scan and is not probed again */
+static int scan_known(struct params_t *params, struct device_t *dev)
+{
+	struct bootdev_t *bd;
+
+	bd = bootcfg_find_device(params->bootcfg,
+			dev->major, dev->minor, dev->blocks);
+	if (!bd) return 0;
+
+	bd->seen = 1;
+#ifdef USE_SCAN_CACHE
+	scan_cache_keep(params->cache, dev);
+#endif
+	log_msg(lg, "+ device is not changed, skipped");
+	return 1;
+}
+
+/* Put boot items found on device into bootcfg
+ * ('cfgdata' is NULL when device have nothing to boot) */
+static void scan_add_items(struct params_t *params, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+#ifdef USE_ASYNC_SCAN
+	unsigned char action = A_SCAN_ITEMS;
+
+	pthread_mutex_lock(&params->scan.lock);
+	addto_bootcfg(params->bootcfg, dev, cfgdata);
+	pthread_mutex_unlock(&params->scan.lock);
+
+	/* Wake up main loop to show new items */
+	if (cfgdata && (-1 == write(params->scan.notify_fd, &action, 1)))
+		log_msg(lg, "Can't notify main loop: %s", ERRMSG);
+#else
+	addto_bootcfg(params->bootcfg, dev, cfgdata);
+#endif
+}
+
+
+#ifdef USE_PARALLEL_SCAN
+/* Drop reference to pool. Last user frees it */
+static void scan_pool_put(struct scan_pool *pool)
+{
+	unsigned int refs;
+
+	pthread_mutex_lock(&pool->lock);
+	refs = --pool->refs;
+	pthread_mutex_unlock(&pool->lock);
+	if (refs > 0) return;
+
+	pthread_cond_destroy(&pool->done);
+	pthread_mutex_destroy(&pool->lock);
+	fsreg_close(pool->fsreg);
+	free(pool->slots);
+	free(pool);
+}
+
+/* Free device and boot info of slot */
+static void scan_slot_free(struct scan_slot *slot)
+{
+	if (slot->done && (0 == slot->rc))
+		destroy_cfgdata(&slot->cfgdata);
+	free(slot->dev.device);
+#ifdef USE_MOUNT_FDS
+	/* Boot items have own copies of mount fd */
+	if (slot->dev.mntfd >= 0) close(slot->dev.mntfd);
+#endif
+}
+
+static void *scan_worker_run(void *arg)
+{
+	struct scan_worker *w = arg;
+	struct scan_pool *pool = w->pool;
+	struct scan_slot *slot;
+	int ts;
+
+#ifdef USE_PROBE_TIMEOUT
+	/* Thread which is given up don't touch log and scan cache */
+	scan_self = w;
+	log_drop_on(&w->abandoned);
+#endif
+
 	for (;;) {
-		rc = devscan_next(f, fl, &dev);
+		pthread_mutex_lock(&pool->lock);
+		if ((pool->next < pool->count) && !scan_stopped(pool->params))
+			slot = &pool->slots[pool->next++];
+		else
+			slot = NULL;
+
+		if (!slot) {
+			/* Wake up merging loop waiting for slots we won't take */
+			pthread_cond_broadcast(&pool->done);
+			pthread_mutex_unlock(&pool->lock);
+			break;
+		}
+#ifdef USE_PROBE_TIMEOUT
+		slot->worker = w;
+		clock_gettime(CLOCK_MONOTONIC, &slot->deadline);
+		slot->deadline.tv_sec += pool->timeout;
+		/* Merging loop may wait for this slot already */
+		pthread_cond_broadcast(&pool->done);
+#endif
+		pthread_mutex_unlock(&pool->lock);
+
+		ts = trace_begin("devscan_probe", slot->dev.device);
+		slot->rc = devscan_probe(pool->fsreg, &slot->dev);
+		trace_end(ts);
+		if (0 == slot->rc)
+			slot->rc = scan_device(pool->params, &slot->dev,
+					w->mountpoint, &slot->cfgdata);
+		else
+			slot->rc = 1;	/* Unknown filesystem, nothing to boot */
+
+		pthread_mutex_lock(&pool->lock);
+		slot->done = 1;
+#ifdef USE_PROBE_TIMEOUT
+		if (slot->abandoned) {
+			/* Nobody waits for us, other thread took our place */
+			pthread_mutex_unlock(&pool->lock);
+			scan_slot_free(slot);
+			break;
+		}
+#endif
+		pthread_cond_broadcast(&pool->done);
+		pthread_mutex_unlock(&pool->lock);
+	}
+
+#ifdef USE_PROBE_TIMEOUT
+	scan_self = NULL;
+	log_drop_on(NULL);
+	if (w->abandoned) {
+		rmdir(w->mountpoint);
+		free(w);
+	}
+#endif
+	scan_pool_put(pool);
+	return NULL;
+}
+
+/* Start scanning thread with next free mountpoint. Return NULL on error */
+static struct scan_worker *scan_worker_start(struct scan_pool *pool)
+{
+	struct scan_worker *w;
+
+	w = malloc(sizeof(*w));
+	if (NULL == w) {
+		DPRINTF("Can't allocate scanning thread");
+		return NULL;
+	}
+	w->pool = pool;
+#ifdef USE_PROBE_TIMEOUT
+	w->abandoned = 0;
+#endif
+
+	snprintf(w->mountpoint, sizeof(w->mountpoint), SCAN_MOUNTPOINT "%u",
+			__sync_fetch_and_add(&scan_worker_next, 1));
+
+	pthread_mutex_lock(&pool->lock);
+	++pool->refs;
+	pthread_mutex_unlock(&pool->lock);
+
+	if ((-1 == mkdir(w->mountpoint, 0755)) && (EEXIST != errno)) {
+		log_msg(lg, "Can't create %s: %s", w->mountpoint, ERRMSG);
+		goto fail;
+	}
+	if (0 != pthread_create(&w->thread, NULL, scan_worker_run, w)) {
+		log_msg(lg, "Can't start scanning thread");
+		rmdir(w->mountpoint);
+		goto fail;
+	}
+
+	return w;
+
+fail:
+	free(w);
+	scan_pool_put(pool);
+	return NULL;
+}
+
+#ifdef USE_PROBE_TIMEOUT
+/* Wait for slot until its deadline. Give it up with its thread when
+ * deadline is missed and start other thread in place of that one.
+ * Called with pool locked, return with pool locked */
+static void scan_slot_wait(struct scan_pool *pool, struct scan_slot *slot,
+		struct scan_worker **workers, unsigned int started)
+{
+	struct scan_worker *w;
+	unsigned int i;
+	int rc;
+
+	rc = pthread_cond_timedwait(&pool->done, &pool->lock, &slot->deadline);
+	if ((ETIMEDOUT != rc) || slot->done) return;
+
+	w = slot->worker;
+	slot->abandoned = 1;
+	log_drop(&w->abandoned);
+	pthread_detach(w->thread);
+	log_msg(lg, "Device %s is not probed in %d sec, skipped",
+			slot->dev.device, pool->timeout);
+
+	/* Don't start thread when there is nothing to do */
+	if (pool->next >= pool->count) w = NULL;
+	pthread_mutex_unlock(&pool->lock);
+
+	for (i = 0; i < started; i++) {
+		if (workers[i] != slot->worker) continue;
+		workers[i] = w ? scan_worker_start(pool) : NULL;
+		break;
+	}
+
+	pthread_mutex_lock(&pool->lock);
+}
+#endif
+
+/* Create pool with room for 'size' slots. Registry 'fsreg' is owned
+ * by pool then. Return NULL on error */
+static struct scan_pool *scan_pool_new(struct params_t *params,
+		struct fs_registry *fsreg, unsigned int size)
+{
+	struct scan_pool *pool;
+
+	pool = malloc(sizeof(*pool));
+	if (NULL == pool) {
+		DPRINTF("Can't allocate scan pool");
+		return NULL;
+	}
+
+	pool->slots = malloc(size * sizeof(*pool->slots));
+	if (NULL == pool->slots) {
+		DPRINTF("Can't allocate scan slots");
+		free(pool);
+		return NULL;
+	}
+	pool->params = params;
+	pool->fsreg = fsreg;
+	pool->count = 0;
+	pool->next = 0;
+	pool->refs = 1;
+#ifdef USE_PROBE_TIMEOUT
+	pool->timeout = params->cfg->probe_timeout;
+#endif
+
+	pthread_mutex_init(&pool->lock, NULL);
+#ifdef USE_PROBE_TIMEOUT
+	{
+		pthread_condattr_t attr;
+
+		/* Deadlines are not affected by setting of clock */
+		pthread_condattr_init(&attr);
+		pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+		pthread_cond_init(&pool->done, &attr);
+		pthread_condattr_destroy(&attr);
+	}
+#else
+	pthread_cond_init(&pool->done, NULL);
+#endif
+
+	return pool;
+}
+
+/* Put device 'dev' into next slot of pool. Slots should be allocated */
+static void scan_pool_add(struct scan_pool *pool, struct device_t *dev)
+{
+	struct scan_slot *slot = &pool->slots[pool->count++];
+
+	slot->dev = *dev;
+	slot->rc = -1;
+	slot->done = 0;
+#ifdef USE_PROBE_TIMEOUT
+	slot->worker = NULL;
+	slot->abandoned = 0;
+#endif
+}
+
+/* Probe devices of list with USE_PARALLEL_SCAN threads. Registry 'fsreg'
+ * is owned by pool then. Return -1 when threads can't be used and devices
+ * should be probed one by one */
+static int scan_devices_parallel(struct params_t *params, struct devscan *ds,
+		struct fs_registry *fsreg)
+{
+	struct scan_pool *pool;
+	struct scan_worker *workers[USE_PARALLEL_SCAN];
+	struct scan_worker self;
+	struct scan_slot *slot;
+	struct device_t dev;
+	unsigned int size, i, started;
+	int rc;
+
+	size = 8;
+	pool = scan_pool_new(params, fsreg, size);
+	if (NULL == pool) return -1;
+
+	/* Collect devices list. It is cheap so do it in this thread */
+	for (;;) {
+		/* Resize slots when needed before adding device */
+		if (pool->count >= size) {
+			struct scan_slot *new_slots;
+
+			size <<= 1;	/* size *= 2; */
+			new_slots = realloc(pool->slots, size * sizeof(*pool->slots));
+			if (NULL == new_slots) {
+				DPRINTF("Can't resize scan slots");
+				break;
+			}
+			pool->slots = new_slots;
+		}
+
+		rc = devscan_read(ds, &dev);
 		if (rc < 0) continue;	/* Error */
 		if (0 == rc) break;		/* EOF */
 
-		/* initialize with defaults */
-		strcpy(mount_dev, dev.device);
-		strcpy(mount_fstype, dev.fstype);
+		if (scan_known(params, &dev)) {
+			free(dev.device);
+			continue;
+		}
 
-		/* We found an ubi erase counter */
-		if (!strncmp(dev.fstype, "ubi",3)) {
+		scan_pool_add(pool, &dev);
+	}
 
-			/* attach ubi boot device - mtd id [0-15] */
-			if(isdigit(atoi(dev.device+strlen(dev.device)-2))) {
-				strcpy(str_mtd_id, dev.device+strlen(dev.device)-2);
-				strcat(str_mtd_id, dev.device+strlen(dev.device)-1);
-			} else {
-				strcpy(str_mtd_id, dev.device+strlen(dev.device)-1);
-			}
-			n = ubi_attach(str_mtd_id);
+	/* Start threads, one per device at most */
+	started = 0;
+	for (i = 0; (i < USE_PARALLEL_SCAN) && (i < pool->count); i++) {
+		workers[i] = scan_worker_start(pool);
+		if (NULL == workers[i]) break;
+		++started;
+	}
 
-			/* we have attached ubiX and we mount /dev/ubiX_0  */
-			sprintf(mount_dev, "/dev/ubi%d", n);
-			 /* HARDCODED: first volume */
-			strcat(mount_dev, "_0");
+	/* Scan in this thread when no other threads are available */
+	if ((0 == started) && (pool->count > 0)) {
+		self.pool = pool;
+#ifdef USE_PROBE_TIMEOUT
+		self.abandoned = 0;
+#endif
+		strcpy(self.mountpoint, MOUNTPOINT);
+		++pool->refs;
+		scan_worker_run(&self);
+	}
 
-			/* HARDCODED: we assume it's ubifs */
-			strcpy(mount_fstype, "ubifs");
+	/* Merge results in /proc/partitions order to keep menu order.
+	 * Every slot is merged as soon as it and all slots before are done */
+	for (i = 0; i < pool->count; i++) {
+		slot = &pool->slots[i];
+
+		pthread_mutex_lock(&pool->lock);
+		while (!slot->done && ((i < pool->next) || !scan_stopped(params))) {
+#ifdef USE_PROBE_TIMEOUT
+			if ((pool->timeout > 0) && slot->worker) {
+				scan_slot_wait(pool, slot, workers, started);
+				if (slot->abandoned) break;
+				continue;
+			}
+#endif
+			pthread_cond_wait(&pool->done, &pool->lock);
 		}
+		pthread_mutex_unlock(&pool->lock);
 
-		/* Mount device */
-		if (-1 == mount(mount_dev, MOUNTPOINT, mount_fstype, MS_RDONLY, NULL)) {
-			log_msg(lg, "+ can't mount device %s: %s", mount_dev, ERRMSG);
-			goto free_device;
+#ifdef USE_PROBE_TIMEOUT
+		/* Slot belongs to its thread now */
+		if (slot->abandoned) continue;
+#endif
+
+		/* Slot is done or will never be taken when scan is stopped */
+		if (slot->done && (0 == slot->rc)) {
+			scan_add_items(params, &slot->dev, &slot->cfgdata);
+		} else if (slot->done && (1 == slot->rc)) {
+			scan_add_items(params, &slot->dev, NULL);
 		}
+		scan_slot_free(slot);
+	}
+
+	for (i = 0; i < started; i++) {
+		if (!workers[i]) continue;
+		pthread_join(workers[i]->thread, NULL);
+		rmdir(workers[i]->mountpoint);
+		free(workers[i]);
+	}
 
-		/* NOTE: Don't go out before umount'ing */
+	scan_pool_put(pool);
+	return 0;
+}
 
-		/* Search boot method and return boot info */
-		rc = get_bootinfo(&cfgdata);
+#ifdef USE_PROBE_TIMEOUT
+/* Probe single device 'dev' by scanning thread until deadline. Registry
+ * 'fsreg' is owned by pool then. Return as scan_device(), 1 for unknown
+ * filesystem or -1 when device is given up. Such device is left to its
+ * thread and 'dev' is cleared. Return -2 when threads can't be used */
+static int scan_device_timed(struct params_t *params, struct fs_registry *fsreg,
+		struct device_t *dev, struct cfgdata_t *cfgdata)
+{
+	struct scan_pool *pool;
+	struct scan_worker *w;
+	struct scan_worker self;
+	struct scan_slot *slot;
+	int rc;
+
+	pool = scan_pool_new(params, fsreg, 1);
+	if (NULL == pool) return -2;
+
+	scan_pool_add(pool, dev);
+	slot = &pool->slots[0];
+
+	w = scan_worker_start(pool);
+	if (NULL == w) {
+		/* Probe in this thread without deadline */
+		self.pool = pool;
+		self.abandoned = 0;
+		strcpy(self.mountpoint, MOUNTPOINT);
+		++pool->refs;
+		scan_worker_run(&self);
+	}
 
-		if (-1 == rc) {	/* Error */
-			goto umount;
+	pthread_mutex_lock(&pool->lock);
+	while (!slot->done && ((pool->next > 0) || !scan_stopped(params))) {
+		if (slot->worker) {
+			scan_slot_wait(pool, slot, &w, 1);
+			if (slot->abandoned) break;
+			continue;
 		}
+		pthread_cond_wait(&pool->done, &pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
 
-#ifdef USE_ICONS
-		/* Iterate over sections found */
-		if (params->gui) {
-			for (i = 0; i < cfgdata.count; i++) {
-				sc = cfgdata.list[i];
-				if (!sc) continue;
-
-				/* Load custom icon */
-				if (sc->iconpath) {
-					rows = xpm_load_image(&xpm_data, sc->iconpath);
-					if (-1 == rows) {
-						log_msg(lg, "+ can't load xpm icon %s", sc->iconpath);
-						continue;
-					}
-
-					sc->icondata = xpm_parse_image(xpm_data, rows);
-					if (!sc->icondata) {
-						log_msg(lg, "+ can't parse xpm icon %s", sc->iconpath);
-						continue;
-					}
-					xpm_destroy_image(xpm_data, rows);
-				}
-			}
+	if (slot->abandoned) {
+		dev->device = NULL;
+#ifdef USE_MOUNT_FDS
+		dev->mntfd = -1;
+#endif
+		rc = -1;
+	} else {
+		/* Device and boot info are ours again */
+		*dev = slot->dev;
+		if (slot->done) *cfgdata = slot->cfgdata;
+		rc = slot->done ? slot->rc : -1;
+	}
+
+	if (w) {
+		pthread_join(w->thread, NULL);
+		rmdir(w->mountpoint);
+		free(w);
+	}
+
+	scan_pool_put(pool);
+	return rc;
+}
+#endif
+#endif
+
+
+#if defined(USE_BOOT_HISTORY) || defined(USE_HOTPLUG)
+/* Probe device 'dev' out of devices scanning. Return as scan_device(),
+ * 1 for unknown filesystem or -1 on error. With USE_PROBE_TIMEOUT device
+ * is given up on timeout and 'dev' is cleared then */
+static int scan_single(struct params_t *params, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+	struct fs_registry *fsreg;
+	int rc;
+
+	fsreg = fsreg_open();
+	if (NULL == fsreg) {
+		log_msg(lg, "Can't open /proc/filesystems: %s", ERRMSG);
+		return -1;
+	}
+
+#ifdef USE_PROBE_TIMEOUT
+	if (params->cfg->probe_timeout > 0) {
+		rc = scan_device_timed(params, fsreg, dev, cfgdata);
+		if (-2 != rc) return rc;
+	}
+#endif
+
+	if (0 == devscan_probe(fsreg, dev))
+		rc = scan_device(params, dev, MOUNTPOINT, cfgdata);
+	else
+		rc = 1;	/* Unknown filesystem, nothing to boot */
+
+	fsreg_close(fsreg);
+	return rc;
+}
+#endif
+
+
+int scan_devices(struct params_t *params)
+{
+	struct fs_registry *fsreg;
+	struct bootconf_t *bootconf;
+	struct device_t dev;
+	struct cfgdata_t cfgdata;
+	int rc, ts, scan_ts;
+	unsigned int i;
+	struct devscan *ds;
+
+	bootconf = params->bootcfg;
+	if (bootconf) {
+		/* Rescan: devices not seen by this scan will be swept */
+		for (i = 0; i < bootconf->devs_fill; i++)
+			bootconf->devs[i].seen = 0;
+	} else {
+		bootconf = create_bootcfg(4);
+		if (NULL == bootconf) {
+			DPRINTF("Can't allocate bootconf structure");
+			return -1;
 		}
+
+#ifdef USE_ASYNC_SCAN
+		pthread_mutex_lock(&params->scan.lock);
+		params->bootcfg = bootconf;
+		pthread_mutex_unlock(&params->scan.lock);
+#else
+		params->bootcfg = bootconf;
+#endif
+	}
+
+	scan_ts = trace_begin("scan_devices", NULL);
+#ifdef USE_SCAN_CACHE
+	scan_cache_begin(params->cache);
+#endif
+
+	ds = devscan_open(&fsreg);
+	if (NULL == ds) {
+		log_msg(lg, "Can't initiate device scan");
+		trace_end(scan_ts);
+		return -1;
+	}
+
+#ifdef USE_PARALLEL_SCAN
+	if (0 == scan_devices_parallel(params, ds, fsreg)) {
+		devscan_close(ds);
+#ifdef USE_SCAN_CACHE
+		if (!scan_stopped(params)) scan_cache_save(params->cache);
+#endif
+		trace_end(scan_ts);
+		return 0;
+	}
 #endif
 
-umount:
-		/* Umount device */
-		if (-1 == umount(MOUNTPOINT)) {
-			log_msg(lg, "+ can't umount device: %s", ERRMSG);
-			goto free_cfgdata;
-		}
+	while (!scan_stopped(params)) {
+		ts = trace_begin("devscan_read", NULL);
+		rc = devscan_read(ds, &dev);
+		trace_end(ts);
+		if (rc < 0) continue;	/* Error */
+		if (0 == rc) break;		/* EOF */
 
-		if (-1 == rc) {	/* Error */
-			goto free_cfgdata;
+		if (scan_known(params, &dev)) {
+			free(dev.device);
+			continue;
 		}
 
-		/* Now we have something in cfgdata */
-		rc = addto_bootcfg(bootconf, &dev, &cfgdata);
+		ts = trace_begin("devscan_probe", dev.device);
+		rc = devscan_probe(fsreg, &dev);
+		trace_end(ts);
+		if (0 == rc)
+			rc = scan_device(params, &dev, MOUNTPOINT, &cfgdata);
+		else
+			rc = 1;	/* Unknown filesystem, nothing to boot */
+
+		if (0 == rc) {
+			/* Now we have something in cfgdata */
+			scan_add_items(params, &dev, &cfgdata);
+			destroy_cfgdata(&cfgdata);
+		} else if (1 == rc) {
+			scan_add_items(params, &dev, NULL);
+		}
 
-free_cfgdata:
-		destroy_cfgdata(&cfgdata);
-free_device:
 		free(dev.device);
+#ifdef USE_MOUNT_FDS
+		/* Boot items have own copies of mount fd */
+		if (dev.mntfd >= 0) close(dev.mntfd);
+#endif
 	}
 
-	free_charlist(fl);
-	params->bootcfg = bootconf;
+	devscan_close(ds);
+	fsreg_close(fsreg);
+#ifdef USE_SCAN_CACHE
+	/* Entries of devices not reached yet shouldn't be dropped */
+	if (!scan_stopped(params)) scan_cache_save(params->cache);
+#endif
+	trace_end(scan_ts);
 	return 0;
 }
 
 
-/* Create system menu */
-kx_menu *build_menu(struct params_t *params)
+#ifdef USE_ASYNC_SCAN
+static void *scan_thread_run(void *arg)
 {
-	kx_menu *menu;
-	kx_menu_level *ml;
-	kx_menu_item *mi;
-	
-#ifdef USE_ICONS
-	kx_picture **icons;
-	
-	if (params->gui) icons = params->gui->icons;
-	else icons = NULL;
-#endif
-	
-	/* Create menu with 2 levels (main and system) */
-	menu = menu_create(2);
-	if (!menu) {
-		DPRINTF("Can't create menu");
-		return NULL;
-	}
-	
-	/* Create main menu level */
-	menu->top = menu_level_create(menu, 4, NULL);
-	
-	/* Create system menu level */
-	ml = menu_level_create(menu, 6, menu->top);
-	if (!ml) {
-		DPRINTF("Can't create system menu");
-		return menu;
+	struct params_t *params = arg;
+	unsigned char action = A_SCAN_DONE;
+
+	scan_devices(params);
+
+	/* Tell main loop that we are done */
+	if (-1 == write(params->scan.notify_fd, &action, 1))
+		log_msg(lg, "Can't notify main loop: %s", ERRMSG);
+
+	return NULL;
+}
+
+/* Prepare background scanning and add its notifications to inputs */
+int scan_init(struct params_t *params, kx_inputs *inputs)
+{
+	int fds[2];
+
+	params->scan.running = 0;
+	params->scan.stop = 0;
+
+	if (-1 == pipe(fds)) {
+		log_msg(lg, "Can't create notification pipe: %s", ERRMSG);
+		return -1;
 	}
 
-	mi = menu_item_add(menu->top, A_SUBMENU, "System menu", NULL, ml);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_SYSTEM]);
-#endif
+	/* Main loop reads everything available without blocking */
+	fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
 
-	mi = menu_item_add(ml, A_PARENTMENU, "Back", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_BACK]);
-#endif
+	params->scan.notify_fd = fds[1];
+	inputs_add_fd(inputs, fds[0], KX_IT_PIPE);
 
-	mi = menu_item_add(ml, A_RESCAN, "Rescan", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_RESCAN]);
-#endif
+	pthread_mutex_init(&params->scan.lock, NULL);
+	return 0;
+}
 
-	mi = menu_item_add(ml, A_DEBUG, "Show debug info", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_DEBUG]);
-#endif
+/* Start scanning devices in background */
+int scan_start(struct params_t *params)
+{
+	if (params->scan.running) return 0;
 
-	mi = menu_item_add(ml, A_REBOOT, "Reboot", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_REBOOT]);
-#endif
+	params->scan.stop = 0;
+	if (0 != pthread_create(&params->scan.thread, NULL,
+			scan_thread_run, params)) {
+		log_msg(lg, "Can't start scanning thread");
+		return -1;
+	}
 
-	mi = menu_item_add(ml, A_SHUTDOWN, "Shutdown", NULL, NULL);
-#ifdef USE_ICONS
-	if (icons) menu_item_set_data(mi, icons[ICON_SHUTDOWN]);
+	params->scan.running = 1;
+#ifdef USE_FBMENU
+	if (params->gui) params->gui->busy = 1;
 #endif
+	return 0;
+}
 
-	if (!initmode) {
-		mi = menu_item_add(ml, A_EXIT, "Exit", NULL, NULL);
-#ifdef USE_ICONS
-		if (icons) menu_item_set_data(mi, icons[ICON_EXIT]);
-#endif
-	}
+/* Wait for background scanning. Ask it to stop early if 'stop' is set */
+void scan_wait(struct params_t *params, int stop)
+{
+	if (!params->scan.running) return;
 
-	menu->current = menu->top;
-	menu_item_select(menu, 0);
-	return menu;
+	if (stop) params->scan.stop = 1;
+	pthread_join(params->scan.thread, NULL);
+	params->scan.running = 0;
 }
+#endif
 
 
-/* Fill main menu with boot items */
-int fill_menu(struct params_t *params)
+#ifdef USE_BOOT_HISTORY
+/* Scan device of last booted item before other devices and
+ * make that item default one when it is still there */
+static void history_scan(struct params_t *params)
 {
-	kx_menu_item *mi;
-	int i, b_items, max_pri, max_i, *a;
-	struct boot_item_t *tbi;
+	struct boot_history *bh = params->history;
 	struct bootconf_t *bl;
-	const int sizeof_desc = 160;
-	char *desc, *label;
-#ifdef USE_ICONS
-	kx_picture *icon;
-	struct gui_t *gui;
+	struct device_t dev;
+	struct cfgdata_t cfgdata;
+	int i, rc;
 
-	gui = params->gui;
-#endif
+	if (-1 == devscan_get(bh->name, bh->major, bh->minor, &dev)) return;
 
-	bl = params->bootcfg;
+	if (dev.blocks != bh->blocks) {
+		log_msg(lg, "Device %s of last booted item is changed", dev.device);
+		free(dev.device);
+		return;
+	}
 
-	if ( (NULL != bl) && (bl->fill > 0) ) b_items = bl->fill;
-	else {
-		log_msg(lg, "No items for menu found");
-		return 0;
+	bl = create_bootcfg(4);
+	if (NULL == bl) {
+		DPRINTF("Can't allocate bootconf structure");
+		free(dev.device);
+		return;
 	}
+	params->bootcfg = bl;
 
-	log_msg(lg, "Populating menu: %d item(s)", b_items);
+	rc = scan_single(params, &dev, &cfgdata);
 
-	desc = malloc(sizeof_desc);
-	if (NULL == desc) {
-		DPRINTF("Can't allocate item description");
-		goto dirty_exit;
+	/* Scanning thread is not started yet so bootcfg is ours */
+	if (0 == rc) {
+		addto_bootcfg(bl, &dev, &cfgdata);
+		destroy_cfgdata(&cfgdata);
+	} else if (1 == rc) {
+		addto_bootcfg(bl, &dev, NULL);
 	}
 
-	a = malloc(b_items * sizeof(*a));	/* Markers array */
-	if (NULL == a) {
-		DPRINTF("Can't allocate markers array");
-		goto dirty_exit;
+	free(dev.device);
+#ifdef USE_MOUNT_FDS
+	if (dev.mntfd >= 0) close(dev.mntfd);
+#endif
+
+	for (i = 0; i < bl->fill; i++) {
+		if (boot_history_match(bh, bl->list[i])) {
+			params->history_choice = i;
+			break;
+		}
 	}
 
-	for (i = 0; i < b_items; i++) a[i] = 0;	/* Clean markers array */
+	if (params->history_choice < 0) {
+		log_msg(lg, "Last booted item is not found");
+		return;
+	}
 
-	/* Create menu of sorted by priority boot items */
-	max_i = -1;
-	for(;;) {
-		max_pri = -1;
-		/* Search item with maximum priority */
-		for (i = 0; i < b_items; i++) {
-			if (0 == a[i]) {	/* Check that item is not processed yet */
-				tbi = bl->list[i];
-				if (tbi->priority > max_pri) {
-					max_pri = tbi->priority;	/* Max priority */
-					max_i = i;					/* Max priority item index */
-				}
-			}
-		}
+	log_msg(lg, "Last booted item is %d", params->history_choice);
+	/* Kernel is preloaded when scanning is done to not hide
+	 * mountpoints of scanning workers */
+	fill_menu(params);
+}
+#endif
 
-		if (max_pri >= 0) {
-			a[max_i] = 1;	/* Mark item as processed */
-			/* We have found new max priority - insert into menu */
-			tbi = bl->list[max_i];
-			snprintf(desc, sizeof_desc, "%s %s %lluMb",
-					tbi->device, tbi->fstype, tbi->blocks/1024);
 
-			if (tbi->label)
-				label = tbi->label;
-			else
-				label = tbi->kernelpath + sizeof(MOUNTPOINT) - 1;
+/* Remove boot item 'i' from menu and bootcfg */
+static void remove_boot_item(struct params_t *params, int i)
+{
+	struct bootconf_t *bl;
+	struct boot_item_t *bi;
 
-			log_msg(lg, "+ [%s]", label);
-			mi = menu_item_add(params->menu->top, A_DEVICES + max_i,
-					label, desc, NULL);
+	bl = params->bootcfg;
+	bi = bl->list[i];
 
+	log_msg(lg, "Removing boot item %d of %s", i, bi->device);
+#ifdef USE_TYPE_FILTER
+	menu_filter_remove(params->filter, A_DEVICES + i);
+#endif
+	menu_item_remove(params->menu->top, A_DEVICES + i);
+#ifdef USE_KEXEC_PRELOAD
+	if ((params->preload.pid > 0) && (params->preload.choice == i))
+		preload_cancel(params);
+#endif
+	if (bl->default_item == bi) bl->default_item = NULL;
+#ifdef USE_BOOT_HISTORY
+	if (params->history_choice == i) params->history_choice = -1;
+#endif
 #ifdef USE_ICONS
-			if (gui) {
-				/* Search associated with boot item icon if any */
-				icon = tbi->icondata;
-				if (!icon && (gui->icons)) {
-					/* We have no custom icon - use default */
-					switch (tbi->dtype) {
-					case DVT_STORAGE:
-						icon = gui->icons[ICON_STORAGE];
-						break;
-					case DVT_MMC:
-						icon = gui->icons[ICON_MMC];
-						break;
-					case DVT_MTD:
-						icon = gui->icons[ICON_MEMORY];
-						break;
-					case DVT_UNKNOWN:
-					default:
-						break;
-					}
-				}
-
-				/* Add icon to menu */
-				if (mi) mi->data = icon;
-			}
+	fb_destroy_picture(bi->icondata);
 #endif
-		}
+	/* Keep indexes of other items as they are menu ids */
+	free_bootitem(bi);
+	bl->list[i] = NULL;
+}
+
+
+/* Remove boot items of devices which are gone or changed
+ * since previous scan */
+static void scan_sweep(struct params_t *params)
+{
+	struct bootconf_t *bl;
+	struct bootdev_t *bd;
+	struct boot_item_t *bi;
+	int i;
 
-		if (-1 == max_pri) break;	/* We have no items to process */
+	bl = params->bootcfg;
+	if (!bl) return;
+
+	for (i = 0; i < bl->fill; i++) {
+		bi = bl->list[i];
+		if (!bi) continue;
+
+		bd = bootcfg_find_device(bl, bi->major, bi->minor, bi->blocks);
+		if (!bd || !bd->seen) remove_boot_item(params, i);
 	}
 
-	free(a);
-	free(desc);
-	return 0;
+	bootcfg_sweep_devices(bl);
 
-dirty_exit:
-	dispose(desc);
-	return -1;
+	/* Should not grow when devices are not changed */
+	DPRINTF("Boot items memory: %lu bytes", (unsigned long)arena_held());
 }
 
 
@@ -772,37 +1875,27 @@ int do_init(void)
 }
 
 
+/* Scan devices again. Unchanged devices are not probed and their
+ * boot items are kept in menu */
 int do_rescan(struct params_t *params)
 {
-	int i;
-
-	/* Clean top menu level except system menu item */
-	/* FIXME should be done by some function from menu module */
-	kx_menu_item *mi;
-	for (i = 1; i < params->menu->top->count; i++) {
-		mi = params->menu->top->list[i];
-		if (mi) {
-			dispose(mi->label);
-			dispose(mi->description);
-			free(mi);
-		}
-		params->menu->top->list[i] = NULL;
-	}
-	params->menu->top->count = 1;
-
-#ifdef USE_ICONS
-	/* Destroy icons */
-	/* FIXME should be done by some function from devicescan module */
-	for (i = 0; i < params->bootcfg->fill; i++) {
-		fb_destroy_picture(params->bootcfg->list[i]->icondata);
-	}
+#ifdef USE_KEXEC_PRELOAD
+	/* Preloading process may hold boot device mounted at MOUNTPOINT */
+	preload_cancel(params);
 #endif
-
-	free_bootcfg(params->bootcfg);
-	params->bootcfg = NULL;
+#ifdef USE_ASYNC_SCAN
+	/* Menu will be updated when scanning thread will find something */
+	return scan_start(params);
+#else
 	scan_devices(params);
+	scan_sweep(params);
 
-	return fill_menu(params);
+	if (-1 == fill_menu(params)) return -1;
+#ifdef USE_KEXEC_PRELOAD
+	preload_start(params);
+#endif
+	return 0;
+#endif
 }
 
 
@@ -813,6 +1906,10 @@ int process_ctx_menu(struct params_t *params, int action) {
 	static int rc;
 	static int menu_action;
 	static kx_menu *menu;
+#ifdef USE_TIMEOUT
+	int n;
+	kx_menu_dim i;
+#endif
 	menu = params->menu;
 
 #ifdef USE_NUMKEYS
@@ -828,6 +1925,11 @@ int process_ctx_menu(struct params_t *params, int action) {
 	}
 #endif
 
+#ifdef USE_TYPE_FILTER
+	/* Nothing matches filter */
+	if ((A_SELECT == action) && !menu->current->current) return 1;
+#endif
+
 	menu_action = (A_SELECT == action ? menu->current->current->id : action);
 	rc = 1;
 
@@ -881,11 +1983,18 @@ int process_ctx_menu(struct params_t *params, int action) {
 		break;
 
 	case A_RESCAN:
+#ifdef USE_ASYNC_SCAN
+		if (params->scan.running) {
+			log_msg(lg, "Scanning is in progress already");
+			break;
+		}
+#else
 #ifdef USE_FBMENU
 		gui_show_msg(params->gui, "Rescanning devices.\nPlease wait...");
 #endif
 #ifdef USE_TEXTUI
 		tui_show_msg(params->tui, "Rescanning devices.\nPlease wait...");
+#endif
 #endif
 		if (-1 == do_rescan(params)) {
 			log_msg(lg, "Rescan failed");
@@ -895,9 +2004,16 @@ int process_ctx_menu(struct params_t *params, int action) {
 		break;
 
 	case A_DEBUG:
+		trace_log(lg);
 		params->context = KX_CTX_TEXTVIEW;
 		break;
 
+#ifdef USE_TYPE_FILTER
+	case A_FILTER:
+		menu_filter_start(params->filter, menu);
+		break;
+#endif
+
 	case A_EXIT:
 		if (initmode) break;	// don't exit if we are init
 	case A_ERROR:
@@ -906,11 +2022,23 @@ int process_ctx_menu(struct params_t *params, int action) {
 
 #ifdef USE_TIMEOUT
 	case A_TIMEOUT:		// timeout was reached - boot 1st kernel if exists
+#ifdef USE_ASYNC_SCAN
+		/* Wait for all items to choose right one
+		 * unless last booted item is found already */
+		if (params->scan.running
+#ifdef USE_BOOT_HISTORY
+				&& (params->history_choice < 0)
+#endif
+				) break;
+#endif
 		menu->current = menu->top;		/* go top-level menu */
-		if (menu->current->count > 1) {
-			menu_item_select(menu, 0);	/* choose first item */
-			menu_item_select(menu, 1);	/* and switch to next item */
-			rc = 0;
+		n = default_choice(params);
+		for (i = 0; (n >= 0) && (i < menu->current->count); i++) {
+			if (menu->current->list[i]->id == A_DEVICES + n) {
+				menu_item_select_by_no(menu, i);	/* choose default item */
+				rc = 0;
+				break;
+			}
 		}
 		break;
 #endif
@@ -923,6 +2051,212 @@ int process_ctx_menu(struct params_t *params, int action) {
 	return rc;
 }
 
+#ifdef USE_HOTPLUG
+/* Remove boot items of device reported by event 'ev' */
+static void hotplug_remove(struct params_t *params, struct hotplug_event_t *ev)
+{
+	struct bootconf_t *bl;
+	struct boot_item_t *bi;
+	unsigned int i;
+
+	bl = params->bootcfg;
+	if (!bl) return;
+
+	for (i = 0; i < bl->fill; i++) {
+		bi = bl->list[i];
+		if (bi && (bi->major == ev->major) && (bi->minor == ev->minor))
+			remove_boot_item(params, i);
+	}
+
+	/* Forget device to probe it when it will be back */
+	for (i = 0; i < bl->devs_fill; i++) {
+		if ((bl->devs[i].major == ev->major)
+				&& (bl->devs[i].minor == ev->minor))
+			bl->devs[i].seen = 0;
+	}
+	bootcfg_sweep_devices(bl);
+}
+
+
+/* Probe device reported by event 'ev' and add its boot items */
+static void hotplug_add(struct params_t *params, struct hotplug_event_t *ev)
+{
+	struct bootconf_t *bl;
+	struct device_t dev;
+	struct cfgdata_t cfgdata;
+	int rc;
+
+	if (-1 == devscan_get(ev->name, ev->major, ev->minor, &dev)) return;
+
+	bl = params->bootcfg;
+	if (!bl) {
+		bl = create_bootcfg(4);
+		if (NULL == bl) {
+			DPRINTF("Can't allocate bootconf structure");
+			free(dev.device);
+			return;
+		}
+		params->bootcfg = bl;
+	}
+
+	/* Device may be found by scanning already */
+	if (bootcfg_find_device(bl, dev.major, dev.minor, dev.blocks)) {
+		free(dev.device);
+		return;
+	}
+
+#ifdef USE_KEXEC_PRELOAD
+	/* Preloading process may hold boot device mounted at MOUNTPOINT.
+	 * It is started again by process_hotplug() */
+	preload_cancel(params);
+#endif
+
+	rc = scan_single(params, &dev, &cfgdata);
+
+	if (0 == rc) {
+		addto_bootcfg(bl, &dev, &cfgdata);
+		destroy_cfgdata(&cfgdata);
+		fill_menu(params);
+	} else if (1 == rc) {
+		addto_bootcfg(bl, &dev, NULL);
+	}
+
+	free(dev.device);
+#ifdef USE_MOUNT_FDS
+	if (dev.mntfd >= 0) close(dev.mntfd);
+#endif
+}
+
+
+/* Update boot items according to event 'ev' */
+static void hotplug_apply(struct params_t *params, struct hotplug_event_t *ev)
+{
+	log_msg(lg, "Device %s is %s", ev->name, (HP_ADD == ev->action) ?
+			"added" : (HP_REMOVE == ev->action) ? "removed" : "changed");
+
+	/* Changed media is removed and added again */
+	if (HP_ADD != ev->action) hotplug_remove(params, ev);
+	if (HP_REMOVE != ev->action) hotplug_add(params, ev);
+}
+
+
+#ifdef USE_ASYNC_SCAN
+/* Save event 'ev' to apply it when scanning thread is finished */
+static void hotplug_enqueue(struct params_t *params, struct hotplug_event_t *ev)
+{
+	struct hotplug_t *hp = &params->hotplug;
+
+	/* Resize queue when needed before adding event */
+	if (hp->fill >= hp->size) {
+		struct hotplug_event_t *new_queue;
+		unsigned int new_size;
+
+		new_size = hp->size ? hp->size * 2 : 4;
+		new_queue = realloc(hp->queue, new_size * sizeof(*(hp->queue)));
+		if (NULL == new_queue) {
+			DPRINTF("Can't resize hotplug queue");
+			return;
+		}
+		hp->size = new_size;
+		hp->queue = new_queue;
+	}
+
+	hp->queue[hp->fill++] = *ev;
+}
+
+
+/* Apply events got while scanning thread was running */
+static void hotplug_flush(struct params_t *params)
+{
+	struct hotplug_t *hp = &params->hotplug;
+	unsigned int i;
+
+	for (i = 0; i < hp->fill; i++)
+		hotplug_apply(params, &hp->queue[i]);
+
+	hp->fill = 0;
+	dispose(hp->queue);
+	hp->size = 0;
+}
+#endif
+
+
+/* Process block devices hotplug events in any context
+ * Return >0 to continue
+ */
+int process_hotplug(struct params_t *params)
+{
+	struct hotplug_event_t ev;
+
+	while (hotplug_read(params->hotplug.fd, &ev) > 0) {
+#ifdef USE_ASYNC_SCAN
+		/* Scanning thread owns bootcfg and mountpoint now */
+		if (params->scan.running) {
+			hotplug_enqueue(params, &ev);
+			continue;
+		}
+#endif
+		hotplug_apply(params, &ev);
+	}
+
+#ifdef USE_KEXEC_PRELOAD
+	/* Default item may be changed */
+#ifdef USE_ASYNC_SCAN
+	if (!params->scan.running)
+#endif
+	preload_start(params);
+#endif
+
+	return 1;
+}
+#endif
+
+
+#ifdef USE_ASYNC_SCAN
+/* Process notifications of scanning thread in any context
+ * Return <0 to raise error, >0 to continue
+ */
+int process_scan(struct params_t *params, int action)
+{
+	int rc;
+
+	if (A_SCAN_DONE == action) {
+		scan_wait(params, 0);
+#ifdef USE_FBMENU
+		if (params->gui) params->gui->busy = 0;
+#endif
+		/* Remove items of devices which are gone */
+		scan_sweep(params);
+#ifdef USE_HOTPLUG
+		hotplug_flush(params);
+#endif
+	}
+
+	/* Add items found so far */
+	pthread_mutex_lock(&params->scan.lock);
+	rc = fill_menu(params);
+	pthread_mutex_unlock(&params->scan.lock);
+
+#ifdef USE_KEXEC_PRELOAD
+	/* Default item is known when all items are found */
+	if ((A_SCAN_DONE == action) && (-1 != rc)) preload_start(params);
+#endif
+
+	return (-1 == rc ? -1 : 1);
+}
+#endif
+
+#ifdef USE_TYPE_FILTER
+/* Process key typed into menu filter
+ * Return >0 to continue
+ */
+int process_filter(struct params_t *params, char c)
+{
+	menu_filter_key(params->filter, params->menu, c);
+	return 1;
+}
+#endif
+
 /* Draw menu context */
 void draw_ctx_menu(struct params_t *params)
 {
@@ -981,11 +2315,13 @@ void draw_ctx_textview(struct params_t *params)
 int do_main_loop(struct params_t *params, kx_inputs *inputs)
 {
 	int rc = 0;
-	int action;
+	int action, ts;
 
 	/* Start with menu context */
 	params->context = KX_CTX_MENU;
+	ts = trace_begin("first_frame", NULL);
 	draw_ctx_menu(params);
+	trace_end(ts);
 
 	/* Event loop */
 	do {
@@ -993,6 +2329,23 @@ int do_main_loop(struct params_t *params, kx_inputs *inputs)
 		action = inputs_process(inputs);
 		if (action != A_NONE) {
 
+#ifdef USE_ASYNC_SCAN
+			if ((A_SCAN_ITEMS == action) || (A_SCAN_DONE == action))
+				rc = process_scan(params, action);
+			else
+#endif
+#ifdef USE_HOTPLUG
+			if (A_HOTPLUG == action)
+				rc = process_hotplug(params);
+			else
+#endif
+#ifdef USE_TYPE_FILTER
+			/* Keys are typed into filter while it is shown */
+			if ((KX_CTX_MENU == params->context) && inputs->key_char
+					&& menu_filter_active(params->filter, params->menu))
+				rc = process_filter(params, inputs->key_char);
+			else
+#endif
 			/* Process events in current context */
 			switch (params->context) {
 			case KX_CTX_MENU:
@@ -1029,7 +2382,7 @@ int do_main_loop(struct params_t *params, kx_inputs *inputs)
 
 int main(int argc, char **argv)
 {
-	int rc = 0;
+	int rc = 0, ts;
 	struct cfgdata_t cfg;
 	struct params_t params;
 	kx_inputs inputs;
@@ -1037,13 +2390,17 @@ int main(int argc, char **argv)
 	lg = log_open(16);
 	log_msg(lg, "%s starting", PACKAGE_STRING);
 
+	ts = trace_begin("do_init", NULL);
 	initmode = do_init();
+	trace_end(ts);
 
 	/* Get cmdline parameters */
 	params.cfg = &cfg;
 	init_cfgdata(&cfg);
 	cfg.angle = 0;	/* No rotation by default */
+	ts = trace_begin("parse_cmdline", NULL);
 	parse_cmdline(&cfg);
+	trace_end(ts);
 
 	kxb_ttydev = cfg.ttydev;
 	setup_terminal(kxb_ttydev, &kxb_echo_state, 1);
@@ -1061,7 +2418,9 @@ int main(int argc, char **argv)
 #ifdef USE_FBMENU
 	params.gui = NULL;
 	if (no_ui) {
+		ts = trace_begin("gui_init", NULL);
 		params.gui = gui_init(cfg.angle);
+		trace_end(ts);
 		if (NULL == params.gui) {
 			log_msg(lg, "Can't initialize GUI");
 		} else no_ui = 0;
@@ -1086,21 +2445,99 @@ int main(int argc, char **argv)
 	
 	params.menu = build_menu(&params);
 	params.bootcfg = NULL;
+	params.menu_filled = 0;
+#ifdef USE_TYPE_FILTER
+	params.filter = menu_filter_create(params.menu->top);
+#endif
+#ifdef USE_SCAN_CACHE
+	params.cache = scan_cache_open(USE_SCAN_CACHE);
+#endif
+#ifdef USE_KEXEC_PRELOAD
+	params.preload.pid = 0;
+	params.preload.choice = -1;
+#endif
+#ifdef USE_HOTPLUG
+	/* Listen before scanning to not miss any device */
+	params.hotplug.fd = hotplug_open();
+#ifdef USE_ASYNC_SCAN
+	params.hotplug.queue = NULL;
+	params.hotplug.size = 0;
+	params.hotplug.fill = 0;
+#endif
+#endif
+
+#ifdef USE_ASYNC_SCAN
+	/* Collect input devices */
+	inputs_init(&inputs, 8);
+	inputs_open(&inputs);
+
+	if (-1 == scan_init(&params, &inputs)) {
+		exit(-1);
+	}
+
+#ifdef USE_BOOT_HISTORY
+	params.history = boot_history_load(USE_BOOT_HISTORY);
+	params.history_choice = -1;
+	/* Show last booted item before anything else is scanned */
+	if (params.history) {
+		ts = trace_begin("history_scan", params.history->name);
+		history_scan(&params);
+		trace_end(ts);
+	}
+#endif
+
+	/* Scan devices in background while menu is shown */
+	if (-1 == scan_start(&params)) {
+		exit(-1);
+	}
+#ifdef USE_HOTPLUG
+	if (params.hotplug.fd >= 0)
+		inputs_add_fd(&inputs, params.hotplug.fd, KX_IT_SOCKET);
+#endif
+	inputs_preprocess(&inputs);
+#else
 	scan_devices(&params);
 
 	if (-1 == fill_menu(&params)) {
 		exit(-1);
 	}
+#ifdef USE_KEXEC_PRELOAD
+	preload_start(&params);
+#endif
 
 	/* Collect input devices */
 	inputs_init(&inputs, 8);
 	inputs_open(&inputs);
+#ifdef USE_HOTPLUG
+	if (params.hotplug.fd >= 0)
+		inputs_add_fd(&inputs, params.hotplug.fd, KX_IT_SOCKET);
+#endif
 	inputs_preprocess(&inputs);
+#endif
 
 	/* Run main event loop
 	 * Return values: <0 - error, >=0 - selected item id */
 	rc = do_main_loop(&params, &inputs);
 
+#ifdef USE_ASYNC_SCAN
+	/* Devices should be left alone before booting */
+	scan_wait(&params, 1);
+#endif
+#if defined(USE_HOTPLUG) && defined(USE_ASYNC_SCAN)
+	dispose(params.hotplug.queue);
+#endif
+#ifdef USE_SCAN_CACHE
+	scan_cache_close(params.cache);
+#endif
+#ifdef USE_BOOT_HISTORY
+	/* History is needed to decide whether to update it */
+	if (rc < A_DEVICES) boot_history_free(params.history);
+#endif
+#ifdef USE_KEXEC_PRELOAD
+	/* Nothing will be booted */
+	if (rc < A_DEVICES) preload_cancel(&params);
+#endif
+
 #ifdef USE_FBMENU
 	if (params.gui) {
 		if (rc < 0) gui_clear(params.gui);
@@ -1119,9 +2556,16 @@ int main(int argc, char **argv)
 	log_close(lg);
 	lg = NULL;
 
+#if defined(USE_TRACE) && defined(USE_HOST_DEBUG)
+	trace_dump(TRACE_FILE);
+#endif
+
 	/* rc < 0 indicate error */
 	if (rc < 0) exit(rc);
 
+#ifdef USE_TYPE_FILTER
+	menu_filter_destroy(params.filter);
+#endif
 	menu_destroy(params.menu, 0);
 
 	if (rc >= A_DEVICES) {
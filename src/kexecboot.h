@@ -20,4 +20,101 @@
 #ifndef _HAVE_KEXECBOOT_H
 #define _HAVE_KEXECBOOT_H
 
+#include <sys/types.h>
+
+#include "config.h"
+#include "cfgparser.h"
+#include "devicescan.h"
+#include "menu.h"
+#include "menufilter.h"
+#include "scancache.h"
+#include "boothistory.h"
+#include "hotplug.h"
+
+#ifdef USE_FBMENU
+#include "gui.h"
+#endif
+
+#ifdef USE_TEXTUI
+#include "tui.h"
+#endif
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+/* Init mode flag */
+extern int initmode;
+
+/* Contexts available - menu and textview */
+typedef enum {
+	KX_CTX_MENU,
+	KX_CTX_TEXTVIEW,
+} kx_context;
+
+#ifdef USE_ASYNC_SCAN
+/* Background scanning state */
+struct scan_state_t {
+	pthread_t thread;
+	pthread_mutex_t lock;	/* Protects bootcfg while thread is running */
+	int running;			/* Thread is started and not joined yet */
+	volatile int stop;		/* Ask thread to stop after current device */
+	int notify_fd;			/* Pipe to send actions to main loop */
+};
+#endif
+
+#ifdef USE_KEXEC_PRELOAD
+/* Background kernel loading state */
+struct preload_t {
+	pid_t pid;		/* Loading process (0 - none) */
+	int choice;		/* Boot item being loaded */
+};
+#endif
+
+#ifdef USE_HOTPLUG
+/* Block devices hotplug state */
+struct hotplug_t {
+	int fd;				/* Uevent socket (-1 - none) */
+#ifdef USE_ASYNC_SCAN
+	struct hotplug_event_t *queue;	/* Events got while scanning */
+	unsigned int size;
+	unsigned int fill;
+#endif
+};
+#endif
+
+/* Common parameters */
+struct params_t {
+	struct cfgdata_t *cfg;
+	struct bootconf_t *bootcfg;
+	unsigned int menu_filled;	/* bootcfg items already added to menu */
+	kx_menu *menu;
+	kx_context context;
+#ifdef USE_FBMENU
+	struct gui_t *gui;
+#endif
+#ifdef USE_TEXTUI
+	kx_tui *tui;
+#endif
+#ifdef USE_ASYNC_SCAN
+	struct scan_state_t scan;
+#endif
+#ifdef USE_SCAN_CACHE
+	struct scan_cache *cache;
+#endif
+#ifdef USE_KEXEC_PRELOAD
+	struct preload_t preload;
+#endif
+#ifdef USE_HOTPLUG
+	struct hotplug_t hotplug;
+#endif
+#ifdef USE_BOOT_HISTORY
+	struct boot_history *history;
+	int history_choice;		/* Last booted item (-1 - not found yet) */
+#endif
+#ifdef USE_TYPE_FILTER
+	struct menu_filter *filter;
+#endif
+};
+
 #endif	/* _HAVE_KEXECBOOT_H */
@@ -98,6 +98,8 @@ kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size,
 	level->current_no = 0;
 	level->current = NULL;
 	level->parent = parent;
+	level->title = NULL;
+	level->serial = 0;
 
 	menu->list[menu->count] = level;
 
@@ -109,13 +111,46 @@ kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size,
 }
 
 
+/* Make room for 'size' items in menu level */
+int menu_level_reserve(kx_menu_level *level, kx_menu_dim size)
+{
+	kx_menu_item **new_list;
+
+	if (!level) return -1;
+	if (size <= level->size) return 0;
+
+	new_list = realloc(level->list, size * sizeof(*(level->list)));
+	if (NULL == new_list) {
+		DPRINTF("Can't resize menu items list");
+		return -1;
+	}
+
+	level->size = size;
+	level->list = new_list;
+	return 0;
+}
+
+
 /* Add menu item to menu level */
 kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 		char *label, char *description, kx_menu_level *submenu)
+{
+	if (!level) return NULL;
+
+	return menu_item_insert(level, level->count, id, label, description,
+			submenu);
+}
+
+
+/* Insert menu item into menu level at position 'no' */
+kx_menu_item *menu_item_insert(kx_menu_level *level, kx_menu_dim no,
+		kx_menu_id id, char *label, char *description,
+		kx_menu_level *submenu)
 {
 	kx_menu_item *item;
 
 	if (!level) return NULL;
+	if (no > level->count) no = level->count;
 	
 	/* Resize list when needed before adding item */
 	if (level->count >= level->size) {
@@ -143,21 +178,64 @@ kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 	item->description = ( description ? strdup(description) : NULL );
 	item->id = id;
 	item->submenu = submenu;
+	item->data = NULL;
 
-	level->list[level->count] = item;
+	/* Move tail of list to free place for new item */
+	memmove(&level->list[no + 1], &level->list[no],
+			(level->count - no) * sizeof(*(level->list)));
+	level->list[no] = item;
 
 	/* If there is no current item yet then make this item current */
 	if (!level->current) {
 		level->current = item;
-		level->current_no = level->count;
+		level->current_no = no;
+	} else if (no <= level->current_no) {
+		/* Current item was moved down */
+		++level->current_no;
 	}
 
 	++level->count;
+	++level->serial;
 
 	return item;
 }
 
 
+/* Remove menu item 'id' from menu level */
+int menu_item_remove(kx_menu_level *level, kx_menu_id id)
+{
+	kx_menu_item *item;
+	kx_menu_dim no;
+
+	if (!level) return -1;
+
+	for (no = 0; no < level->count; no++)
+		if (level->list[no] && (level->list[no]->id == id)) break;
+	if (no >= level->count) return -1;
+
+	item = level->list[no];
+	dispose(item->label);
+	dispose(item->description);
+	free(item);
+
+	/* Move tail of list to fill place of item */
+	--level->count;
+	memmove(&level->list[no], &level->list[no + 1],
+			(level->count - no) * sizeof(*(level->list)));
+
+	/* Keep current item or select next one when it was removed */
+	if (no < level->current_no) {
+		--level->current_no;
+	} else if ((no == level->current_no) && (no >= level->count)) {
+		level->current_no = (level->count > 0 ? level->count - 1 : 0);
+	}
+	level->current = (level->count > 0 ? level->list[level->current_no] : NULL);
+	++level->serial;
+
+	return 0;
+}
+
+
 void menu_destroy(kx_menu *menu, int destroy_data)
 {
 	int i,j;
@@ -42,6 +42,8 @@ typedef struct kx_menu_level {
 	kx_menu_item *current;		/* Current active item */
 	struct kx_menu_level *parent;	/* Upper menu level */
 	kx_menu_item **list;		/* Menu items array */
+	const char *title;			/* Shown instead of default title (or NULL) */
+	unsigned int serial;		/* Changed when items are added or removed */
 } kx_menu_level;
 
 typedef struct kx_menu {
@@ -70,10 +72,21 @@ kx_menu_dim menu_item_select_by_no(kx_menu *menu, int no);
 kx_menu_level *menu_level_create(kx_menu *menu, kx_menu_dim size, 
 		kx_menu_level *parent);
 
+/* Make room for 'size' items in menu level */
+int menu_level_reserve(kx_menu_level *level, kx_menu_dim size);
+
 /* Add menu item to menu level */
 kx_menu_item *menu_item_add(kx_menu_level *level, kx_menu_id id,
 		char *label, char *description, kx_menu_level *submenu);
 
+/* Insert menu item into menu level at position 'no' */
+kx_menu_item *menu_item_insert(kx_menu_level *level, kx_menu_dim no,
+		kx_menu_id id, char *label, char *description,
+		kx_menu_level *submenu);
+
+/* Remove menu item 'id' from menu level */
+int menu_item_remove(kx_menu_level *level, kx_menu_id id);
+
 void menu_item_set_data(kx_menu_item *item, void *data);
 
 void menu_destroy(kx_menu *menu, int destroy_data);
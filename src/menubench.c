@@ -0,0 +1,171 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Menu building benchmark
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+/*
+ * Usage: kexecboot-menubench [<items> [<rounds>]]
+ *
+ * Puts synthetic boot items of random priorities into bootcfg, ten per
+ * device, and fills menu with them at once and device by device as
+ * background scanning does. Log goes to /dev/null.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "config.h"
+#include "util.h"
+#include "bootmenu.h"
+
+#define ITEMS_PER_DEVICE	10
+
+/* Kernel search paths of kexecboot.c. Kernels are not searched here */
+char *default_kernels[] = { NULL };
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Add device 'n' with 'count' boot items to bootcfg */
+static int add_device(struct bootconf_t *bl, int n, int count)
+{
+	struct cfgdata_t cfgdata;
+	struct device_t dev;
+	char buf[64];
+	int i, rc;
+
+	init_cfgdata(&cfgdata);
+	for (i = 0; i < count; i++) {
+		snprintf(buf, sizeof(buf), MOUNTPOINT "/boot/zImage-%d", i);
+		if (-1 == cfgdata_add_kernel(&cfgdata, buf)) return -1;
+
+		snprintf(buf, sizeof(buf), "Linux %d.%d", n, i);
+		cfgdata.current->label = strdup(buf);
+		cfgdata.current->priority = rand() % 100;
+	}
+
+	snprintf(buf, sizeof(buf), "/dev/mmcblk0p%d", n);
+	dev.device = buf;
+	dev.fstype = "ext4";
+	dev.blocks = 1024 * 1024;
+	dev.major = 179;
+	dev.minor = n;
+	dev.stamp = 0;
+#ifdef USE_MOUNT_FDS
+	dev.mntfd = -1;
+#endif
+
+	rc = addto_bootcfg(bl, &dev, &cfgdata);
+	destroy_cfgdata(&cfgdata);
+	return rc;
+}
+
+/* Build menu of 'count' items. Fill it after every device when
+ * 'incremental' is set. Add spent times to 'add' and 'fill' */
+static int run(int count, int incremental, double *add, double *fill)
+{
+	struct cfgdata_t cfg;
+	struct params_t params;
+	int n, rc;
+	double t;
+
+	memset(&params, 0, sizeof(params));
+	init_cfgdata(&cfg);
+	params.cfg = &cfg;
+	params.menu = build_menu(&params);
+	params.bootcfg = create_bootcfg(4);
+	if (!params.menu || !params.bootcfg) return -1;
+#ifdef USE_TYPE_FILTER
+	params.filter = menu_filter_create(params.menu->top);
+#endif
+
+	rc = 0;
+	for (n = 0; (0 == rc) && (n * ITEMS_PER_DEVICE < count); n++) {
+		t = now();
+		rc = add_device(params.bootcfg, n, ITEMS_PER_DEVICE);
+		*add += now() - t;
+
+		if (incremental && (0 == rc)) {
+			t = now();
+			rc = fill_menu(&params);
+			*fill += now() - t;
+		}
+	}
+
+	if (!incremental && (0 == rc)) {
+		t = now();
+		rc = fill_menu(&params);
+		*fill += now() - t;
+	}
+
+	if ((0 == rc) && (params.menu->top->count < count)) {
+		fprintf(stdout, "Menu has %d items of %d\n",
+				params.menu->top->count, count);
+		rc = -1;
+	}
+
+#ifdef USE_TYPE_FILTER
+	menu_filter_destroy(params.filter);
+#endif
+	menu_destroy(params.menu, 0);
+	free_bootcfg(params.bootcfg);
+	destroy_cfgdata(&cfg);
+	return rc;
+}
+
+int main(int argc, char **argv)
+{
+	double add, fill;
+	int count, rounds, incremental, i;
+
+	count = (argc > 1) ? atoi(argv[1]) : 10000;
+	rounds = (argc > 2) ? atoi(argv[2]) : 5;
+	if ((count <= 0) || (rounds <= 0)) {
+		fprintf(stderr, "Usage: %s [<items> [<rounds>]]\n", argv[0]);
+		return 2;
+	}
+
+	/* Every item is logged */
+	if (NULL == freopen("/dev/null", "w", stderr)) return 1;
+
+	printf("%d items, %d per device, %d rounds\n",
+			count, ITEMS_PER_DEVICE, rounds);
+
+	for (incremental = 0; incremental < 2; incremental++) {
+		add = 0;
+		fill = 0;
+		for (i = 0; i < rounds; i++) {
+			lg = log_open(16);
+			srand(i);
+			if (-1 == run(count, incremental, &add, &fill)) {
+				printf("Can't build menu\n");
+				return 1;
+			}
+			log_close(lg);
+		}
+
+		printf("%-12s bootcfg: %8.3f ms  fill_menu: %8.3f ms\n",
+				incremental ? "per device" : "at once",
+				add * 1e3 / rounds, fill * 1e3 / rounds);
+	}
+
+	return 0;
+}
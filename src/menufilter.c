@@ -0,0 +1,425 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Type-ahead filter of menu items
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_TYPE_FILTER
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "util.h"
+#include "menufilter.h"
+
+/* Every 1, 2 and 3 characters long substring of item text is put into
+ * bucket chosen by its hash. Filter text is looked for only in items of
+ * smallest bucket of its substrings */
+#define FILTER_GRAM			3
+#define FILTER_BUCKETS		1024	/* Power of 2 */
+
+/* Removed entries are dropped from index when there are many of them */
+#define FILTER_DEAD_MIN		64
+
+struct filter_entry {
+	kx_menu_item *item;		/* NULL when item is removed */
+	kx_menu_id id;
+	int priority;
+	char *text;				/* Lowercased label and description */
+};
+
+struct filter_bucket {
+	unsigned int *list;		/* Entries having substring of bucket */
+	unsigned int size;
+	unsigned int fill;
+};
+
+struct menu_filter {
+	kx_menu_level level;	/* Matching items (not owned) */
+
+	struct filter_entry *entries;
+	unsigned int size;
+	unsigned int fill;
+	unsigned int dead;		/* Removed entries count */
+	int broken;				/* Index is incomplete, check all entries */
+
+	struct filter_bucket buckets[FILTER_BUCKETS];
+
+	unsigned int *matches;	/* Entries matching filter text, sorted */
+	unsigned int matches_fill;
+
+	char title[MENU_FILTER_MAX + 2];	/* '/' and filter text */
+	int len;				/* Filter text length */
+};
+
+
+static unsigned int gram_hash(const char *s, int n)
+{
+	unsigned int h = n;
+
+	while (n--) h = h * 31 + (unsigned char)*s++;
+	return h & (FILTER_BUCKETS - 1);
+}
+
+
+/* Put entry 'idx' into bucket once */
+static int bucket_add(struct filter_bucket *b, unsigned int idx)
+{
+	/* Entry substrings are added together so check last one only */
+	if ((b->fill > 0) && (b->list[b->fill - 1] == idx)) return 0;
+
+	if (b->fill >= b->size) {
+		unsigned int *new_list;
+		unsigned int new_size;
+
+		new_size = b->size ? b->size * 2 : 4;
+		new_list = realloc(b->list, new_size * sizeof(*(b->list)));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize filter bucket");
+			return -1;
+		}
+		b->size = new_size;
+		b->list = new_list;
+	}
+
+	b->list[b->fill++] = idx;
+	return 0;
+}
+
+
+/* Put substrings of entry 'idx' into index */
+static void filter_index(struct menu_filter *mf, unsigned int idx)
+{
+	const char *text, *p;
+	int n;
+
+	text = mf->entries[idx].text;
+	for (p = text; *p; p++) {
+		/* Don't join label and description */
+		for (n = 1; (n <= FILTER_GRAM) && p[n - 1] && ('\n' != p[n - 1]); n++) {
+			if (-1 == bucket_add(&mf->buckets[gram_hash(p, n)], idx))
+				mf->broken = 1;
+		}
+	}
+}
+
+
+/* Drop removed entries and build index again */
+static void filter_reindex(struct menu_filter *mf)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < FILTER_BUCKETS; i++)
+		mf->buckets[i].fill = 0;
+
+	for (i = 0, j = 0; i < mf->fill; i++) {
+		if (mf->entries[i].item) mf->entries[j++] = mf->entries[i];
+	}
+	mf->fill = j;
+	mf->dead = 0;
+	mf->broken = 0;
+
+	for (i = 0; i < mf->fill; i++)
+		filter_index(mf, i);
+}
+
+
+/* qsort() has no context argument. Filter is used by main thread only */
+static struct filter_entry *sort_entries;
+
+/* Same order as main menu has */
+static int match_cmp(const void *a, const void *b)
+{
+	const struct filter_entry *ea, *eb;
+
+	ea = &sort_entries[*(const unsigned int *)a];
+	eb = &sort_entries[*(const unsigned int *)b];
+
+	if (ea->priority != eb->priority)
+		return (ea->priority < eb->priority) ? 1 : -1;
+	return ea->id - eb->id;
+}
+
+
+/* Find entries matching filter text using index */
+static void filter_query(struct menu_filter *mf)
+{
+	const char *text;
+	struct filter_bucket *b, *best;
+	unsigned int i, count, idx, *list;
+	int n, pos;
+
+	text = mf->title + 1;
+	mf->matches_fill = 0;
+
+	if ((0 == mf->len) || mf->broken) {
+		list = NULL;
+		count = mf->fill;
+	} else {
+		/* Smallest bucket has least candidates */
+		n = (mf->len < FILTER_GRAM) ? mf->len : FILTER_GRAM;
+		best = NULL;
+		for (pos = 0; pos + n <= mf->len; pos++) {
+			b = &mf->buckets[gram_hash(text + pos, n)];
+			if (!best || (b->fill < best->fill)) best = b;
+		}
+		list = best->list;
+		count = best->fill;
+	}
+
+	for (i = 0; i < count; i++) {
+		idx = list ? list[i] : i;
+		if (!mf->entries[idx].item) continue;
+		if (mf->len && !strstr(mf->entries[idx].text, text)) continue;
+		mf->matches[mf->matches_fill++] = idx;
+	}
+
+	sort_entries = mf->entries;
+	qsort(mf->matches, mf->matches_fill, sizeof(*(mf->matches)), match_cmp);
+}
+
+
+/* Keep matches which have longer filter text too */
+static void filter_narrow(struct menu_filter *mf)
+{
+	unsigned int i, j, idx;
+
+	for (i = 0, j = 0; i < mf->matches_fill; i++) {
+		idx = mf->matches[i];
+		if (strstr(mf->entries[idx].text, mf->title + 1))
+			mf->matches[j++] = idx;
+	}
+	mf->matches_fill = j;
+}
+
+
+/* Show matching items in filter level. Keep current item if possible */
+static void filter_show(struct menu_filter *mf)
+{
+	kx_menu_level *ml = &mf->level;
+	kx_menu_item *current;
+	unsigned int i;
+
+	current = ml->current;
+	if (-1 == menu_level_reserve(ml, mf->matches_fill)) {
+		mf->matches_fill = ml->size;
+	}
+
+	ml->current_no = 0;
+	for (i = 0; i < mf->matches_fill; i++) {
+		ml->list[i] = mf->entries[mf->matches[i]].item;
+		if (ml->list[i] == current) ml->current_no = i;
+	}
+	ml->count = mf->matches_fill;
+	ml->current = (ml->count > 0) ? ml->list[ml->current_no] : NULL;
+	++ml->serial;
+}
+
+
+struct menu_filter *menu_filter_create(kx_menu_level *parent)
+{
+	struct menu_filter *mf;
+
+	mf = calloc(1, sizeof(*mf));
+	if (NULL == mf) {
+		DPRINTF("Can't allocate menu filter");
+		return NULL;
+	}
+
+	mf->level.size = 4;
+	mf->level.list = malloc(mf->level.size * sizeof(*(mf->level.list)));
+	if (NULL == mf->level.list) {
+		DPRINTF("Can't allocate menu filter items array");
+		free(mf);
+		return NULL;
+	}
+	mf->level.parent = parent;
+	mf->level.title = mf->title;
+	mf->title[0] = '/';
+
+	return mf;
+}
+
+
+void menu_filter_destroy(struct menu_filter *mf)
+{
+	unsigned int i;
+
+	if (!mf) return;
+
+	for (i = 0; i < mf->fill; i++)
+		dispose(mf->entries[i].text);
+	for (i = 0; i < FILTER_BUCKETS; i++)
+		dispose(mf->buckets[i].list);
+	dispose(mf->entries);
+	dispose(mf->matches);
+	free(mf->level.list);
+	free(mf);
+}
+
+
+int menu_filter_add(struct menu_filter *mf, kx_menu_item *mi, int priority)
+{
+	struct filter_entry *e;
+	size_t label_len, desc_len;
+	char *p;
+
+	if (!mf) return -1;
+
+	if (mf->fill >= mf->size) {
+		struct filter_entry *new_entries;
+		unsigned int *new_matches;
+		unsigned int new_size;
+
+		new_size = mf->size ? mf->size * 2 : 16;
+		new_entries = realloc(mf->entries, new_size * sizeof(*(mf->entries)));
+		if (NULL == new_entries) {
+			DPRINTF("Can't resize menu filter entries");
+			return -1;
+		}
+		mf->entries = new_entries;
+
+		new_matches = realloc(mf->matches, new_size * sizeof(*(mf->matches)));
+		if (NULL == new_matches) {
+			DPRINTF("Can't resize menu filter matches");
+			return -1;
+		}
+		mf->matches = new_matches;
+		mf->size = new_size;
+	}
+
+	label_len = strlenn(mi->label);
+	desc_len = strlenn(mi->description);
+
+	e = &mf->entries[mf->fill];
+	e->text = malloc(label_len + desc_len + 2);
+	if (NULL == e->text) {
+		DPRINTF("Can't allocate menu filter text");
+		return -1;
+	}
+
+	/* Filter is case insensitive */
+	p = e->text;
+	if (label_len) p = chcase('l', mi->label, p) + label_len;
+	*p++ = '\n';
+	if (desc_len) chcase('l', mi->description, p);
+	else *p = '\0';
+
+	e->item = mi;
+	e->id = mi->id;
+	e->priority = priority;
+
+	filter_index(mf, mf->fill++);
+	return 0;
+}
+
+
+void menu_filter_remove(struct menu_filter *mf, kx_menu_id id)
+{
+	unsigned int i, j;
+
+	if (!mf) return;
+
+	for (i = mf->fill; i > 0; i--) {
+		if (mf->entries[i - 1].item && (mf->entries[i - 1].id == id)) break;
+	}
+	if (0 == i) return;
+	--i;
+
+	mf->entries[i].item = NULL;
+	dispose(mf->entries[i].text);
+	mf->entries[i].text = NULL;
+	++mf->dead;
+
+	/* Item should not be shown anymore */
+	for (j = 0; j < mf->matches_fill; j++) {
+		if (mf->matches[j] != i) continue;
+		--mf->matches_fill;
+		memmove(&mf->matches[j], &mf->matches[j + 1],
+				(mf->matches_fill - j) * sizeof(*(mf->matches)));
+		break;
+	}
+
+	if ((mf->dead > FILTER_DEAD_MIN) && (mf->dead * 2 > mf->fill)) {
+		/* Entries are moved so match them again */
+		filter_reindex(mf);
+		filter_query(mf);
+	}
+
+	if (mf->level.current && (mf->level.current->id == id))
+		mf->level.current = NULL;
+	filter_show(mf);
+}
+
+
+int menu_filter_active(struct menu_filter *mf, kx_menu *menu)
+{
+	return (mf && (menu->current == &mf->level));
+}
+
+
+void menu_filter_start(struct menu_filter *mf, kx_menu *menu)
+{
+	if (!mf) return;
+
+	mf->len = 0;
+	mf->title[1] = '\0';
+	mf->level.current = NULL;
+	filter_query(mf);
+	filter_show(mf);
+
+	menu->current = &mf->level;
+}
+
+
+void menu_filter_key(struct menu_filter *mf, kx_menu *menu, char c)
+{
+	if (!menu_filter_active(mf, menu)) return;
+
+	if ((MENU_FILTER_LEAVE == c)
+			|| ((MENU_FILTER_ERASE == c) && (0 == mf->len)))
+	{
+		menu->current = mf->level.parent;
+		return;
+	}
+
+	if (MENU_FILTER_ERASE == c) {
+		mf->title[mf->len--] = '\0';
+		filter_query(mf);
+	} else {
+		if (mf->len >= MENU_FILTER_MAX) return;
+
+		mf->title[++mf->len] = tolower((unsigned char)c);
+		mf->title[mf->len + 1] = '\0';
+
+		/* Longer text matches some of current matches only */
+		if (1 == mf->len) filter_query(mf);
+		else filter_narrow(mf);
+	}
+
+	mf->level.current = NULL;
+	filter_show(mf);
+}
+
+
+void menu_filter_update(struct menu_filter *mf, kx_menu *menu)
+{
+	if (!menu_filter_active(mf, menu)) return;
+
+	filter_query(mf);
+	filter_show(mf);
+}
+
+#endif	/* USE_TYPE_FILTER */
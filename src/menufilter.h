@@ -0,0 +1,62 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Type-ahead filter of menu items
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_MENUFILTER_H_
+#define _HAVE_MENUFILTER_H_
+
+#include "config.h"
+
+#ifdef USE_TYPE_FILTER
+#include "menu.h"
+
+/* Max length of filter text */
+#define MENU_FILTER_MAX		32
+
+/* Keys processed by menu_filter_key() besides text characters */
+#define MENU_FILTER_ERASE	'\b'
+#define MENU_FILTER_LEAVE	'\033'
+
+struct menu_filter;
+
+/* Create filter. Items matching filter text are shown in own menu level
+ * with 'parent' as upper level */
+struct menu_filter *menu_filter_create(kx_menu_level *parent);
+
+/* Free filter structure. Items are not touched */
+void menu_filter_destroy(struct menu_filter *mf);
+
+/* Index label and description of item 'mi'. Matching items are shown
+ * by 'priority' (higher first) and then by item id */
+int menu_filter_add(struct menu_filter *mf, kx_menu_item *mi, int priority);
+
+/* Forget item 'id'. Call it before item is removed from menu */
+void menu_filter_remove(struct menu_filter *mf, kx_menu_id id);
+
+/* Return 1 when filter level is shown now */
+int menu_filter_active(struct menu_filter *mf, kx_menu *menu);
+
+/* Show filter level with empty filter text */
+void menu_filter_start(struct menu_filter *mf, kx_menu *menu);
+
+/* Append character 'c' to filter text, erase last one or leave filter */
+void menu_filter_key(struct menu_filter *mf, kx_menu *menu, char c);
+
+/* Match text again when items were added */
+void menu_filter_update(struct menu_filter *mf, kx_menu *menu);
+
+#endif	/* USE_TYPE_FILTER */
+
+#endif	/* _HAVE_MENUFILTER_H_ */
@@ -0,0 +1,165 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Detached mounts support
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_MOUNT_FDS
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "cfgparser.h"
+#include "mountfd.h"
+
+/* Values from linux/mount.h and linux/openat2.h. These headers are
+ * not available everywhere and conflict with sys/mount.h sometimes */
+#ifndef FSOPEN_CLOEXEC
+#define FSOPEN_CLOEXEC		0x00000001
+#endif
+#ifndef FSCONFIG_SET_FLAG
+#define FSCONFIG_SET_FLAG	0
+#endif
+#ifndef FSCONFIG_SET_STRING
+#define FSCONFIG_SET_STRING	1
+#endif
+#ifndef FSCONFIG_CMD_CREATE
+#define FSCONFIG_CMD_CREATE	6
+#endif
+#ifndef FSMOUNT_CLOEXEC
+#define FSMOUNT_CLOEXEC		0x00000001
+#endif
+#ifndef MOUNT_ATTR_RDONLY
+#define MOUNT_ATTR_RDONLY	0x00000001
+#endif
+#ifndef OPEN_TREE_CLONE
+#define OPEN_TREE_CLONE		1
+#endif
+#ifndef OPEN_TREE_CLOEXEC
+#define OPEN_TREE_CLOEXEC	O_CLOEXEC
+#endif
+#ifndef AT_EMPTY_PATH
+#define AT_EMPTY_PATH		0x1000
+#endif
+#ifndef MOVE_MOUNT_F_EMPTY_PATH
+#define MOVE_MOUNT_F_EMPTY_PATH	0x00000004
+#endif
+#ifndef RESOLVE_IN_ROOT
+#define RESOLVE_IN_ROOT		0x10
+#endif
+
+struct kx_open_how {
+	uint64_t flags;
+	uint64_t mode;
+	uint64_t resolve;
+};
+
+
+int mountfd_open(const char *device, const char *fstype)
+{
+#if defined(SYS_fsopen) && defined(SYS_fsconfig) && defined(SYS_fsmount)
+	int fsfd, mfd, err;
+
+	fsfd = syscall(SYS_fsopen, fstype, FSOPEN_CLOEXEC);
+	if (fsfd < 0) return -1;
+
+	if ( (-1 == syscall(SYS_fsconfig, fsfd, FSCONFIG_SET_STRING,
+				"source", device, 0))
+		|| (-1 == syscall(SYS_fsconfig, fsfd, FSCONFIG_SET_FLAG,
+				"ro", NULL, 0))
+		|| (-1 == syscall(SYS_fsconfig, fsfd, FSCONFIG_CMD_CREATE,
+				NULL, NULL, 0)) )
+	{
+		err = errno;
+		close(fsfd);
+		errno = err;
+		return -1;
+	}
+
+	mfd = syscall(SYS_fsmount, fsfd, FSMOUNT_CLOEXEC, MOUNT_ATTR_RDONLY);
+	err = errno;
+	close(fsfd);
+	errno = err;
+
+	return mfd;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+
+char *mountfd_path(char *buf, int mfd)
+{
+	snprintf(buf, MOUNTFD_PATH_SIZE, "/proc/self/fd/%d", mfd);
+	return buf;
+}
+
+
+int mountfd_openat(int mfd, const char *path, int flags)
+{
+	int fd;
+
+	/* Paths are stored with MOUNTPOINT prepended */
+	if (!strncmp(path, MOUNTPOINT, sizeof(MOUNTPOINT) - 1))
+		path += sizeof(MOUNTPOINT) - 1;
+
+	/* Path should be relative to mount root */
+	while ('/' == *path) ++path;
+
+#ifdef SYS_openat2
+	struct kx_open_how how;
+
+	how.flags = flags | O_CLOEXEC;
+	how.mode = 0;
+	how.resolve = RESOLVE_IN_ROOT;
+
+	fd = syscall(SYS_openat2, mfd, path, &how, sizeof(how));
+	if ((fd >= 0) || (ENOSYS != errno)) return fd;
+#endif
+
+	fd = openat(mfd, path, flags | O_CLOEXEC);
+	return fd;
+}
+
+
+int mountfd_attach(int mfd, const char *path)
+{
+#if defined(SYS_open_tree) && defined(SYS_move_mount)
+	int tfd, rc, err;
+
+	/* Attach clone to keep 'mfd' detached and usable again */
+	tfd = syscall(SYS_open_tree, mfd, "",
+			OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC | AT_EMPTY_PATH);
+	if (tfd < 0) return -1;
+
+	rc = syscall(SYS_move_mount, tfd, "", AT_FDCWD, path,
+			MOVE_MOUNT_F_EMPTY_PATH);
+	err = errno;
+	close(tfd);
+	errno = err;
+
+	return rc;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+#endif	/* USE_MOUNT_FDS */
@@ -0,0 +1,44 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Detached mounts support
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_MOUNTFD_H_
+#define _HAVE_MOUNTFD_H_
+
+#include "config.h"
+
+#ifdef USE_MOUNT_FDS
+
+/* Enough to hold "/proc/self/fd/<fd>" */
+#define MOUNTFD_PATH_SIZE	32
+
+/* Mount 'device' of 'fstype' read-only without attaching it anywhere.
+ * Return mount fd or -1 on error (errno is ENOSYS when kernel can't) */
+int mountfd_open(const char *device, const char *fstype);
+
+/* Return path to root of mount 'mfd' usable as mountpoint */
+char *mountfd_path(char *buf, int mfd);
+
+/* Open file 'path' (which starts with MOUNTPOINT) on mount 'mfd'.
+ * Absolute symlinks are resolved inside of mount when kernel can */
+int mountfd_openat(int mfd, const char *path, int flags);
+
+/* Attach copy of mount 'mfd' to directory 'path'.
+ * Return 0 or -1 on error */
+int mountfd_attach(int mfd, const char *path);
+
+#endif	/* USE_MOUNT_FDS */
+
+#endif	/* _HAVE_MOUNTFD_H_ */
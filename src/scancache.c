@@ -0,0 +1,347 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Device scan cache
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_SCAN_CACHE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "scancache.h"
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+/* Cached boot info of one device */
+struct cache_entry {
+	int major, minor;			/* Device numbers */
+	unsigned long long blocks;	/* Device size in 1K blocks */
+	unsigned long long stamp;	/* Superblock stamp */
+	char fstype[16];
+	int bootable;				/* 0 - nothing to boot on device */
+	int used;					/* Entry was used during current scan */
+	kx_blob data;				/* Packed cfgdata */
+};
+
+struct scan_cache {
+	char *path;
+	struct cache_entry *list;
+	unsigned int size;
+	unsigned int fill;
+	int dirty;					/* Cache file should be rewritten */
+#ifdef USE_THREADS
+	pthread_mutex_t lock;
+#endif
+};
+
+#ifdef USE_THREADS
+#define cache_lock(sc)		pthread_mutex_lock(&(sc)->lock)
+#define cache_unlock(sc)	pthread_mutex_unlock(&(sc)->lock)
+#else
+#define cache_lock(sc)		do { } while (0)
+#define cache_unlock(sc)	do { } while (0)
+#endif
+
+
+/* Return free entry at end of list */
+static struct cache_entry *cache_entry_new(struct scan_cache *sc)
+{
+	struct cache_entry *e;
+
+	/* Resize list when needed before adding entry */
+	if (sc->fill >= sc->size) {
+		struct cache_entry *new_list;
+		unsigned int new_size;
+
+		new_size = sc->size ? sc->size * 2 : 8;
+		new_list = realloc(sc->list, new_size * sizeof(*(sc->list)));
+		if (NULL == new_list) {
+			DPRINTF("Can't resize scan cache");
+			return NULL;
+		}
+
+		sc->size = new_size;
+		sc->list = new_list;
+	}
+
+	e = &sc->list[sc->fill++];
+	e->used = 0;
+	e->bootable = 0;
+	e->fstype[0] = '\0';
+	blob_init(&e->data);
+
+	return e;
+}
+
+
+/* Find entry by device numbers */
+static struct cache_entry *cache_entry_find(struct scan_cache *sc,
+		struct device_t *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < sc->fill; i++) {
+		if ((sc->list[i].major == dev->major)
+				&& (sc->list[i].minor == dev->minor))
+			return &sc->list[i];
+	}
+
+	return NULL;
+}
+
+
+/* Read entries from file */
+static void cache_load(struct scan_cache *sc)
+{
+	kx_blob b;
+	struct cache_entry *e;
+	unsigned int count;
+	char *fstype;
+	size_t len;
+
+	if (-1 == blob_load(&b, sc->path, SCAN_CACHE_MAGIC, SCAN_CACHE_VERSION)) {
+		log_msg(lg, "Scan cache %s is not found or invalid", sc->path);
+		return;
+	}
+
+	for (count = blob_get_u32(&b); !b.error && (count > 0); count--) {
+		e = cache_entry_new(sc);
+		if (NULL == e) break;
+
+		e->major = blob_get_u32(&b);
+		e->minor = blob_get_u32(&b);
+		e->blocks = blob_get_u64(&b);
+		e->stamp = blob_get_u64(&b);
+		fstype = blob_get_str(&b);
+		if (fstype) {
+			strncpy(e->fstype, fstype, sizeof(e->fstype) - 1);
+			e->fstype[sizeof(e->fstype) - 1] = '\0';
+			free(fstype);
+		}
+		e->bootable = blob_get_u32(&b);
+
+		len = blob_get_u32(&b);
+		if (len > b.fill - b.pos) {
+			b.error = 1;
+			break;
+		}
+		blob_put(&e->data, b.data + b.pos, len);
+		b.pos += len;
+	}
+
+	if (b.error) {
+		log_msg(lg, "Scan cache %s is broken", sc->path);
+		while (sc->fill > 0) blob_free(&sc->list[--sc->fill].data);
+	}
+
+	blob_free(&b);
+}
+
+
+struct scan_cache *scan_cache_open(const char *path)
+{
+	struct scan_cache *sc;
+
+	sc = malloc(sizeof(*sc));
+	if (NULL == sc) {
+		DPRINTF("Can't allocate scan cache");
+		return NULL;
+	}
+
+	sc->path = strdup(path);
+	sc->list = NULL;
+	sc->size = 0;
+	sc->fill = 0;
+	sc->dirty = 0;
+#ifdef USE_THREADS
+	pthread_mutex_init(&sc->lock, NULL);
+#endif
+
+	cache_load(sc);
+	return sc;
+}
+
+
+void scan_cache_close(struct scan_cache *sc)
+{
+	unsigned int i;
+
+	if (!sc) return;
+
+	for (i = 0; i < sc->fill; i++)
+		blob_free(&sc->list[i].data);
+	dispose(sc->list);
+	dispose(sc->path);
+#ifdef USE_THREADS
+	pthread_mutex_destroy(&sc->lock);
+#endif
+	free(sc);
+}
+
+
+void scan_cache_begin(struct scan_cache *sc)
+{
+	unsigned int i;
+
+	if (!sc) return;
+
+	cache_lock(sc);
+	for (i = 0; i < sc->fill; i++)
+		sc->list[i].used = 0;
+	cache_unlock(sc);
+}
+
+
+int scan_cache_lookup(struct scan_cache *sc, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+	struct cache_entry *e;
+	kx_blob b;
+	int rc;
+
+	/* Can't say anything about device without stamp */
+	if (!sc || (0 == dev->stamp)) return -1;
+
+	cache_lock(sc);
+	e = cache_entry_find(sc, dev);
+	if ( (NULL == e) || (e->blocks != dev->blocks)
+			|| (e->stamp != dev->stamp) || strcmp(e->fstype, dev->fstype) )
+	{
+		cache_unlock(sc);
+		return -1;
+	}
+
+	if (e->bootable) {
+		/* Read entry data without touching entry itself */
+		b = e->data;
+		b.pos = 0;
+		rc = cfgdata_unpack(&b, cfgdata);
+	} else {
+		rc = 1;
+	}
+
+	if (-1 != rc) e->used = 1;
+	cache_unlock(sc);
+
+	return rc;
+}
+
+
+void scan_cache_keep(struct scan_cache *sc, struct device_t *dev)
+{
+	struct cache_entry *e;
+
+	if (!sc) return;
+
+	cache_lock(sc);
+	e = cache_entry_find(sc, dev);
+	if (e && (e->blocks == dev->blocks)) e->used = 1;
+	cache_unlock(sc);
+}
+
+
+void scan_cache_store(struct scan_cache *sc, struct device_t *dev,
+		struct cfgdata_t *cfgdata)
+{
+	struct cache_entry *e;
+
+	if (!sc || (0 == dev->stamp)) return;
+
+	cache_lock(sc);
+	e = cache_entry_find(sc, dev);
+	if (NULL == e) {
+		e = cache_entry_new(sc);
+		if (NULL == e) {
+			cache_unlock(sc);
+			return;
+		}
+	} else {
+		blob_free(&e->data);
+	}
+
+	e->major = dev->major;
+	e->minor = dev->minor;
+	e->blocks = dev->blocks;
+	e->stamp = dev->stamp;
+	strncpy(e->fstype, dev->fstype, sizeof(e->fstype) - 1);
+	e->fstype[sizeof(e->fstype) - 1] = '\0';
+	e->bootable = (NULL != cfgdata);
+	e->used = 1;
+
+	if (cfgdata && (-1 == cfgdata_pack(&e->data, cfgdata))) {
+		/* Don't keep broken entry */
+		blob_free(&e->data);
+		*e = sc->list[--sc->fill];
+	}
+
+	sc->dirty = 1;
+	cache_unlock(sc);
+}
+
+
+int scan_cache_save(struct scan_cache *sc)
+{
+	kx_blob b;
+	struct cache_entry *e;
+	unsigned int i;
+	int rc;
+
+	if (!sc) return -1;
+
+	cache_lock(sc);
+
+	/* Drop entries of devices which are gone */
+	for (i = 0; i < sc->fill; ) {
+		if (sc->list[i].used) {
+			++i;
+			continue;
+		}
+		blob_free(&sc->list[i].data);
+		sc->list[i] = sc->list[--sc->fill];
+		sc->dirty = 1;
+	}
+
+	if (!sc->dirty) {
+		cache_unlock(sc);
+		return 0;
+	}
+
+	blob_init(&b);
+	blob_put_u32(&b, sc->fill);
+	for (i = 0; i < sc->fill; i++) {
+		e = &sc->list[i];
+		blob_put_u32(&b, e->major);
+		blob_put_u32(&b, e->minor);
+		blob_put_u64(&b, e->blocks);
+		blob_put_u64(&b, e->stamp);
+		blob_put_str(&b, e->fstype);
+		blob_put_u32(&b, e->bootable);
+		blob_put_u32(&b, e->data.fill);
+		blob_put(&b, e->data.data, e->data.fill);
+	}
+
+	rc = blob_save(&b, sc->path, SCAN_CACHE_MAGIC, SCAN_CACHE_VERSION);
+	if (0 == rc) sc->dirty = 0;
+	cache_unlock(sc);
+
+	blob_free(&b);
+	return rc;
+}
+
+#endif	/* USE_SCAN_CACHE */
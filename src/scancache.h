@@ -0,0 +1,60 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Device scan cache
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_SCANCACHE_H_
+#define _HAVE_SCANCACHE_H_
+
+#include "config.h"
+
+#ifdef USE_SCAN_CACHE
+#include "cfgparser.h"
+#include "devicescan.h"
+
+#define SCAN_CACHE_MAGIC	0x4358424b	/* "KBXC" */
+#define SCAN_CACHE_VERSION	2
+
+struct scan_cache;
+
+/* Load cache from file 'path'. Missing or broken file gives empty cache */
+struct scan_cache *scan_cache_open(const char *path);
+
+/* Free cache structure */
+void scan_cache_close(struct scan_cache *sc);
+
+/* Forget which entries were used. Call it before devices scanning */
+void scan_cache_begin(struct scan_cache *sc);
+
+/* Look for boot info of device 'dev'.
+ * Return 0 when cfgdata is filled, 1 when device have nothing to boot
+ * and -1 when device is not cached or was changed */
+int scan_cache_lookup(struct scan_cache *sc, struct device_t *dev,
+		struct cfgdata_t *cfgdata);
+
+/* Keep entry of device 'dev' which is not scanned again */
+void scan_cache_keep(struct scan_cache *sc, struct device_t *dev);
+
+/* Remember boot info of device 'dev' ('cfgdata' is NULL when
+ * device have nothing to boot) */
+void scan_cache_store(struct scan_cache *sc, struct device_t *dev,
+		struct cfgdata_t *cfgdata);
+
+/* Drop entries not used since scan_cache_begin() and write cache file
+ * when anything was changed. Return 0 or -1 on error */
+int scan_cache_save(struct scan_cache *sc);
+
+#endif	/* USE_SCAN_CACHE */
+
+#endif	/* _HAVE_SCANCACHE_H_ */
@@ -0,0 +1,183 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Boot phases tracing
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#include "config.h"
+
+#ifdef USE_TRACE
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "util.h"
+#include "trace.h"
+
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
+struct trace_span_t {
+	const char *name;
+	char arg[24];
+	int tid;
+	unsigned long long start;	/* CLOCK_MONOTONIC, microseconds */
+	unsigned long long end;		/* 0 while span is not finished */
+};
+
+static struct trace_span_t spans[TRACE_MAX_SPANS];
+static int spans_fill = 0;
+static int spans_logged = 0;
+
+#ifdef USE_THREADS
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+#define trace_lock()	pthread_mutex_lock(&trace_lock)
+#define trace_unlock()	pthread_mutex_unlock(&trace_lock)
+#else
+#define trace_lock()	do { } while (0)
+#define trace_unlock()	do { } while (0)
+#endif
+
+
+static unsigned long long trace_now(void)
+{
+	struct timespec ts;
+
+	if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (unsigned long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+
+int trace_begin(const char *name, const char *arg)
+{
+	struct trace_span_t *sp;
+	int id;
+
+	trace_lock();
+	if (spans_fill >= TRACE_MAX_SPANS) {
+		trace_unlock();
+		return -1;
+	}
+	id = spans_fill++;
+	trace_unlock();
+
+	/* Slot is owned by us now */
+	sp = &spans[id];
+	sp->name = name;
+	if (arg) {
+		strncpy(sp->arg, arg, sizeof(sp->arg) - 1);
+		sp->arg[sizeof(sp->arg) - 1] = '\0';
+	} else {
+		sp->arg[0] = '\0';
+	}
+	sp->tid = syscall(SYS_gettid);
+	sp->end = 0;
+	sp->start = trace_now();
+
+	return id;
+}
+
+
+void trace_end(int id)
+{
+	unsigned long long now;
+
+	if (id < 0) return;
+
+	now = trace_now();
+	trace_lock();
+	spans[id].end = now;
+	trace_unlock();
+}
+
+
+void trace_log(kx_text *log)
+{
+	struct trace_span_t *sp;
+	int i, fill;
+
+	trace_lock();
+	fill = spans_fill;
+	trace_unlock();
+
+	if (spans_logged >= fill) return;
+
+	if (0 == spans_logged)
+		log_msg(log, "Trace (start ms, duration ms):");
+
+	/* Keep order: stop at first unfinished span */
+	for (i = spans_logged; i < fill; i++) {
+		sp = &spans[i];
+		if (0 == sp->end) break;
+		log_msg(log, "%6llu.%03llu %5llu.%03llu %s %s",
+				sp->start / 1000, sp->start % 1000,
+				(sp->end - sp->start) / 1000, (sp->end - sp->start) % 1000,
+				sp->name, sp->arg);
+	}
+	spans_logged = i;
+}
+
+
+#ifdef USE_HOST_DEBUG
+/* Write string escaped for JSON */
+static void json_puts(FILE *f, const char *s)
+{
+	for (; *s; s++) {
+		if (('"' == *s) || ('\\' == *s)) fputc('\\', f);
+		if ((unsigned char)*s >= ' ') fputc(*s, f);
+	}
+}
+
+
+int trace_dump(const char *path)
+{
+	FILE *f;
+	struct trace_span_t *sp;
+	int i, n, fill;
+
+	f = fopen(path, "w");
+	if (NULL == f) {
+		DPRINTF("Can't open trace file %s", path);
+		return -1;
+	}
+
+	trace_lock();
+	fill = spans_fill;
+	trace_unlock();
+
+	fprintf(f, "{\"traceEvents\":[");
+	for (i = 0, n = 0; i < fill; i++) {
+		sp = &spans[i];
+		if (0 == sp->end) continue;
+
+		fprintf(f, "%s\n{\"name\":\"", n++ ? "," : "");
+		json_puts(f, sp->name);
+		fprintf(f, "\",\"cat\":\"boot\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+				"\"ts\":%llu,\"dur\":%llu,\"args\":{\"arg\":\"",
+				(int)getpid(), sp->tid, sp->start, sp->end - sp->start);
+		json_puts(f, sp->arg);
+		fprintf(f, "\"}}");
+	}
+	fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+
+	fclose(f);
+	return 0;
+}
+#endif
+
+#endif	/* USE_TRACE */
@@ -0,0 +1,54 @@
+/*
+ *  kexecboot - A kexec based bootloader
+ *  Boot phases tracing
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ */
+
+#ifndef _HAVE_TRACE_H_
+#define _HAVE_TRACE_H_
+
+#include "config.h"
+#include "util.h"
+
+#ifdef USE_TRACE
+
+/* Max number of spans to record. Extra spans are dropped */
+#define TRACE_MAX_SPANS		256
+
+/* Start span 'name' with optional argument 'arg' (device name e.g.)
+ * Return span id or -1 when span can't be recorded */
+int trace_begin(const char *name, const char *arg);
+
+/* Finish span 'id' */
+void trace_end(int id);
+
+/* Add finished spans not logged yet to 'log' */
+void trace_log(kx_text *log);
+
+#ifdef USE_HOST_DEBUG
+/* Where to dump trace when running on host */
+#define TRACE_FILE	"/tmp/kexecboot-trace.json"
+
+/* Write spans to file 'path' in Chrome trace event format */
+int trace_dump(const char *path);
+#endif
+
+#else
+
+#define trace_begin(name, arg)	(-1)
+#define trace_end(id)			do { (void)(id); } while (0)
+#define trace_log(log)			do { } while (0)
+
+#endif	/* USE_TRACE */
+
+#endif	/* _HAVE_TRACE_H_ */
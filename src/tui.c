@@ -130,11 +130,13 @@ void tui_show_menu(kx_tui *tui, kx_menu *menu)
 	static int firstslot=0;
 	int cur_no;
 
+	ml = menu->current;			/* active menu level */
+
 	/* Goto 1,1; switch color; draw 3 lines */
 	fprintf(tui->ts, TERM_CSI_ED TERM_CSI "1;1" TERM_CUP TUI_CLR_BG TERM_CSI_EL "\n"
-		" KEXECBOOT" TERM_CSI_EEL "\n" TERM_CSI_EL "\n");
+		" %s" TERM_CSI_EEL "\n" TERM_CSI_EL "\n",
+		(ml->title ? ml->title : "KEXECBOOT"));
 
-	ml = menu->current;			/* active menu level */
 	cur_no = ml->current_no;	/* active menu item index */
 
 	if(cur_no < firstslot)
@@ -28,10 +28,18 @@
 #include <termios.h>
 #include <limits.h>		/* LONG_MAX, INT_MAX */
 #include <stdarg.h>		/* va_start/va_end */
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/ioctl.h>
+#include <mtd/ubi-user.h>
 
 #include "config.h"
 #include "util.h"
 
+#ifdef USE_THREADS
+#include <pthread.h>
+#endif
+
 
 /* Create charlist structure */
 struct charlist *create_charlist(int size)
@@ -93,6 +101,370 @@ int in_charlist(struct charlist *cl, const char *str)
 }
 
 
+#ifdef USE_BLOBS
+void blob_init(kx_blob *b)
+{
+	b->data = NULL;
+	b->size = 0;
+	b->fill = 0;
+	b->pos = 0;
+	b->error = 0;
+}
+
+
+void blob_free(kx_blob *b)
+{
+	dispose(b->data);
+	blob_init(b);
+}
+
+
+void blob_put(kx_blob *b, const void *data, size_t len)
+{
+	if (b->error) return;
+
+	/* Resize buffer when needed */
+	if (b->fill + len > b->size) {
+		unsigned char *new_data;
+		size_t new_size;
+
+		new_size = b->size ? b->size : 256;
+		while (new_size < b->fill + len) new_size <<= 1;
+
+		new_data = realloc(b->data, new_size);
+		if (NULL == new_data) {
+			DPRINTF("Can't resize blob");
+			b->error = 1;
+			return;
+		}
+		b->data = new_data;
+		b->size = new_size;
+	}
+
+	memcpy(b->data + b->fill, data, len);
+	b->fill += len;
+}
+
+
+/* Numbers are stored little-endian whatever byte order of host is */
+static void le_encode(unsigned char *p, uint64_t val, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++, val >>= 8)
+		p[i] = val & 0xFF;
+}
+
+static uint64_t le_decode(const unsigned char *p, int len)
+{
+	uint64_t val = 0;
+
+	while (len--)
+		val = (val << 8) | p[len];
+	return val;
+}
+
+
+void blob_put_u32(kx_blob *b, uint32_t val)
+{
+	unsigned char buf[4];
+
+	le_encode(buf, val, sizeof(buf));
+	blob_put(b, buf, sizeof(buf));
+}
+
+
+void blob_put_u64(kx_blob *b, uint64_t val)
+{
+	unsigned char buf[8];
+
+	le_encode(buf, val, sizeof(buf));
+	blob_put(b, buf, sizeof(buf));
+}
+
+
+/* String is stored as length + 1 (0 for NULL) and chars without '\0' */
+void blob_put_str(kx_blob *b, const char *str)
+{
+	uint32_t len;
+
+	if (NULL == str) {
+		blob_put_u32(b, 0);
+		return;
+	}
+
+	len = strlen(str);
+	blob_put_u32(b, len + 1);
+	blob_put(b, str, len);
+}
+
+
+int blob_get(kx_blob *b, void *data, size_t len)
+{
+	if (b->error || (len > b->fill - b->pos)) {
+		b->error = 1;
+		memset(data, 0, len);
+		return -1;
+	}
+
+	memcpy(data, b->data + b->pos, len);
+	b->pos += len;
+	return 0;
+}
+
+
+uint32_t blob_get_u32(kx_blob *b)
+{
+	unsigned char buf[4];
+
+	blob_get(b, buf, sizeof(buf));
+	return le_decode(buf, sizeof(buf));
+}
+
+
+uint64_t blob_get_u64(kx_blob *b)
+{
+	unsigned char buf[8];
+
+	blob_get(b, buf, sizeof(buf));
+	return le_decode(buf, sizeof(buf));
+}
+
+
+char *blob_get_str(kx_blob *b)
+{
+	uint32_t len;
+	char *str;
+
+	len = blob_get_u32(b);
+	if (0 == len) return NULL;
+	--len;
+
+	if (b->error || (len > b->fill - b->pos)) {
+		b->error = 1;
+		return NULL;
+	}
+
+	str = malloc(len + 1);
+	if (NULL == str) {
+		DPRINTF("Can't allocate memory for string");
+		b->error = 1;
+		return NULL;
+	}
+
+	memcpy(str, b->data + b->pos, len);
+	str[len] = '\0';
+	b->pos += len;
+
+	return str;
+}
+
+
+/* File header: magic, version, length and checksum of data */
+#define BLOB_HEADER_SIZE	16
+
+int blob_save(kx_blob *b, const char *path, uint32_t magic, uint32_t version)
+{
+	FILE *f;
+	unsigned char hdr[BLOB_HEADER_SIZE];
+	char tmp[PATH_MAX];
+
+	if (b->error) return -1;
+
+	le_encode(hdr, magic, 4);
+	le_encode(hdr + 4, version, 4);
+	le_encode(hdr + 8, b->fill, 4);
+	le_encode(hdr + 12, fnv_hash(b->data, b->fill), 4);
+
+	snprintf(tmp, sizeof(tmp), "%s.new", path);
+	f = fopen(tmp, "w");
+	if (NULL == f) {
+		log_msg(lg, "Can't open '%s' for writing: %s", tmp, ERRMSG);
+		return -1;
+	}
+
+	if ( (1 != fwrite(hdr, sizeof(hdr), 1, f))
+		|| (b->fill && (1 != fwrite(b->data, b->fill, 1, f))) )
+	{
+		log_msg(lg, "Can't write '%s': %s", tmp, ERRMSG);
+		fclose(f);
+		unlink(tmp);
+		return -1;
+	}
+
+	if (0 != fclose(f)) {
+		log_msg(lg, "Can't write '%s': %s", tmp, ERRMSG);
+		unlink(tmp);
+		return -1;
+	}
+
+	/* Don't leave half-written file in place */
+	if (-1 == rename(tmp, path)) {
+		log_msg(lg, "Can't rename '%s': %s", tmp, ERRMSG);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int blob_load(kx_blob *b, const char *path, uint32_t magic, uint32_t version)
+{
+	FILE *f;
+	unsigned char buf[BLOB_HEADER_SIZE];
+	uint32_t length;
+
+	blob_init(b);
+
+	f = fopen(path, "r");
+	if (NULL == f) {
+		DPRINTF("Can't open '%s': %s", path, ERRMSG);
+		return -1;
+	}
+
+	if ( (1 != fread(buf, sizeof(buf), 1, f))
+		|| (le_decode(buf, 4) != magic) || (le_decode(buf + 4, 4) != version) )
+	{
+		DPRINTF("File '%s' have wrong header", path);
+		fclose(f);
+		return -1;
+	}
+	length = le_decode(buf + 8, 4);
+
+	b->data = malloc(length ? length : 1);
+	if (NULL == b->data) {
+		DPRINTF("Can't allocate %u bytes for '%s'", length, path);
+		fclose(f);
+		return -1;
+	}
+	b->size = length;
+
+	if (length && (1 != fread(b->data, length, 1, f))) {
+		DPRINTF("File '%s' is truncated", path);
+		fclose(f);
+		blob_free(b);
+		return -1;
+	}
+	fclose(f);
+
+	b->fill = length;
+	if (fnv_hash(b->data, b->fill) != le_decode(buf + 12, 4)) {
+		DPRINTF("File '%s' have wrong checksum", path);
+		blob_free(b);
+		return -1;
+	}
+
+	return 0;
+}
+
+
+uint32_t fnv_hash(const void *data, size_t len)
+{
+	const unsigned char *p = data;
+	uint32_t hash = 2166136261U;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+#endif
+
+
+/* Arena memory is taken from chunks of this size at least */
+#define ARENA_CHUNK_SIZE	1024
+/* Alignment of arena allocations (enough for long long on ARM) */
+#define ARENA_ALIGN			8
+#define arena_round(n)		(((n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+struct kx_arena_chunk {
+	struct kx_arena_chunk *next;
+	size_t size;	/* Usable bytes */
+	size_t used;
+};
+
+/* Data of chunk starts after aligned header */
+#define ARENA_HDR_SIZE		arena_round(sizeof(struct kx_arena_chunk))
+
+#ifdef DEBUG
+static size_t arena_bytes = 0;
+
+size_t arena_held(void)
+{
+	return arena_bytes;
+}
+#endif
+
+
+void arena_init(kx_arena *a)
+{
+	a->chunks = NULL;
+}
+
+
+void *arena_alloc(kx_arena *a, size_t size)
+{
+	struct kx_arena_chunk *c;
+	size_t chunk_size;
+	void *p;
+
+	size = arena_round(size);
+	c = a->chunks;
+
+	if (!c || (c->size - c->used < size)) {
+		chunk_size = (size > ARENA_CHUNK_SIZE) ? size : ARENA_CHUNK_SIZE;
+		c = malloc(ARENA_HDR_SIZE + chunk_size);
+		if (NULL == c) {
+			DPRINTF("Can't allocate arena chunk");
+			return NULL;
+		}
+		c->size = chunk_size;
+		c->used = 0;
+		c->next = a->chunks;
+		a->chunks = c;
+#ifdef DEBUG
+		arena_bytes += ARENA_HDR_SIZE + chunk_size;
+#endif
+	}
+
+	p = (char *)c + ARENA_HDR_SIZE + c->used;
+	c->used += size;
+	return p;
+}
+
+
+char *arena_strdup(kx_arena *a, const char *str)
+{
+	char *p;
+	size_t len;
+
+	if (!str) return NULL;
+
+	len = strlen(str) + 1;
+	p = arena_alloc(a, len);
+	if (p) memcpy(p, str, len);
+	return p;
+}
+
+
+void arena_free(kx_arena *a)
+{
+	struct kx_arena_chunk *c;
+
+	while (a->chunks) {
+		c = a->chunks;
+		a->chunks = c->next;
+#ifdef DEBUG
+		arena_bytes -= ARENA_HDR_SIZE + c->size;
+#endif
+		free(c);
+	}
+}
+
+
 kx_text *log_open(unsigned int size)
 {
 	kx_text *log;
@@ -114,17 +486,44 @@ void log_plain_msg(kx_text *log, char *msg)
 	fputs("\n", stderr);
 }
 
+#ifdef USE_THREADS
+/* Log may be written by device scanning threads */
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Messages of current thread are dropped when this is set */
+static __thread int *log_dropped;
+
+void log_drop_on(int *flag)
+{
+	log_dropped = flag;
+}
+
+void log_drop(int *flag)
+{
+	pthread_mutex_lock(&log_lock);
+	*flag = 1;
+	pthread_mutex_unlock(&log_lock);
+}
+#endif
+
 /* Log message */
 void log_msg(kx_text *log, char *fmt, ...)
 {
-	static char *b, *e, buf[512];
-	static va_list ap;
+	char *b, *e, buf[512];
+	va_list ap;
 
 	/* Format string */
 	va_start(ap, fmt);
 	vsnprintf((char *)&buf, sizeof(buf), fmt, ap);
 	va_end(ap);
-	
+
+#ifdef USE_THREADS
+	pthread_mutex_lock(&log_lock);
+	if (log_dropped && *log_dropped) {
+		pthread_mutex_unlock(&log_lock);
+		return;
+	}
+#endif
 	/* Split strings by '\n' and add to charlist */
 	b = buf;
 	while (NULL != (e = strchr(b, '\n'))) {
@@ -135,6 +534,9 @@ void log_msg(kx_text *log, char *fmt, ...)
 
 	/* Process latest part of string if any */
 	if (*b != '\0') log_plain_msg(log, b);
+#ifdef USE_THREADS
+	pthread_mutex_unlock(&log_lock);
+#endif
 }
 
 void log_close(kx_text *log)
@@ -234,7 +636,7 @@ char *ltrim(char *str)
 /* Get unsigned long-long integer */
 unsigned long long get_nnll(const char *str, char **endptr, int *error_flag)
 {
-	static unsigned long long val;
+	unsigned long long val;
 
 	errno = 0;
 	val = strtoull(str, endptr, 10);
@@ -261,8 +663,8 @@ unsigned long long get_nnll(const char *str, char **endptr, int *error_flag)
 /* Get non-negative integer */
 int get_nni(const char *str, char **endptr)
 {
-	static unsigned long long val;
-	static int eflag;
+	unsigned long long val;
+	int eflag;
 
 	eflag = 0;
 	val = get_nnll(str, endptr, &eflag);
@@ -388,68 +790,147 @@ int fexecw(const char *path, char *const argv[], char *const envp[])
 }
 
 /*
- * wrapper around fexecw ubiattach
+ * write number of MTD device 'device' (/dev/mtdN or /dev/mtdblockN)
+ * to 'mtd_id' of 'size' bytes
+ * on error (not MTD device), returns -1
+ */
+int mtd_id_of(const char *device, char *mtd_id, size_t size)
+{
+	const char *p;
+	char *end;
+	long n;
+
+	p = strrchr(device, '/');
+	p = p ? p + 1 : device;
+	if (strncmp(p, "mtd", 3)) return -1;
+	p += 3;
+	if (!strncmp(p, "block", 5)) p += 5;
+
+	errno = 0;
+	n = strtol(p, &end, 10);
+	if ((end == p) || ('\0' != *end) || (n < 0) || (n > INT_MAX) || errno)
+		return -1;
+
+	snprintf(mtd_id, size, "%ld", n);
+	return 0;
+}
+
+/*
+ * attach MTD device mtd_id with UBI_IOCATT ioctl
  * returns ubi_id attached to mtd_id
  * on error, returns -1 so that mount fails
  */
 int ubi_attach(const char *mtd_id)
 {
-	/* prepare ubiattach_argv[] */
-	const char *ubiattach_argv[] = { NULL, NULL, NULL, NULL };
-	char *const envp[] = { NULL };
-	int n,res;
-
-	ubiattach_argv[0] = UBIATTACH_PATH;
-	ubiattach_argv[1] = "-m";
-	ubiattach_argv[2] = mtd_id;
+	struct ubi_attach_req req;
+	int fd, n;
 
+	memset(&req, 0, sizeof(req));
+	req.ubi_num = UBI_DEV_NUM_AUTO;
+	req.mtd_num = atoi(mtd_id);
 #ifdef UBI_VID_HDR_OFFSET
-	ubiattach_argv[3] = "-O" UBI_VID_HDR_OFFSET;
+	req.vid_hdr_offset = atoi(UBI_VID_HDR_OFFSET);
 #endif
 
-	/* fexecw ubiattach */
-	n = fexecw(UBIATTACH_PATH, (char *const *)ubiattach_argv, envp);
+	fd = open(UBI_CTRL_DEV, O_RDONLY | O_CLOEXEC);
+	if (-1 == fd) {
+		log_msg(lg, "+ can't open %s: %s", UBI_CTRL_DEV, ERRMSG);
+		return -1;
+	}
+
+	/* UBI device number is returned in req.ubi_num */
+	n = ioctl(fd, UBI_IOCATT, &req);
+	close(fd);
 	if (-1 == n) {
-		log_msg(lg, "+ ubiattach failed: %s", ERRMSG);
-		res = -1;
-	} else {
-		res = find_attached_ubi_device(mtd_id);
+		/* Attached already by previous scan */
+		if (EEXIST == errno) return find_attached_ubi_device(mtd_id);
+
+		log_msg(lg, "+ can't attach /dev/mtd%s: %s", mtd_id, ERRMSG);
+		return -1;
 	}
-	return res;
+
+	log_msg(lg, "+ map /dev/ubi%d on /dev/mtd%s", req.ubi_num, mtd_id);
+	return req.ubi_num;
 }
 
 
 /*
- * loop until /sys/class/ubi/ubiX/mtd_num == mtd_id
- * kernel: max 32 ubi devices (0-31)
- * kernel: max 16 mtd char devices (0-15)
+ * look for ubiX in /sys/class/ubi with ubiX/mtd_num == mtd_id
+ * only devices present are checked
  */
 int find_attached_ubi_device(const char *mtd_id)
 {
-	char sys_class_ubi[32]; /* max 26 + 2 + 1 */
-	int ubi_id;
-	char line[3];
+	char path[64];
+	char line[16];
+	int ubi_id, mtd_num;
 	int res = -1;
+	char *end;
+	DIR *d;
+	struct dirent *de;
 	FILE *f;
 
-	for (ubi_id = 0; ubi_id < 32; ubi_id++)
-	{
-		snprintf(sys_class_ubi, sizeof(sys_class_ubi), "/sys/class/ubi/ubi%d/mtd_num", ubi_id);
-		f = fopen(sys_class_ubi, "r");
-		if (NULL == f) {
-			/* log_msg(lg, "+ missing ubi%d in sysfs: %s", ubi_id, ERRMSG); */
-		} else {
-			/* We have only one line in that file */
-			if (fgets(line, sizeof(line), f)) {
-				line[strlen(line) - 1] = '\0';
-				if (!strncmp(line, mtd_id, 2)) {
-					log_msg(lg, "+ map /dev/ubi%d on /dev/mtd%s", ubi_id, mtd_id);
-					res = ubi_id;
-				}
-			}
-			fclose(f);
-			if (res >= 0) break;
+	d = opendir("/sys/class/ubi");
+	if (NULL == d) {
+		log_msg(lg, "+ can't open /sys/class/ubi: %s", ERRMSG);
+		return -1;
+	}
+
+	mtd_num = atoi(mtd_id);
+	while ((res < 0) && (NULL != (de = readdir(d)))) {
+		/* Skip volumes (ubiX_Y) and other entries */
+		if (strncmp(de->d_name, "ubi", 3)) continue;
+		ubi_id = get_nni(de->d_name + 3, &end);
+		if ((ubi_id < 0) || ('\0' != *end)) continue;
+
+		snprintf(path, sizeof(path), "/sys/class/ubi/ubi%d/mtd_num", ubi_id);
+		f = fopen(path, "r");
+		if (NULL == f) continue;
+
+		/* We have only one line in that file */
+		if (fgets(line, sizeof(line), f) && (atoi(line) == mtd_num)) {
+			log_msg(lg, "+ map /dev/ubi%d on /dev/mtd%s", ubi_id, mtd_id);
+			res = ubi_id;
 		}
+		fclose(f);
 	}
+
+	closedir(d);
 	return res;
 }
+
+
+int ubi_volumes(int ubi_num, int *vols, int size)
+{
+	char path[32];
+	char prefix[16];
+	int n, len, vol, i;
+	char *end;
+	DIR *d;
+	struct dirent *de;
+
+	snprintf(path, sizeof(path), "/sys/class/ubi/ubi%d", ubi_num);
+	d = opendir(path);
+	if (NULL == d) {
+		log_msg(lg, "+ can't open %s: %s", path, ERRMSG);
+		return -1;
+	}
+
+	/* Volumes are ubiX_Y entries */
+	len = snprintf(prefix, sizeof(prefix), "ubi%d_", ubi_num);
+	n = 0;
+	while ((n < size) && (NULL != (de = readdir(d)))) {
+		if (strncmp(de->d_name, prefix, len)) continue;
+		vol = get_nni(de->d_name + len, &end);
+		if ((vol < 0) || ('\0' != *end)) continue;
+
+		/* Keep ids sorted */
+		for (i = n; (i > 0) && (vols[i - 1] > vol); i--)
+			vols[i] = vols[i - 1];
+		vols[i] = vol;
+		++n;
+	}
+
+	closedir(d);
+	log_msg(lg, "+ /dev/ubi%d have %d volume(s)", ubi_num, n);
+	return n;
+}
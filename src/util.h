@@ -20,6 +20,7 @@
 #define _HAVE_UTIL_H_
 
 #include <stdint.h>     /* uint's below */
+#include <stddef.h>     /* size_t */
 
 #ifndef COMMAND_LINE_SIZE
 #define COMMAND_LINE_SIZE 1024
@@ -64,6 +65,23 @@ struct charlist {
 	unsigned int fill;
 };
 
+#ifdef USE_BLOBS
+/* Growable buffer of serialized data */
+typedef struct {
+	unsigned char *data;
+	size_t size;	/* Allocated bytes */
+	size_t fill;	/* Used bytes */
+	size_t pos;		/* Read position */
+	int error;		/* Set on allocation failure or reading beyond end */
+} kx_blob;
+#endif
+
+/* Bump allocator. Memory is released at once by arena_free() */
+struct kx_arena_chunk;
+typedef struct {
+	struct kx_arena_chunk *chunks;	/* Newest chunk first */
+} kx_arena;
+
 /* Text structure */
 typedef struct {
 	unsigned int current_line_no;
@@ -90,6 +108,62 @@ void addto_charlist(struct charlist *cl, const char *str);
 int in_charlist(struct charlist *cl, const char *str);
 
 
+#ifdef USE_BLOBS
+/* Initialize empty blob */
+void blob_init(kx_blob *b);
+
+/* Free blob data */
+void blob_free(kx_blob *b);
+
+/* Append 'len' bytes of 'data' to blob 'b' */
+void blob_put(kx_blob *b, const void *data, size_t len);
+
+/* Append number in little-endian byte order */
+void blob_put_u32(kx_blob *b, uint32_t val);
+void blob_put_u64(kx_blob *b, uint64_t val);
+
+/* Append string 'str' (may be NULL) */
+void blob_put_str(kx_blob *b, const char *str);
+
+/* Read 'len' bytes from blob 'b' into 'data'. Return 0 or -1 on error */
+int blob_get(kx_blob *b, void *data, size_t len);
+uint32_t blob_get_u32(kx_blob *b);
+uint64_t blob_get_u64(kx_blob *b);
+
+/* Read string. Return malloc()'ed string or NULL */
+char *blob_get_str(kx_blob *b);
+
+/* Write blob 'b' to file 'path' with header of 'magic' and 'version'.
+ * File is replaced atomically. Return 0 or -1 on error */
+int blob_save(kx_blob *b, const char *path, uint32_t magic, uint32_t version);
+
+/* Read blob 'b' from file 'path' written by blob_save() and check header
+ * and checksum. Return 0 or -1 on error */
+int blob_load(kx_blob *b, const char *path, uint32_t magic, uint32_t version);
+
+/* Calculate 32-bit FNV-1a hash of 'len' bytes of 'data' */
+uint32_t fnv_hash(const void *data, size_t len);
+#endif
+
+
+/* Initialize empty arena */
+void arena_init(kx_arena *a);
+
+/* Allocate 'size' bytes from arena 'a'. Return NULL on error */
+void *arena_alloc(kx_arena *a, size_t size);
+
+/* Copy string 'str' (may be NULL) into arena 'a' */
+char *arena_strdup(kx_arena *a, const char *str);
+
+/* Release all memory of arena 'a' */
+void arena_free(kx_arena *a);
+
+#ifdef DEBUG
+/* Bytes held by all arenas */
+size_t arena_held(void);
+#endif
+
+
 /* Create log structure of 'size' initial rows */
 kx_text *log_open(unsigned int size);
 
@@ -99,6 +173,14 @@ void log_msg(kx_text *log, char *fmt, ...);
 /* Destroy log structure */
 void log_close(kx_text *log);
 
+#ifdef USE_THREADS
+/* Drop messages of current thread once '*flag' is set (NULL - never) */
+void log_drop_on(int *flag);
+
+/* Set '*flag' so thread watching it can't log anymore */
+void log_drop(int *flag);
+#endif
+
 
 /* Strip leading and trailing white-space */
 /* NOTE: this will modify str */
@@ -151,10 +233,26 @@ void setup_terminal(char *ttydev, int *echo_state, int mode);
  */
 int fexecw(const char *path, char *const argv[], char *const envp[]);
 
-/* UBI attach MTD device to mtd_id */
+/* UBI control device to attach MTD devices with */
+#define UBI_CTRL_DEV	"/dev/ubi_ctrl"
+
+/* Max number of volumes of one UBI device */
+#define UBI_MAX_VOLUMES	128
+
+/* Room for decimal MTD number with terminating zero */
+#define MTD_ID_SIZE	12
+
+/* Write number of MTD device 'device' to 'mtd_id'. Return 0 or -1 */
+int mtd_id_of(const char *device, char *mtd_id, size_t size);
+
+/* UBI attach MTD device to mtd_id. Return UBI device number or -1 */
 int ubi_attach(const char *mtd_id);
 
 /* Find UBI device attached to mtd_id */
 int find_attached_ubi_device(const char *mtd_id);
 
+/* Fill 'vols' with ids of volumes of UBI device 'ubi_num' in ascending
+ * order. Return number of volumes or -1 on error */
+int ubi_volumes(int ubi_num, int *vols, int size);
+
 #endif //_HAVE_UTIL_H_